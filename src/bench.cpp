@@ -0,0 +1,273 @@
+#include "cpu/cpu.h"
+#include "programs/snake.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utils/types.h>
+#include <vector>
+
+// Throughput benchmarks for the 6502 core. Each benchmark runs through the
+// batched API (cpu::run_instructions) for at least --min-time seconds and
+// prints one JSON object per line, so results can be appended to a log and
+// compared across commits:
+//
+//   {"bench":"lda_zp","instructions":...,"cycles":...,"seconds":...,
+//    "mips":...,"ns_per_instruction":...,"cycles_per_second":...}
+//
+// --engine cached runs the same batches on the decode cache instead of the
+// threaded interpreter, and --engine jit with hot blocks compiled to native
+// code.
+//
+// Micro benchmarks repeat a single instruction (or a short sequence) to fill
+// a page and jump back, so the loop overhead is one JMP per ~100
+// instructions. Macro benchmarks run the snake game and a synthetic
+// checksum loop.
+
+namespace snake = nes_simulator::snake;
+using nes_simulator::uint8;
+using nes_simulator::uint64;
+
+namespace {
+
+// Zero page $10/$11 points at $0300 for the indirect modes; X and Y are 1 and
+// A is non-zero, so BNE is taken and BEQ is not.
+const std::vector<uint8> prologue = {
+    0xA9, 0x00, // LDA #$00
+    0x85, 0x10, // STA $10
+    0xA9, 0x03, // LDA #$03
+    0x85, 0x11, // STA $11
+    0xA2, 0x01, // LDX #$01
+    0xA0, 0x01, // LDY #$01
+    0xA9, 0x01, // LDA #$01
+};
+
+struct benchmark {
+  const char *name;
+  std::vector<uint8> program;
+  // Reloads the program and restarts it from reset whenever it halts.
+  bool restart_on_halt = false;
+  // Called every `interval` instructions, for programs that poll memory.
+  uint64 interval = 0;
+  void (*feed)(nes_simulator::cpu &, uint64 tick) = nullptr;
+};
+
+// prologue, then `body` repeated to fill about 200 bytes, then a JMP back to
+// the first repetition.
+std::vector<uint8> repeat(std::vector<uint8> body) {
+  auto program = prologue;
+  const auto loop = 0x600 + program.size();
+  for (std::size_t size = 0; size + body.size() <= 200; size += body.size()) {
+    program.insert(program.end(), body.begin(), body.end());
+  }
+  program.insert(program.end(), {0x4C, uint8(loop & 0xFF), uint8(loop >> 8)});
+  return program;
+}
+
+// prologue, then `count` JSRs to an RTS placed after the loop.
+std::vector<uint8> jsr_rts(int count) {
+  auto program = prologue;
+  const auto loop = 0x600 + program.size();
+  const auto subroutine = loop + count * 3 + 3;
+  for (int i = 0; i < count; i++) {
+    program.insert(program.end(), {0x20, uint8(subroutine & 0xFF),
+                                   uint8(subroutine >> 8)});
+  }
+  program.insert(program.end(), {0x4C, uint8(loop & 0xFF), uint8(loop >> 8)});
+  program.push_back(0x60);
+  return program;
+}
+
+// Sums 8 pages starting at $0300 into $20 through a (zp),Y pointer, copies
+// each byte to $1000,Y on the way, and starts over: a mix of loads, stores,
+// ALU, increments and taken/untaken branches typical of game loops.
+const std::vector<uint8> checksum_loop = {
+    0xA9, 0x00,       // start: LDA #$00
+    0x85, 0x10,       //   STA $10
+    0x85, 0x20,       //   STA $20
+    0xA9, 0x03,       //   LDA #$03
+    0x85, 0x11,       //   STA $11
+    0xA2, 0x08,       //   LDX #$08
+    0xA0, 0x00,       // page: LDY #$00
+    0xB1, 0x10,       // byte: LDA ($10),Y
+    0x99, 0x00, 0x10, //   STA $1000,Y
+    0x18,             //   CLC
+    0x65, 0x20,       //   ADC $20
+    0x85, 0x20,       //   STA $20
+    0xC8,             //   INY
+    0xD0, 0xF3,       //   BNE byte
+    0xE6, 0x11,       //   INC $11
+    0xCA,             //   DEX
+    0xD0, 0xEC,       //   BNE page
+    0x4C, 0x00, 0x06, //   JMP start
+};
+
+std::vector<benchmark> benchmarks() {
+  std::vector<benchmark> list = {
+      {"lda_imm", repeat({0xA9, 0x01})},
+      {"lda_zp", repeat({0xA5, 0x10})},
+      {"lda_zpx", repeat({0xB5, 0x10})},
+      {"lda_abs", repeat({0xAD, 0x00, 0x03})},
+      {"lda_absx", repeat({0xBD, 0x00, 0x03})},
+      {"lda_absx_page_cross", repeat({0xBD, 0xFF, 0x03})},
+      {"lda_absy", repeat({0xB9, 0x00, 0x03})},
+      {"lda_indx", repeat({0xA1, 0x0F})},
+      {"lda_indy", repeat({0xB1, 0x10})},
+      {"sta_zp", repeat({0x85, 0x30})},
+      {"sta_zpx", repeat({0x95, 0x30})},
+      {"sta_abs", repeat({0x8D, 0x00, 0x03})},
+      {"sta_absx", repeat({0x9D, 0x00, 0x03})},
+      {"sta_absy", repeat({0x99, 0x00, 0x03})},
+      {"sta_indx", repeat({0x81, 0x0F})},
+      {"sta_indy", repeat({0x91, 0x10})},
+      {"adc_imm", repeat({0x69, 0x01})},
+      {"sbc_zp", repeat({0xE5, 0x10})},
+      {"and_ora_eor", repeat({0x29, 0xFF, 0x09, 0x01, 0x49, 0x00})},
+      {"cmp_imm", repeat({0xC9, 0x01})},
+      {"asl_lsr_acc", repeat({0x0A, 0x4A})},
+      {"rol_ror_zp", repeat({0x26, 0x30, 0x66, 0x30})},
+      {"inc_dec_zp", repeat({0xE6, 0x30, 0xC6, 0x30})},
+      {"inx_dey", repeat({0xE8, 0x88})},
+      {"transfers", repeat({0xAA, 0x8A, 0xA8, 0x98})},
+      {"flags", repeat({0x18, 0x38, 0xB8})},
+      {"branch_taken", repeat({0xD0, 0x00})},
+      {"branch_untaken", repeat({0xF0, 0x00})},
+      {"pha_pla", repeat({0x48, 0x68})},
+      {"php_plp", repeat({0x08, 0x28})},
+      {"jsr_rts", jsr_rts(32)},
+      {"checksum_loop", checksum_loop},
+  };
+
+  // The snake game with deterministic randomness and a fixed steering
+  // pattern; it restarts whenever the snake dies.
+  benchmark game{"snake", {}, true, 1000};
+  game.program.assign(std::begin(snake::game_code),
+                      std::end(snake::game_code));
+  game.feed = [](nes_simulator::cpu &cpu, uint64 tick) {
+    static constexpr uint8 keys[] = {snake::KEY_RIGHT, snake::KEY_DOWN,
+                                     snake::KEY_LEFT, snake::KEY_UP};
+    cpu.mem_write(snake::RANDOM,
+                  snake::random_byte(tick * 2654435761u >> 16));
+    if (tick % 16 == 0) {
+      cpu.mem_write(snake::INPUT, keys[tick / 16 % 4]);
+    }
+  };
+  list.push_back(std::move(game));
+  return list;
+}
+
+struct result {
+  uint64 instructions;
+  uint64 cycles;
+  double seconds;
+};
+
+result run(const benchmark &bench, nes_simulator::Engine engine,
+           double min_time) {
+  using clock = std::chrono::steady_clock;
+  constexpr uint64 batch = 1 << 20;
+
+  std::unique_ptr<nes_simulator::cpu> cpu;
+  uint64 tick = 0;
+  auto restart = [&] {
+    cpu = std::make_unique<nes_simulator::cpu>();
+    cpu->engine = engine;
+    cpu->load(bench.program.data(), bench.program.size());
+    cpu->reset();
+    if (bench.feed) {
+      cpu->add_interval_hook(bench.interval, [&](nes_simulator::cpu &c) {
+        bench.feed(c, ++tick);
+      });
+    }
+  };
+  restart();
+
+  result total{0, 0, 0};
+  const auto start = clock::now();
+  while (clock::now() - start < std::chrono::duration<double>(min_time)) {
+    const uint64 instructions = cpu->instructions;
+    const uint64 cycles = cpu->cycles;
+    cpu->run_instructions(batch);
+    total.instructions += cpu->instructions - instructions;
+    total.cycles += cpu->cycles - cycles;
+
+    if (cpu->halted) {
+      if (!bench.restart_on_halt) {
+        throw std::runtime_error(std::string(bench.name) + " halted");
+      }
+      restart();
+    }
+  }
+  total.seconds = std::chrono::duration<double>(clock::now() - start).count();
+  return total;
+}
+
+void usage() {
+  std::cerr << "usage: bench [--filter SUBSTRING] [--min-time SECONDS] "
+               "[--engine threaded|cached|jit] [--list]"
+            << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  std::string filter;
+  double min_time = 0.5;
+  auto engine = nes_simulator::Engine::Threaded;
+  bool list = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+      min_time = std::strtod(argv[++i], nullptr);
+    } else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+      const std::string name = argv[++i];
+      if (name == "threaded") {
+        engine = nes_simulator::Engine::Threaded;
+      } else if (name == "cached") {
+        engine = nes_simulator::Engine::Cached;
+      } else if (name == "jit") {
+        engine = nes_simulator::Engine::Jit;
+      } else {
+        usage();
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--list") == 0) {
+      list = true;
+    } else {
+      usage();
+      return 1;
+    }
+  }
+
+  try {
+    for (const auto &bench : benchmarks()) {
+      if (std::string(bench.name).find(filter) == std::string::npos) {
+        continue;
+      }
+      if (list) {
+        std::printf("%s\n", bench.name);
+        continue;
+      }
+
+      const auto r = run(bench, engine, min_time);
+      std::printf("{\"bench\":\"%s\",\"instructions\":%llu,\"cycles\":%llu,"
+                  "\"seconds\":%.6f,\"mips\":%.2f,"
+                  "\"ns_per_instruction\":%.3f,\"cycles_per_second\":%.0f}\n",
+                  bench.name, (unsigned long long)r.instructions,
+                  (unsigned long long)r.cycles, r.seconds,
+                  r.instructions / r.seconds / 1e6,
+                  r.seconds * 1e9 / r.instructions, r.cycles / r.seconds);
+      std::fflush(stdout);
+    }
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,200 @@
+#include "cartridge/cartridge.h"
+#include "cpu/cpu.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace nes_simulator {
+
+namespace {
+
+// NES 2.0 sizes: a 12-bit count of `unit`s, or, when the high nibble is $F,
+// 2^E * (2M + 1) bytes with the low byte holding E in bits 7-2 and M in bits
+// 1-0.
+uint64 rom_size(uint8 lsb, uint8 msb, uint64 unit) {
+  if (msb != 0xF) {
+    return (uint64{msb} << 8 | lsb) * unit;
+  }
+  const uint8 exponent = lsb >> 2;
+  if (exponent > 40) {
+    throw std::runtime_error("ROM size exponent too large");
+  }
+  return (uint64{1} << exponent) * ((lsb & 3) * 2 + 1);
+}
+
+uint64 ram_size(uint8 shift) { return shift ? uint64{64} << shift : 0; }
+
+std::runtime_error system_error(const std::string &what,
+                                const std::string &path) {
+  return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+
+} // namespace
+
+ines_header parse_ines_header(std::span<const uint8> data) {
+  if (data.size() < INES_HEADER_SIZE ||
+      std::memcmp(data.data(), "NES\x1A", 4) != 0) {
+    throw std::runtime_error("not an iNES file");
+  }
+
+  ines_header header{};
+  const uint8 flags6 = data[6];
+  const uint8 flags7 = data[7];
+  header.nes2 = (flags7 & 0x0C) == 0x08;
+  header.battery = flags6 & 0x02;
+  header.trainer = flags6 & 0x04;
+  if (flags6 & 0x08) {
+    header.mirroring = Mirroring::FourScreen;
+  } else {
+    header.mirroring =
+        flags6 & 0x01 ? Mirroring::Vertical : Mirroring::Horizontal;
+  }
+
+  if (header.nes2) {
+    header.mapper = (data[8] & 0x0F) << 8 | (flags7 & 0xF0) | flags6 >> 4;
+    header.submapper = data[8] >> 4;
+    header.prg_rom_size = rom_size(data[4], data[9] & 0x0F, PRG_BANK_SIZE);
+    header.chr_rom_size = rom_size(data[5], data[9] >> 4, CHR_BANK_SIZE);
+    header.prg_ram_size = ram_size(data[10] & 0x0F);
+    header.prg_nvram_size = ram_size(data[10] >> 4);
+    header.chr_ram_size = ram_size(data[11] & 0x0F);
+    header.chr_nvram_size = ram_size(data[11] >> 4);
+    return header;
+  }
+
+  // Old dumping tools wrote signatures such as "DiskDude!" into bytes 7-15;
+  // when the unused tail is dirty, the upper mapper nibble is garbage too.
+  const bool dirty_tail = data[12] || data[13] || data[14] || data[15];
+  header.mapper = (dirty_tail ? 0 : flags7 & 0xF0) | flags6 >> 4;
+  header.prg_rom_size = uint64{data[4]} * PRG_BANK_SIZE;
+  header.chr_rom_size = uint64{data[5]} * CHR_BANK_SIZE;
+  // A PRG RAM size of 0 means 8 KB, for compatibility with older dumps.
+  const uint64 prg_ram = uint64{data[8] ? data[8] : uint8{1}} * 0x2000;
+  (header.battery ? header.prg_nvram_size : header.prg_ram_size) = prg_ram;
+  header.chr_ram_size = header.chr_rom_size ? 0 : CHR_BANK_SIZE;
+  return header;
+}
+
+cartridge::cartridge(const std::string &path)
+    : data(nullptr), size(0), info() {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw system_error("cannot open", path);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    const auto error = system_error("cannot stat", path);
+    close(fd);
+    throw error;
+  }
+  if (st.st_size < static_cast<off_t>(INES_HEADER_SIZE)) {
+    close(fd);
+    throw std::runtime_error(path + ": not an iNES file");
+  }
+
+  // The mapping keeps the file referenced, so the descriptor can go.
+  void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (mapping == MAP_FAILED) {
+    const auto error = system_error("cannot map", path);
+    close(fd);
+    throw error;
+  }
+  close(fd);
+  data = static_cast<const uint8 *>(mapping);
+  size = st.st_size;
+
+  try {
+    const std::span<const uint8> file(data, size);
+    info = parse_ines_header(file);
+    const std::size_t trainer_size = info.trainer ? INES_TRAINER_SIZE : 0;
+    if (INES_HEADER_SIZE + trainer_size + info.prg_rom_size +
+            info.chr_rom_size >
+        size) {
+      throw std::runtime_error("file is shorter than its header says");
+    }
+    trainer_data = file.subspan(INES_HEADER_SIZE, trainer_size);
+    prg = file.subspan(INES_HEADER_SIZE + trainer_size, info.prg_rom_size);
+    chr = file.subspan(INES_HEADER_SIZE + trainer_size + info.prg_rom_size,
+                       info.chr_rom_size);
+  } catch (const std::runtime_error &e) {
+    release();
+    throw std::runtime_error(path + ": " + e.what());
+  }
+
+  // Banks are read wherever the game jumps; ask for the whole file up front
+  // rather than faulting it in page by page.
+  madvise(mapping, size, MADV_WILLNEED);
+}
+
+cartridge::~cartridge() { release(); }
+
+cartridge::cartridge(cartridge &&other) noexcept
+    : data(std::exchange(other.data, nullptr)),
+      size(std::exchange(other.size, 0)), info(other.info),
+      trainer_data(other.trainer_data), prg(other.prg), chr(other.chr) {}
+
+cartridge &cartridge::operator=(cartridge &&other) noexcept {
+  if (this != &other) {
+    release();
+    data = std::exchange(other.data, nullptr);
+    size = std::exchange(other.size, 0);
+    info = other.info;
+    trainer_data = other.trainer_data;
+    prg = other.prg;
+    chr = other.chr;
+  }
+  return *this;
+}
+
+void cartridge::release() {
+  if (data) {
+    munmap(const_cast<uint8 *>(data), size);
+    data = nullptr;
+    size = 0;
+  }
+}
+
+std::span<const uint8> cartridge::prg_bank(uint32 index,
+                                           uint32 bank_size) const {
+  if (bank_size == 0 || prg.size() < bank_size) {
+    return {};
+  }
+  return prg.subspan(index % (prg.size() / bank_size) * bank_size, bank_size);
+}
+
+std::span<const uint8> cartridge::chr_bank(uint32 index,
+                                           uint32 bank_size) const {
+  if (bank_size == 0 || chr.size() < bank_size) {
+    return {};
+  }
+  return chr.subspan(index % (chr.size() / bank_size) * bank_size, bank_size);
+}
+
+void cartridge::map(cpu &cpu) const {
+  if (info.mapper != 0) {
+    throw std::runtime_error("unsupported mapper " +
+                             std::to_string(info.mapper));
+  }
+  if (prg.size() != PRG_BANK_SIZE && prg.size() != 2 * PRG_BANK_SIZE) {
+    throw std::runtime_error("NROM needs 16 or 32 KB of PRG ROM");
+  }
+
+  cpu.bus.map_ram(0x6000, 0x8000, 0x2000);
+  if (!trainer_data.empty()) {
+    std::memcpy(cpu.memory + 0x7000, trainer_data.data(), trainer_data.size());
+  }
+  // The bus reads each bank in place, so ROM pages point into the file
+  // mapping; 16 KB boards mirror their one bank into $C000-$FFFF.
+  const auto low = prg_bank(0);
+  const auto high = prg_bank(1);
+  cpu.bus.map_rom(0x8000, 0xC000, low.data(), low.size());
+  cpu.bus.map_rom(0xC000, 0x10000, high.data(), high.size());
+}
+
+} // namespace nes_simulator
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <string>
+#include <utils/types.h>
+
+namespace nes_simulator {
+
+class cpu;
+
+enum class Mirroring {
+  Horizontal,
+  Vertical,
+  FourScreen,
+};
+
+struct ines_header {
+  bool nes2;
+  uint16 mapper;
+  uint8 submapper;
+  Mirroring mirroring;
+  bool battery;
+  bool trainer;
+  uint64 prg_rom_size;
+  uint64 chr_rom_size;
+  // Volatile and battery-backed RAM on the cartridge. iNES 1.0 headers only
+  // give the PRG RAM size; CHR RAM is assumed when there is no CHR ROM.
+  uint64 prg_ram_size;
+  uint64 prg_nvram_size;
+  uint64 chr_ram_size;
+  uint64 chr_nvram_size;
+};
+
+constexpr std::size_t INES_HEADER_SIZE = 16;
+constexpr std::size_t INES_TRAINER_SIZE = 512;
+constexpr uint32 PRG_BANK_SIZE = 0x4000;
+constexpr uint32 CHR_BANK_SIZE = 0x2000;
+
+// Parses an iNES or NES 2.0 header; throws std::runtime_error if `data` does
+// not start with one.
+ines_header parse_ines_header(std::span<const uint8> data);
+
+// An iNES / NES 2.0 ROM file mapped read-only into memory. The trainer, PRG
+// and CHR spans point straight into the mapping, so opening a ROM costs a
+// header parse regardless of its size, and every cartridge opened on the same
+// file shares the kernel's page-cache copy of it.
+class cartridge {
+public:
+  // Throws std::runtime_error if the file cannot be mapped, is not an iNES
+  // file, or is shorter than its header says.
+  explicit cartridge(const std::string &path);
+  ~cartridge();
+  cartridge(cartridge &&other) noexcept;
+  cartridge &operator=(cartridge &&other) noexcept;
+  cartridge(const cartridge &) = delete;
+  cartridge &operator=(const cartridge &) = delete;
+
+  const ines_header &header() const { return info; }
+
+  std::span<const uint8> trainer() const { return trainer_data; }
+  std::span<const uint8> prg_rom() const { return prg; }
+  std::span<const uint8> chr_rom() const { return chr; }
+
+  // The `index`th bank of `bank_size` bytes, wrapping around the ROM like
+  // the address lines of a mapper that ignores the high bits.
+  std::span<const uint8> prg_bank(uint32 index,
+                                  uint32 bank_size = PRG_BANK_SIZE) const;
+  std::span<const uint8> chr_bank(uint32 index,
+                                  uint32 bank_size = CHR_BANK_SIZE) const;
+
+  // Maps PRG RAM at $6000-$7FFF (with the trainer at $7000) and PRG ROM at
+  // $8000-$FFFF onto the cpu's bus. The ROM pages point straight into the
+  // file mapping, so the cartridge must outlive the mapping (or the cpu).
+  // Only NROM (mapper 0) is supported; other mappers throw
+  // std::runtime_error.
+  void map(cpu &cpu) const;
+
+private:
+  void release();
+
+  const uint8 *data;
+  std::size_t size;
+  ines_header info;
+  std::span<const uint8> trainer_data;
+  std::span<const uint8> prg;
+  std::span<const uint8> chr;
+};
+
+} // namespace nes_simulator
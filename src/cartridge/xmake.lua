@@ -0,0 +1,4 @@
+target("cartridge")
+  set_kind("static")
+  add_files("*.cpp")
+  add_deps("cpu")
\ No newline at end of file
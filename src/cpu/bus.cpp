@@ -0,0 +1,113 @@
+#include "cpu/bus.h"
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace nes_simulator {
+
+memory_bus::memory_bus(uint8 *image)
+    : image(image), read_pages(), write_pages(), pages(), watched(), mmio(),
+      mapping_count(0), direct_pages(0) {}
+
+// `low_ram` is whether the mapping may cover pages 0 and 1: only RAM that
+// maps them onto themselves may.
+void memory_bus::check_range(uint16 begin, uint32 end, uint32 size,
+                             bool low_ram) const {
+  if (begin % PAGE_SIZE || end % PAGE_SIZE || size % PAGE_SIZE ||
+      end > 0x10000 || begin >= end) {
+    throw std::runtime_error("bad bus mapping: " + std::to_string(begin) +
+                             "-" + std::to_string(end));
+  }
+  if (begin < 0x200 && !low_ram) {
+    throw std::runtime_error("zero page and stack must stay RAM");
+  }
+}
+
+void memory_bus::map_ram(uint16 begin, uint32 end, uint32 size) {
+  check_range(begin, end, size, begin >= 0x200 || size >= 0x200u - begin);
+  if (size == 0) {
+    throw std::runtime_error("empty RAM mapping");
+  }
+
+  for (uint32 addr = begin; addr < end; addr += PAGE_SIZE) {
+    uint8 *data = image + begin + (addr - begin) % size;
+    if (data != image + addr) {
+      std::memset(image + addr, 0, PAGE_SIZE);
+    }
+    map_page(addr >> 8, {data, data, 0});
+  }
+}
+
+void memory_bus::map_rom(uint16 begin, uint32 end, const uint8 *data,
+                         uint32 size) {
+  check_range(begin, end, size, false);
+  if (size == 0) {
+    throw std::runtime_error("empty ROM mapping");
+  }
+
+  std::memset(image + begin, 0, end - begin);
+  for (uint32 addr = begin; addr < end; addr += PAGE_SIZE) {
+    map_page(addr >> 8, {data + (addr - begin) % size, nullptr, 0});
+  }
+}
+
+void memory_bus::map_mmio(uint16 begin, uint32 end, read_handler_t read,
+                          write_handler_t write) {
+  check_range(begin, end, 0, false);
+  mmio.push_back({std::move(read), std::move(write)});
+  std::memset(image + begin, 0, end - begin);
+  for (uint32 addr = begin; addr < end; addr += PAGE_SIZE) {
+    map_page(addr >> 8, {nullptr, nullptr, static_cast<uint16>(mmio.size())});
+  }
+}
+
+void memory_bus::unmap(uint16 begin, uint32 end) {
+  check_range(begin, end, 0, false);
+  std::memset(image + begin, 0, end - begin);
+  for (uint32 addr = begin; addr < end; addr += PAGE_SIZE) {
+    map_page(addr >> 8, {nullptr, nullptr, 0});
+  }
+}
+
+void memory_bus::map_page(uint8 page, page_mapping mapping) {
+  pages[page] = mapping;
+  mapping_count++;
+  set_write_watch(page, watched[page]);
+}
+
+void memory_bus::set_write_watch(uint8 page, bool watch) {
+  uint8 *const own = image + page * PAGE_SIZE;
+  const auto direct = [&] {
+    return read_pages[page] == own && write_pages[page] == own;
+  };
+  direct_pages -= direct();
+  watched[page] = watch;
+  read_pages[page] = pages[page].read;
+  write_pages[page] = watch ? nullptr : pages[page].write;
+  direct_pages += direct();
+}
+
+uint8 memory_bus::read_slow(uint16 addr) {
+  const auto &page = pages[addr >> 8];
+  if (page.mmio && mmio[page.mmio - 1].read) {
+    return mmio[page.mmio - 1].read(addr);
+  }
+  return 0;
+}
+
+void memory_bus::write_slow(uint16 addr, uint8 val) {
+  const auto &page = pages[addr >> 8];
+  if (page.write) {
+    page.write[addr & 0xFF] = val;
+  } else if (page.mmio && mmio[page.mmio - 1].write) {
+    mmio[page.mmio - 1].write(addr, val);
+  }
+}
+
+uint8 memory_bus::peek(uint16 addr) const {
+  const auto &page = pages[addr >> 8];
+  return page.read ? page.read[addr & 0xFF] : 0;
+}
+
+} // namespace nes_simulator
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <utils/types.h>
+#include <vector>
+
+namespace nes_simulator {
+
+// The CPU address space as 256 pages of 256 bytes over a flat 64 KB image.
+// A page backed by RAM or ROM has direct read and write pointers, so a data
+// access is a table load plus an index; a null pointer sends the access to
+// the out-of-line slow path, which handles ROM (writes dropped), MMIO
+// handlers and unmapped pages (reads 0, writes dropped).
+//
+// RAM lives in the image at its own address, with mirrors pointing back at
+// it, so zero page and stack accesses index the image directly. ROM pages
+// point into the caller's buffer, which must outlive the mapping; nothing is
+// copied. Instruction fetch reads through the page table like data, without
+// MMIO side effects, so code runs from RAM mirrors and ROM alike; MMIO and
+// unmapped pages fetch zeros, which decode as BRK. Mirror, ROM, MMIO and
+// unmapped pages hold zeros in the image. Pages 0 and 1 must stay RAM.
+//
+// The NES layout, for example:
+//
+//   bus.map_ram(0x0000, 0x2000, 0x800);        // 2 KB mirrored 4 times
+//   bus.map_mmio(0x2000, 0x4000, ppu_read, ppu_write);
+//   bus.map_mmio(0x4000, 0x4100, apu_read, apu_write);
+//   bus.map_rom(0x8000, 0x10000, prg, 0x4000); // 16 KB mirrored twice
+class memory_bus {
+public:
+  using read_handler_t = std::function<uint8(uint16 addr)>;
+  using write_handler_t = std::function<void(uint16 addr, uint8 val)>;
+
+  static constexpr uint32 PAGE_SIZE = 0x100;
+
+  explicit memory_bus(uint8 *image);
+
+  // Map [begin, end) as `size` bytes of RAM, or of ROM read in place from
+  // `data`, repeating every `size` bytes. begin, end and size must be
+  // multiples of PAGE_SIZE.
+  void map_ram(uint16 begin, uint32 end, uint32 size);
+  void map_rom(uint16 begin, uint32 end, const uint8 *data, uint32 size);
+  // Handlers see the full address and do their own mirroring.
+  void map_mmio(uint16 begin, uint32 end, read_handler_t read,
+                write_handler_t write);
+  void unmap(uint16 begin, uint32 end);
+
+  // Fast-path pointers to the page holding `addr`, or null when the access
+  // needs read_slow / write_slow. Writers go through the owner (cpu) so that
+  // watched pages are honoured; write_slow itself ignores watches.
+  const uint8 *read_page(uint16 addr) const { return read_pages[addr >> 8]; }
+  uint8 *write_page(uint16 addr) const { return write_pages[addr >> 8]; }
+
+  // The tables behind read_page and write_page, for generated code.
+  const uint8 *const *read_table() const { return read_pages.data(); }
+  uint8 *const *write_table() const { return write_pages.data(); }
+
+  uint8 read(uint16 addr);
+  uint8 read_slow(uint16 addr);
+  void write_slow(uint16 addr, uint8 val);
+
+  // Reads without triggering MMIO handlers; MMIO and unmapped pages read 0.
+  uint8 peek(uint16 addr) const;
+  // peek over the fast-path table, for instruction fetch.
+  uint8 fetch(uint16 addr) const {
+    const uint8 *page = read_pages[addr >> 8];
+    return page ? page[addr & 0xFF] : 0;
+  }
+
+  // The RAM page behind `addr`, whether or not it is watched; null for ROM,
+  // MMIO and unmapped pages.
+  uint8 *ram_page(uint16 addr) const { return pages[addr >> 8].write; }
+  // The image address writes to `addr` land on: the primary page's for RAM
+  // and its mirrors, `addr` itself for everything else.
+  uint16 ram_address(uint16 addr) const {
+    const uint8 *page = pages[addr >> 8].write;
+    return page ? (page - image) | (addr & 0xFF) : addr;
+  }
+
+  // A watched page keeps its mapping but loses its fast write pointer, so
+  // every write to it reaches the owner's slow path first.
+  void set_write_watch(uint8 page, bool watch);
+
+  // Whether every page is unwatched RAM at its own image address, so that
+  // accesses may index the image directly instead of going through the
+  // page tables. A cpu that has saved its state watches the pages not
+  // written since (cpu::save), so it is never flat again; on the snake
+  // that costs the Threaded engine about a fifth of its speed and the Jit
+  // a few percent.
+  bool flat() const { return direct_pages == 0x100; }
+
+  // Bumped by every map_* and unmap, so that anything derived from the
+  // image's contents (the decode cache) can tell the layout changed.
+  uint64 mappings() const { return mapping_count; }
+
+private:
+  struct page_mapping {
+    const uint8 *read;
+    uint8 *write;
+    // Index into `mmio` plus one; 0 when the page is not MMIO.
+    uint16 mmio;
+  };
+
+  struct mmio_region {
+    read_handler_t read;
+    write_handler_t write;
+  };
+
+  void check_range(uint16 begin, uint32 end, uint32 size,
+                   bool low_ram) const;
+  void map_page(uint8 page, page_mapping mapping);
+
+  uint8 *image;
+  std::array<const uint8 *, 0x100> read_pages;
+  std::array<uint8 *, 0x100> write_pages;
+  std::array<page_mapping, 0x100> pages;
+  std::array<bool, 0x100> watched;
+  std::vector<mmio_region> mmio;
+  uint64 mapping_count;
+  // Pages whose read and write pointers are both their own image page.
+  uint32 direct_pages;
+};
+
+[[gnu::always_inline]] inline uint8 memory_bus::read(uint16 addr) {
+  if (const uint8 *page = read_page(addr)) [[likely]] {
+    return page[addr & 0xFF];
+  }
+  return read_slow(addr);
+}
+
+} // namespace nes_simulator
@@ -1,51 +1,48 @@
 #include "cpu/cpu.h"
+#include "cpu/instructions.h"
+#include "cpu/interpreter.h"
 #include "cpu/opcode.h"
+#include "utils/hash.h"
 #include "utils/types.h"
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <iterator>
+#include <limits>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
 namespace nes_simulator {
 
-cpu::cpu()
-    : reg_a(0), reg_x(0), reg_y(0), sp(STACK_RESET), status(0b100100), pc(0),
-      memory() {
-  memset(memory, 0, sizeof(memory));
-}
+namespace {
 
-uint8 cpu::mem_read(uint16 addr) { return memory[addr]; }
-uint16 cpu::mem_read_uint16(uint16 addr) {
-  return static_cast<uint16>(mem_read(addr + 1) << 8) | mem_read(addr);
-}
-
-void cpu::mem_write(uint16 addr, uint8 val) { memory[addr] = val; }
-void cpu::mem_write_uint16(uint16 addr, uint16 val) {
-  mem_write(addr, val & 0xFF);
-  mem_write(addr + 1, val >> 8);
-}
+const char *const engine_names[] = {"switch", "threaded", "cached", "jit"};
 
-uint8 cpu::stack_pop() {
-  sp++;
-  return mem_read(STACK + sp);
-}
+} // namespace
 
-uint16 cpu::stack_pop_uint16() {
-  uint16 lo = stack_pop();
-  uint16 hi = stack_pop();
-  return hi << 8 | lo;
+Engine parse_engine(const std::string &name) {
+  for (std::size_t i = 0; i < std::size(engine_names); i++) {
+    if (name == engine_names[i]) {
+      return static_cast<Engine>(i);
+    }
+  }
+  throw std::runtime_error("unknown engine " + name);
 }
 
-void cpu::stack_push(uint8 data) {
-  mem_write(STACK + sp, data);
-  sp--;
+const char *engine_name(Engine engine) {
+  return engine_names[static_cast<std::size_t>(engine)];
 }
 
-void cpu::stack_push_uint16(uint16 data) {
-  stack_push(data >> 8);
-  stack_push(data & 0xff);
+cpu::cpu()
+    : reg_a(0), reg_x(0), reg_y(0), sp(STACK_RESET), status(0b100100), pc(0),
+      memory(), bus(memory), engine(Engine::Switch), halted(false),
+      at_breakpoint(false), instructions(0), cycles(0), page_watch(),
+      dirty_bits(), breakpoint_bits(), tracer(nullptr), snapshot_pages(),
+      snapshot_tracking(false), page_crossed(false), decoded(), jit(),
+      code_written(false), zn(zn_of(status)), flags_lazy(false) {
+  memset(memory, 0, sizeof(memory));
+  bus.map_ram(0x0000, 0x10000, sizeof(memory));
 }
 
 uint16 cpu::get_addr(AddressingMode mode) {
@@ -55,32 +52,42 @@ uint16 cpu::get_addr(AddressingMode mode) {
     return pc;
 
   case AddressingMode::ZeroPage:
-    return mem_read(pc);
+    return fetch(pc);
 
   case AddressingMode::Absolute:
-    return mem_read_uint16(pc);
+    return fetch_uint16(pc);
 
   case AddressingMode::ZeroPage_X:
-    return mem_read(pc) + reg_x;
+    return fetch(pc) + reg_x;
 
   case AddressingMode::ZeroPage_Y:
-    return mem_read(pc) + reg_y;
+    return fetch(pc) + reg_y;
 
-  case AddressingMode::Absolute_X:
-    return mem_read_uint16(pc) + reg_x;
+  case AddressingMode::Absolute_X: {
+    uint16 base = fetch_uint16(pc);
+    uint16 addr = base + reg_x;
+    page_crossed = (base & 0xFF00) != (addr & 0xFF00);
+    return addr;
+  }
 
-  case AddressingMode::Absolute_Y:
-    return mem_read_uint16(pc) + reg_y;
+  case AddressingMode::Absolute_Y: {
+    uint16 base = fetch_uint16(pc);
+    uint16 addr = base + reg_y;
+    page_crossed = (base & 0xFF00) != (addr & 0xFF00);
+    return addr;
+  }
 
   case AddressingMode::Indirect_X: {
-    uint8 ptr = mem_read(pc) + reg_x;
-    return static_cast<uint16>(mem_read(ptr + 1) << 8) | mem_read(ptr);
+    uint8 ptr = fetch(pc) + reg_x;
+    return static_cast<uint16>(low_read(ptr + 1) << 8) | low_read(ptr);
   }
 
   case AddressingMode::Indirect_Y: {
-    uint8 ptr = mem_read(pc);
-    return (static_cast<uint16>(mem_read(ptr + 1) << 8) | mem_read(ptr)) +
-           reg_y;
+    uint8 ptr = fetch(pc);
+    uint16 base = static_cast<uint16>(low_read(ptr + 1) << 8) | low_read(ptr);
+    uint16 addr = base + reg_y;
+    page_crossed = (base & 0xFF00) != (addr & 0xFF00);
+    return addr;
   }
   case AddressingMode::Implied:
     break;
@@ -90,26 +97,23 @@ uint16 cpu::get_addr(AddressingMode mode) {
                            std::to_string((int)mode));
 }
 
-bool cpu::status_bit_get(flag flag) {
-  uint8 t = 1 << static_cast<int>(flag);
-  return status & t;
-}
-
-void cpu::status_bit_set(flag flag, bool v) {
-  uint8 t = 1 << static_cast<int>(flag);
-  v ? status |= t : status &= ~t;
-}
-
-void cpu::update_zero_negative_flag(uint8 reg) {
-  status_bit_set(flag::ZeroFlag, reg == 0);
-  status_bit_set(flag::NegativeFlag, reg & 0x80);
-}
-
 void cpu::reset() {
   reg_a = reg_x = reg_y = 0;
   sp = STACK_RESET;
   status = 0b100100;
   pc = mem_read_uint16(0xFFFC);
+  halted = false;
+  cycles += 7;
+}
+
+uint64 cpu::state_digest() const {
+  const uint8 registers[] = {
+      reg_a, reg_x, reg_y, sp, status, static_cast<uint8>(pc),
+      static_cast<uint8>(pc >> 8),
+  };
+  uint64 hash = fnv1a(registers, sizeof(registers));
+  hash = fnv1a(reinterpret_cast<const uint8 *>(&cycles), sizeof(cycles), hash);
+  return fnv1a(memory, sizeof(memory), hash);
 }
 
 void cpu::load_and_run(const uint8 *program, int length, callback_t callback) {
@@ -120,393 +124,592 @@ void cpu::load_and_run(const uint8 *program, int length, callback_t callback) {
 
 void cpu::load(const uint8 *program, int length) {
   memcpy(memory + 0x600, program, length);
+  // The copy bypasses the write path, so tell a pending save_delta about it.
+  for (uint32 page = 0x6; length > 0 && page <= (0x5FFu + length) >> 8;
+       page++) {
+    snapshot_pages[page / 64] |= uint64{1} << (page % 64);
+  }
+  flush_decoded();
   mem_write_uint16(0xFFFC, 0x600);
 }
 
 void cpu::run(callback_t &&callback) {
-  while (true) {
-    if (callback)
-      callback(*this);
-
-    const auto opcode = memory[pc++];
-    const auto pc_before_op = pc;
-    const auto &info = opcodes[opcode];
-
-    switch (info.opcode) {
-    case OpcodeType::LDA:
-      reg_a = mem_read(get_addr(info.mode));
-      update_zero_negative_flag(reg_a);
-      break;
-
-    case OpcodeType::LDX:
-      reg_x = mem_read(get_addr(info.mode));
-      update_zero_negative_flag(reg_x);
-      break;
-
-    case OpcodeType::LDY:
-      reg_y = mem_read(get_addr(info.mode));
-      update_zero_negative_flag(reg_y);
-      break;
-
-    case OpcodeType::STA:
-      mem_write(get_addr(info.mode), reg_a);
-      break;
-
-    case OpcodeType::STX:
-      mem_write(get_addr(info.mode), reg_x);
-      break;
-
-    case OpcodeType::STY:
-      mem_write(get_addr(info.mode), reg_y);
-      break;
-
-    case OpcodeType::ADC: {
-      uint8 base = mem_read(get_addr(info.mode));
-      uint16 tmp =
-          static_cast<uint16>(reg_a) + base + status_bit_get(flag::CarryFlag);
-
-      status_bit_set(flag::CarryFlag, tmp > 0xff);
-      status_bit_set(flag::OverflowFlag, static_cast<uint8>(tmp ^ base) &
-                                             static_cast<uint8>(tmp ^ reg_a) &
-                                             0x80 != 0);
-
-      reg_a = tmp & 0xff;
-      update_zero_negative_flag(reg_a);
-      break;
-    }
+  switch (engine) {
+  case Engine::Switch:
+    run_switch(std::move(callback));
+    break;
+  case Engine::Threaded:
+    run_threaded(std::move(callback));
+    break;
+  case Engine::Cached:
+    run_cached(std::move(callback));
+    break;
+  case Engine::Jit:
+    run_jit(std::move(callback));
+    break;
+  }
+}
 
-    case OpcodeType::SBC: {
-      uint8 base = -(mem_read(get_addr(info.mode)) + 1);
-      uint16 tmp =
-          static_cast<uint16>(reg_a) + base + status_bit_get(flag::CarryFlag);
+// The reference engine, kept simple on purpose: every other engine must
+// match it instruction for instruction.
+void cpu::run_switch(callback_t &&callback) {
+  if (!callback) {
+    interpret_switch<fast_policy::paged>([](cpu &) { return false; });
+    return;
+  }
+  interpret_switch<fast_policy::paged>([&](cpu &c) {
+    c.publish_flags();
+    callback(c);
+    c.adopt_flags();
+    return false;
+  });
+}
 
-      status_bit_set(flag::CarryFlag, tmp > 0xff);
-      status_bit_set(flag::OverflowFlag, static_cast<uint8>(tmp ^ base) &
-                                             static_cast<uint8>(tmp ^ reg_a) &
-                                             0x80 != 0);
+// One instruction of the switch loop, from its opcode byte at pc. Returns
+// false when the cpu halts (BRK or an unknown opcode).
+bool cpu::step_switch() {
+  const auto opcode = fetch(pc++);
+  const auto pc_before_op = pc;
+  const auto &info = opcodes[opcode];
+  cycles += info.cycle;
+  page_crossed = false;
+
+  switch (info.opcode) {
+  case OpcodeType::LDA:
+    reg_a = mem_read(get_addr(info.mode));
+    update_zero_negative_flag(reg_a);
+    break;
 
-      reg_a = tmp & 0xff;
-      update_zero_negative_flag(reg_a);
-      break;
-    }
+  case OpcodeType::LDX:
+    reg_x = mem_read(get_addr(info.mode));
+    update_zero_negative_flag(reg_x);
+    break;
 
-    case OpcodeType::AND:
-      reg_a &= mem_read(get_addr(info.mode));
-      update_zero_negative_flag(reg_a);
-      break;
+  case OpcodeType::LDY:
+    reg_y = mem_read(get_addr(info.mode));
+    update_zero_negative_flag(reg_y);
+    break;
 
-    case OpcodeType::BCC:
-      if (!status_bit_get(flag::CarryFlag)) {
-        pc += (int8)(mem_read(get_addr(info.mode))) + 1;
-      }
-      break;
+  case OpcodeType::STA:
+    mem_write(get_addr(info.mode), reg_a);
+    break;
 
-    case OpcodeType::BCS:
-      if (status_bit_get(flag::CarryFlag)) {
-        pc += (int8)(mem_read(get_addr(info.mode))) + 1;
-      }
-      break;
+  case OpcodeType::STX:
+    mem_write(get_addr(info.mode), reg_x);
+    break;
 
-    case OpcodeType::BEQ:
-      if (status_bit_get(flag::ZeroFlag)) {
-        pc += (int8)(mem_read(get_addr(info.mode))) + 1;
-      }
-      break;
+  case OpcodeType::STY:
+    mem_write(get_addr(info.mode), reg_y);
+    break;
 
-    case OpcodeType::BMI:
-      if (status_bit_get(flag::NegativeFlag)) {
-        pc += (int8)(mem_read(get_addr(info.mode))) + 1;
-      }
-      break;
+  case OpcodeType::ADC: {
+    uint8 base = mem_read(get_addr(info.mode));
+    uint16 tmp =
+        static_cast<uint16>(reg_a) + base + status_bit_get(flag::CarryFlag);
 
-    case OpcodeType::BNE:
-      if (!status_bit_get(flag::ZeroFlag)) {
-        pc += (int8)(mem_read(get_addr(info.mode))) + 1;
-      }
-      break;
+    status_bit_set(flag::CarryFlag, tmp > 0xff);
+    status_bit_set(flag::OverflowFlag,
+                   (static_cast<uint8>(tmp ^ base) &
+                    static_cast<uint8>(tmp ^ reg_a) & 0x80) != 0);
 
-    case OpcodeType::BPL:
-      if (!status_bit_get(flag::NegativeFlag)) {
-        pc += (int8)(mem_read(get_addr(info.mode))) + 1;
-      }
-      break;
+    reg_a = tmp & 0xff;
+    update_zero_negative_flag(reg_a);
+    break;
+  }
 
-    case OpcodeType::BVC:
-      if (!status_bit_get(flag::OverflowFlag)) {
-        pc += (int8)(mem_read(get_addr(info.mode))) + 1;
-      }
-      break;
+  case OpcodeType::SBC: {
+    uint8 base = -(mem_read(get_addr(info.mode)) + 1);
+    uint16 tmp =
+        static_cast<uint16>(reg_a) + base + status_bit_get(flag::CarryFlag);
 
-    case OpcodeType::BVS:
-      if (status_bit_get(flag::OverflowFlag)) {
-        pc += (int8)(mem_read(get_addr(info.mode))) + 1;
-      }
-      break;
-
-    case OpcodeType::JMP_ABS:
-      pc = mem_read_uint16(get_addr(info.mode));
-      break;
-
-    case OpcodeType::JMP_IND: {
-      uint16 addr = mem_read_uint16(get_addr(info.mode));
-      if ((addr & 0xFF) == 0xFF) {
-        pc = (mem_read(addr & 0xFF00) << 8) | mem_read(addr);
-      } else {
-        pc = mem_read_uint16(addr);
-      }
-      break;
-    }
+    status_bit_set(flag::CarryFlag, tmp > 0xff);
+    status_bit_set(flag::OverflowFlag,
+                   (static_cast<uint8>(tmp ^ base) &
+                    static_cast<uint8>(tmp ^ reg_a) & 0x80) != 0);
 
-    case OpcodeType::JSR: {
-      stack_push_uint16(pc + 2 - 1);
-      pc = mem_read_uint16(pc);
-      break;
-    }
+    reg_a = tmp & 0xff;
+    update_zero_negative_flag(reg_a);
+    break;
+  }
 
-    case OpcodeType::NOP:
-      break;
-
-    case OpcodeType::ORA:
-      reg_a |= mem_read(get_addr(info.mode));
-      update_zero_negative_flag(reg_a);
-      break;
-
-    case OpcodeType::EOR:
-      reg_a ^= mem_read(get_addr(info.mode));
-      update_zero_negative_flag(reg_a);
-      break;
-
-    case OpcodeType::INX:
-      reg_x += 1;
-      update_zero_negative_flag(reg_x);
-      break;
-
-    case OpcodeType::INY:
-      reg_y += 1;
-      update_zero_negative_flag(reg_y);
-      break;
-
-    case OpcodeType::DEX:
-      reg_x -= 1;
-      update_zero_negative_flag(reg_x);
-      break;
-
-    case OpcodeType::DEY:
-      reg_y -= 1;
-      update_zero_negative_flag(reg_y);
-      break;
-
-    case OpcodeType::ASL: {
-      uint16 addr = get_addr(info.mode);
-      uint8 data = mem_read(addr);
-      status_bit_set(flag::CarryFlag, data & 0x80);
-
-      data <<= 1;
-      mem_write(addr, data << 1);
-      update_zero_negative_flag(data);
-      break;
-    }
+  case OpcodeType::AND:
+    reg_a &= mem_read(get_addr(info.mode));
+    update_zero_negative_flag(reg_a);
+    break;
 
-    case OpcodeType::ASL_ACC:
-      status_bit_set(flag::CarryFlag, reg_a & 0x80);
-      reg_a <<= 1;
-      break;
-
-    case OpcodeType::BIT: {
-      uint8 data = mem_read(get_addr(info.mode));
-      uint8 tmp = reg_a & data;
-      status_bit_set(flag::ZeroFlag, tmp == 0);
-      status_bit_set(flag::NegativeFlag, data & 0x80);
-      status_bit_set(flag::OverflowFlag, data & 0x40);
-      break;
-    }
+  case OpcodeType::BCC:
+    branch(!status_bit_get(flag::CarryFlag));
+    break;
 
-    case OpcodeType::CLC:
-      status_bit_set(flag::CarryFlag, false);
-      break;
+  case OpcodeType::BCS:
+    branch(status_bit_get(flag::CarryFlag));
+    break;
 
-    case OpcodeType::CLD:
-      status_bit_set(flag::DecimalModeFlag, false);
-      break;
+  case OpcodeType::BEQ:
+    branch(status_bit_get(flag::ZeroFlag));
+    break;
 
-    case OpcodeType::CLI:
-      status_bit_set(flag::InterruptDisable, false);
-      break;
+  case OpcodeType::BMI:
+    branch(status_bit_get(flag::NegativeFlag));
+    break;
 
-    case OpcodeType::SLC:
-      status_bit_set(flag::CarryFlag, true);
-      break;
+  case OpcodeType::BNE:
+    branch(!status_bit_get(flag::ZeroFlag));
+    break;
 
-    case OpcodeType::SLD:
-      status_bit_set(flag::DecimalModeFlag, true);
-      break;
+  case OpcodeType::BPL:
+    branch(!status_bit_get(flag::NegativeFlag));
+    break;
 
-    case OpcodeType::SLI:
-      status_bit_set(flag::InterruptDisable, true);
-      break;
+  case OpcodeType::BVC:
+    branch(!status_bit_get(flag::OverflowFlag));
+    break;
 
-    case OpcodeType::CLV:
-      status_bit_set(flag::OverflowFlag, false);
-      break;
+  case OpcodeType::BVS:
+    branch(status_bit_get(flag::OverflowFlag));
+    break;
 
-    case OpcodeType::CMP: {
-      uint8 data = mem_read(get_addr(info.mode));
-      status_bit_set(flag::CarryFlag, reg_a >= data);
-      update_zero_negative_flag(reg_a - data);
-      break;
-    }
+  case OpcodeType::JMP_ABS:
+    pc = mem_read_uint16(get_addr(info.mode));
+    break;
 
-    case OpcodeType::CPX: {
-      uint8 data = mem_read(get_addr(info.mode));
-      status_bit_set(flag::CarryFlag, reg_x >= data);
-      update_zero_negative_flag(reg_x - data);
-      break;
+  case OpcodeType::JMP_IND: {
+    uint16 addr = mem_read_uint16(get_addr(info.mode));
+    if ((addr & 0xFF) == 0xFF) {
+      pc = (mem_read(addr & 0xFF00) << 8) | mem_read(addr);
+    } else {
+      pc = mem_read_uint16(addr);
     }
+    break;
+  }
 
-    case OpcodeType::CPY: {
-      uint8 data = mem_read(get_addr(info.mode));
-      status_bit_set(flag::CarryFlag, reg_y >= data);
-      update_zero_negative_flag(reg_y - data);
-      break;
-    }
+  case OpcodeType::JSR: {
+    stack_push_uint16(pc + 2 - 1);
+    pc = fetch_uint16(pc);
+    break;
+  }
 
-    case OpcodeType::LSR_ACC:
-      status_bit_set(flag::CarryFlag, reg_a & 1);
-      reg_a >>= 1;
-      update_zero_negative_flag(reg_a);
-      break;
-
-    case OpcodeType::LSR: {
-      uint16 addr = get_addr(info.mode);
-      uint8 data = mem_read(addr);
-      status_bit_set(flag::CarryFlag, data & 1);
-      data >>= 1;
-      mem_write(addr, data);
-      update_zero_negative_flag(data);
-      break;
-    }
+  case OpcodeType::NOP:
+    break;
 
-    case OpcodeType::TAX:
-      reg_x = reg_a;
-      update_zero_negative_flag(reg_x);
-      break;
-
-    case OpcodeType::TAY:
-      reg_y = reg_a;
-      update_zero_negative_flag(reg_y);
-      break;
-
-    case OpcodeType::TSX:
-      reg_x = sp;
-      update_zero_negative_flag(reg_x);
-      break;
-
-    case OpcodeType::TXA:
-      reg_a = reg_x;
-      update_zero_negative_flag(reg_a);
-      break;
-
-    case OpcodeType::TXS:
-      sp = reg_x;
-      update_zero_negative_flag(sp);
-      break;
-
-    case OpcodeType::TYA:
-      reg_a = reg_y;
-      update_zero_negative_flag(reg_a);
-      break;
-
-    case OpcodeType::PHA:
-      stack_push(reg_a);
-      break;
-
-    case OpcodeType::PHP:
-      stack_push(status);
-      break;
-
-    case OpcodeType::PLA:
-      reg_a = stack_pop();
-      update_zero_negative_flag(reg_a);
-      break;
-
-    case OpcodeType::PLP:
-      status = stack_pop();
-      break;
-
-    case OpcodeType::BRK:
-      return;
-
-    case OpcodeType::ROL_ACC: {
-      uint8 old_carry = status_bit_get(flag::CarryFlag);
-      status_bit_set(flag::CarryFlag, reg_a & 0x80);
-      reg_a = (reg_a << 1) | old_carry;
-      update_zero_negative_flag(reg_a);
-      break;
-    }
+  case OpcodeType::ORA:
+    reg_a |= mem_read(get_addr(info.mode));
+    update_zero_negative_flag(reg_a);
+    break;
 
-    case OpcodeType::ROL: {
-      uint16 addr = get_addr(info.mode);
-      uint8 data = mem_read(addr);
-      uint8 old_carry = status_bit_get(flag::CarryFlag);
-      status_bit_set(flag::CarryFlag, data & 0x80);
-      data = (data << 1) | old_carry;
-      mem_write(addr, data);
-      update_zero_negative_flag(data);
-      break;
-    }
+  case OpcodeType::EOR:
+    reg_a ^= mem_read(get_addr(info.mode));
+    update_zero_negative_flag(reg_a);
+    break;
 
-    case OpcodeType::ROR_ACC: {
-      uint8 old_carry = status_bit_get(flag::CarryFlag);
-      status_bit_set(flag::CarryFlag, reg_a & 1);
-      reg_a = (reg_a >> 1) | (old_carry << 7);
-      update_zero_negative_flag(reg_a);
-      break;
-    }
+  case OpcodeType::INX:
+    reg_x += 1;
+    update_zero_negative_flag(reg_x);
+    break;
 
-    case OpcodeType::ROR: {
-      uint16 addr = get_addr(info.mode);
-      uint8 data = mem_read(addr);
-      uint8 old_carry = status_bit_get(flag::CarryFlag);
-      status_bit_set(flag::CarryFlag, data & 1);
-      data = (data >> 1) | (old_carry << 7);
-      mem_write(addr, data);
-      update_zero_negative_flag(data);
-      break;
-    }
+  case OpcodeType::INY:
+    reg_y += 1;
+    update_zero_negative_flag(reg_y);
+    break;
 
-    case OpcodeType::RTI:
-      status = stack_pop();
-      status_bit_set(flag::BreakCommand, false);
-      status_bit_set(flag::BreakCommand2, true);
-      pc = stack_pop_uint16();
-      break;
-
-    case OpcodeType::RTS:
-      pc = stack_pop_uint16() + 1;
-      break;
-
-    case OpcodeType::INC: {
-      uint16 addr = get_addr(info.mode);
-      uint8 data = mem_read(addr);
-      data++;
-      mem_write(addr, data);
-      update_zero_negative_flag(data);
-      break;
-    }
+  case OpcodeType::DEX:
+    reg_x -= 1;
+    update_zero_negative_flag(reg_x);
+    break;
 
-    case OpcodeType::DEC:
-      uint16 addr = get_addr(info.mode);
-      uint8 data = mem_read(addr);
-      data--;
-      mem_write(addr, data);
-      update_zero_negative_flag(data);
-      break;
-    }
+  case OpcodeType::DEY:
+    reg_y -= 1;
+    update_zero_negative_flag(reg_y);
+    break;
+
+  case OpcodeType::ASL: {
+    uint16 addr = get_addr(info.mode);
+    uint8 data = mem_read(addr);
+    status_bit_set(flag::CarryFlag, data & 0x80);
+
+    data <<= 1;
+    mem_write(addr, data);
+    update_zero_negative_flag(data);
+    break;
+  }
+
+  case OpcodeType::ASL_ACC:
+    status_bit_set(flag::CarryFlag, reg_a & 0x80);
+    reg_a <<= 1;
+    update_zero_negative_flag(reg_a);
+    break;
+
+  case OpcodeType::BIT: {
+    uint8 data = mem_read(get_addr(info.mode));
+    uint8 tmp = reg_a & data;
+    status_bit_set(flag::ZeroFlag, tmp == 0);
+    status_bit_set(flag::NegativeFlag, data & 0x80);
+    status_bit_set(flag::OverflowFlag, data & 0x40);
+    break;
+  }
+
+  case OpcodeType::CLC:
+    status_bit_set(flag::CarryFlag, false);
+    break;
+
+  case OpcodeType::CLD:
+    status_bit_set(flag::DecimalModeFlag, false);
+    break;
+
+  case OpcodeType::CLI:
+    status_bit_set(flag::InterruptDisable, false);
+    break;
+
+  case OpcodeType::SLC:
+    status_bit_set(flag::CarryFlag, true);
+    break;
+
+  case OpcodeType::SLD:
+    status_bit_set(flag::DecimalModeFlag, true);
+    break;
+
+  case OpcodeType::SLI:
+    status_bit_set(flag::InterruptDisable, true);
+    break;
+
+  case OpcodeType::CLV:
+    status_bit_set(flag::OverflowFlag, false);
+    break;
+
+  case OpcodeType::CMP: {
+    uint8 data = mem_read(get_addr(info.mode));
+    status_bit_set(flag::CarryFlag, reg_a >= data);
+    update_zero_negative_flag(reg_a - data);
+    break;
+  }
+
+  case OpcodeType::CPX: {
+    uint8 data = mem_read(get_addr(info.mode));
+    status_bit_set(flag::CarryFlag, reg_x >= data);
+    update_zero_negative_flag(reg_x - data);
+    break;
+  }
+
+  case OpcodeType::CPY: {
+    uint8 data = mem_read(get_addr(info.mode));
+    status_bit_set(flag::CarryFlag, reg_y >= data);
+    update_zero_negative_flag(reg_y - data);
+    break;
+  }
+
+  case OpcodeType::LSR_ACC:
+    status_bit_set(flag::CarryFlag, reg_a & 1);
+    reg_a >>= 1;
+    update_zero_negative_flag(reg_a);
+    break;
+
+  case OpcodeType::LSR: {
+    uint16 addr = get_addr(info.mode);
+    uint8 data = mem_read(addr);
+    status_bit_set(flag::CarryFlag, data & 1);
+    data >>= 1;
+    mem_write(addr, data);
+    update_zero_negative_flag(data);
+    break;
+  }
+
+  case OpcodeType::TAX:
+    reg_x = reg_a;
+    update_zero_negative_flag(reg_x);
+    break;
+
+  case OpcodeType::TAY:
+    reg_y = reg_a;
+    update_zero_negative_flag(reg_y);
+    break;
+
+  case OpcodeType::TSX:
+    reg_x = sp;
+    update_zero_negative_flag(reg_x);
+    break;
+
+  case OpcodeType::TXA:
+    reg_a = reg_x;
+    update_zero_negative_flag(reg_a);
+    break;
+
+  case OpcodeType::TXS:
+    sp = reg_x;
+    break;
+
+  case OpcodeType::TYA:
+    reg_a = reg_y;
+    update_zero_negative_flag(reg_a);
+    break;
+
+  case OpcodeType::PHA:
+    stack_push(reg_a);
+    break;
+
+  case OpcodeType::PHP:
+    stack_push(current_status());
+    break;
+
+  case OpcodeType::PLA:
+    reg_a = stack_pop();
+    update_zero_negative_flag(reg_a);
+    break;
+
+  case OpcodeType::PLP:
+    load_status(stack_pop());
+    break;
+
+  case OpcodeType::BRK:
+  case OpcodeType::UNKNOWN:
+    return false;
+
+  case OpcodeType::ROL_ACC: {
+    uint8 old_carry = status_bit_get(flag::CarryFlag);
+    status_bit_set(flag::CarryFlag, reg_a & 0x80);
+    reg_a = (reg_a << 1) | old_carry;
+    update_zero_negative_flag(reg_a);
+    break;
+  }
+
+  case OpcodeType::ROL: {
+    uint16 addr = get_addr(info.mode);
+    uint8 data = mem_read(addr);
+    uint8 old_carry = status_bit_get(flag::CarryFlag);
+    status_bit_set(flag::CarryFlag, data & 0x80);
+    data = (data << 1) | old_carry;
+    mem_write(addr, data);
+    update_zero_negative_flag(data);
+    break;
+  }
+
+  case OpcodeType::ROR_ACC: {
+    uint8 old_carry = status_bit_get(flag::CarryFlag);
+    status_bit_set(flag::CarryFlag, reg_a & 1);
+    reg_a = (reg_a >> 1) | (old_carry << 7);
+    update_zero_negative_flag(reg_a);
+    break;
+  }
+
+  case OpcodeType::ROR: {
+    uint16 addr = get_addr(info.mode);
+    uint8 data = mem_read(addr);
+    uint8 old_carry = status_bit_get(flag::CarryFlag);
+    status_bit_set(flag::CarryFlag, data & 1);
+    data = (data >> 1) | (old_carry << 7);
+    mem_write(addr, data);
+    update_zero_negative_flag(data);
+    break;
+  }
+
+  case OpcodeType::RTI:
+    load_status(stack_pop());
+    status_bit_set(flag::BreakCommand, false);
+    status_bit_set(flag::BreakCommand2, true);
+    pc = stack_pop_uint16();
+    break;
+
+  case OpcodeType::RTS:
+    pc = stack_pop_uint16() + 1;
+    break;
+
+  case OpcodeType::INC: {
+    uint16 addr = get_addr(info.mode);
+    uint8 data = mem_read(addr);
+    data++;
+    mem_write(addr, data);
+    update_zero_negative_flag(data);
+    break;
+  }
+
+  case OpcodeType::DEC:
+    uint16 addr = get_addr(info.mode);
+    uint8 data = mem_read(addr);
+    data--;
+    mem_write(addr, data);
+    update_zero_negative_flag(data);
+    break;
+  }
+
+  if (page_crossed && has_page_cross_penalty(info.opcode)) {
+    cycles++;
+  }
+
+  if (pc_before_op == pc) {
+    pc += info.bytes - 1;
+  }
+  return true;
+}
+
+// Same semantics as run_switch, but every opcode byte has its own label with
+// the handler from instructions.h inlined into it, and each ends in its own
+// indirect jump through a compile-time label table (GNU computed goto). The
+// branch predictor sees one dispatch site per opcode instead of a shared
+// switch, and no addressing mode is decoded at runtime.
+void cpu::run_threaded(callback_t &&callback) {
+  if (!callback) {
+    interpret<fast_policy::paged>([](cpu &) { return false; });
+    return;
+  }
+  interpret<fast_policy::paged>([&](cpu &c) {
+    c.publish_flags();
+    callback(c);
+    c.adopt_flags();
+    return false;
+  });
+}
+
+// Same handlers as run_threaded, fed micro-ops from the decode cache instead
+// of bytes from the image: after a block's first pass there is no opcode or
+// operand fetch, only a dispatch per instruction and a lookup per block.
+void cpu::run_cached(callback_t &&callback) {
+  if (!callback) {
+    interpret_cached<fast_policy::paged>([](cpu &) { return false; });
+    return;
+  }
+  interpret_cached<fast_policy::paged>([&](cpu &c) {
+    c.publish_flags();
+    callback(c);
+    c.adopt_flags();
+    return false;
+  });
+}
+
+// Native code cannot stop for a per-instruction callback, so with one the
+// Jit engine runs the decode cache interpreter instead.
+void cpu::run_jit(callback_t &&callback) {
+  if (callback) {
+    run_cached(std::move(callback));
+    return;
+  }
+  interpret_jit(std::numeric_limits<uint64>::max(),
+                std::numeric_limits<uint64>::max());
+}
+
+template <class Policy> uint64 cpu::run_instructions(uint64 count) {
+  return run_batched<Policy>(
+      count, cycle_deadline{std::numeric_limits<uint64>::max()});
+}
+
+template <class Policy> uint64 cpu::run_cycles(uint64 budget) {
+  const uint64 start = cycles;
+  const uint64 target = start + budget;
+  run_batched<Policy>(std::numeric_limits<uint64>::max(),
+                      cycle_deadline{target});
+  return cycles - start;
+}
+
+template uint64 cpu::run_instructions<fast_policy>(uint64 count);
+template uint64 cpu::run_instructions<debug_policy>(uint64 count);
+template uint64 cpu::run_cycles<fast_policy>(uint64 budget);
+template uint64 cpu::run_cycles<debug_policy>(uint64 budget);
+
+uint64 cpu::run_frame(uint64 budget) {
+  const auto spent = run_cycles(budget);
+  for (auto &hook : frame_end_hooks) {
+    hook(*this);
+  }
+  return spent;
+}
+
+void cpu::add_breakpoint(uint16 addr) {
+  breakpoint_bits[addr / 64] |= uint64{1} << addr % 64;
+}
+
+void cpu::remove_breakpoint(uint16 addr) {
+  breakpoint_bits[addr / 64] &= ~(uint64{1} << addr % 64);
+}
+
+void cpu::clear_breakpoints() { breakpoint_bits.fill(0); }
+
+void cpu::add_interval_hook(uint64 interval, hook_t hook) {
+  if (interval == 0) {
+    throw std::runtime_error("interval hook needs a non-zero interval");
+  }
+  interval_hooks.push_back(
+      {interval, instructions + interval, std::move(hook)});
+}
+
+void cpu::add_frame_end_hook(hook_t hook) {
+  frame_end_hooks.push_back(std::move(hook));
+}
+
+void cpu::add_write_hook(uint16 addr, write_hook_t hook) {
+  write_hooks.push_back({addr, std::move(hook)});
+  watch_page(addr >> 8, page_watch[addr >> 8] | WATCH_HOOK);
+}
+
+void cpu::clear_hooks() {
+  interval_hooks.clear();
+  frame_end_hooks.clear();
+  write_hooks.clear();
+  for (uint32 page = 0; page < page_watch.size(); page++) {
+    watch_page(page, page_watch[page] & ~WATCH_HOOK);
+  }
+}
+
+bool cpu::has_hooks() const {
+  return !interval_hooks.empty() || !frame_end_hooks.empty() ||
+         !write_hooks.empty();
+}
+
+void cpu::track_dirty(uint16 begin, uint16 end) {
+  for (uint32 addr = begin; addr < end; addr++) {
+    dirty_bits[addr / 64] |= uint64{1} << (addr % 64);
+    watch_page(addr >> 8, page_watch[addr >> 8] | WATCH_DIRTY);
+  }
+}
+
+void cpu::watch_page(uint8 page, uint8 bits) {
+  page_watch[page] = bits;
+  bus.set_write_watch(page, bits != 0);
+}
+
+void cpu::publish_flags() {
+  if (flags_lazy) {
+    status = current_status();
+  }
+}
+
+void cpu::adopt_flags() {
+  if (flags_lazy) {
+    zn = zn_of(status);
+  }
+}
 
-    if (pc_before_op == pc) {
-      pc += info.bytes - 1;
+uint8 cpu::read_slow(uint16 addr) {
+  publish_flags();
+  const uint8 val = bus.read_slow(addr);
+  adopt_flags();
+  return val;
+}
+
+void cpu::watched_write(uint16 addr, uint8 val) {
+  const uint8 watch = page_watch[addr >> 8];
+  if (watch & WATCH_SNAPSHOT) {
+    // Mirrors write through to their primary page, which is what a delta
+    // has to record.
+    if (const uint8 *target = bus.ram_page(addr)) {
+      const uint32 page = (target - memory) >> 8;
+      snapshot_pages[page / 64] |= uint64{1} << (page % 64);
+    }
+    watch_page(addr >> 8, watch & ~WATCH_SNAPSHOT);
+  }
+  if ((watch & WATCH_DIRTY) && bus.peek(addr) != val) {
+    dirty_bits[addr / 64] |= uint64{1} << (addr % 64);
+  }
+  if ((watch & WATCH_CODE) && bus.peek(addr) != val) {
+    code_written |= decoded->invalidate(bus.ram_address(addr));
+  }
+  publish_flags();
+  bus.write_slow(addr, val);
+  if (watch & WATCH_HOOK) {
+    for (auto &hook : write_hooks) {
+      if (hook.addr == addr) {
+        hook.hook(*this, addr, val);
+      }
     }
   }
+  adopt_flags();
 }
 
 } // namespace nes_simulator
\ No newline at end of file
@@ -1,8 +1,16 @@
 #pragma once
 
 #include <array>
+#include <bit>
+#include <cpu/bus.h>
+#include <cpu/decode_cache.h>
+#include <cpu/jit.h>
+#include <cpu/policy.h>
+#include <cpu/save_state.h>
 #include <cstddef>
 #include <functional>
+#include <memory>
+#include <string>
 #include <utils/types.h>
 #include <vector>
 
@@ -33,17 +41,51 @@ enum class flag {
   NegativeFlag = 7,
 };
 
+enum class Engine {
+  Switch,
+  Threaded,
+  // The threaded handlers run from pre-decoded basic blocks.
+  Cached,
+  // Cached, with hot blocks compiled to x86-64 code; see jit.h.
+  Jit,
+};
+
+// Engines by the names the front ends take on their command lines: switch,
+// threaded, cached and jit. parse_engine throws std::runtime_error for any
+// other name.
+Engine parse_engine(const std::string &name);
+const char *engine_name(Engine engine);
+
+constexpr uint64 NTSC_CPU_FREQUENCY = 1789773;
+constexpr double NTSC_FRAME_RATE = 60.0988;
+constexpr uint64 PAL_CPU_FREQUENCY = 1662607;
+constexpr double PAL_FRAME_RATE = 50.0070;
+
+class trace_writer;
+
 constexpr uint16 STACK = 0x0100;
 constexpr uint16 STACK_RESET = 0xFD;
 
 class cpu {
 public:
   using callback_t = std::function<void(cpu &cpu)>;
+  using hook_t = std::function<void(cpu &cpu)>;
+  using write_hook_t = std::function<void(cpu &cpu, uint16 addr, uint8 val)>;
 
   cpu();
+  // The bus holds pointers into `memory`.
+  cpu(const cpu &) = delete;
+  cpu &operator=(const cpu &) = delete;
 
   uint8 mem_read(uint16 addr);
   uint16 mem_read_uint16(uint16 addr);
+  // Zero page and stack accesses (addr < 0x200), which are always RAM.
+  uint8 low_read(uint16 addr);
+  void low_write(uint16 addr, uint8 val);
+  // Opcode and operand bytes, read through the page table without MMIO side
+  // effects; see memory_bus::fetch.
+  uint8 fetch(uint16 addr) const;
+  uint16 fetch_uint16(uint16 addr) const;
 
   void mem_write(uint16 addr, uint8 val);
   void mem_write_uint16(uint16 addr, uint16 val);
@@ -60,17 +102,371 @@ public:
                     callback_t callback = nullptr);
   void load(const uint8 *program, int length);
   void run(callback_t &&callback = nullptr);
+  void run_switch(callback_t &&callback = nullptr);
+  void run_threaded(callback_t &&callback = nullptr);
+  void run_cached(callback_t &&callback = nullptr);
+  void run_jit(callback_t &&callback = nullptr);
   void reset();
 
+  // Drops every block the Cached and Jit engines have decoded. Writes
+  // through the cpu, load(), restores and bus remaps are noticed on their
+  // own; this is for code written into `memory` directly.
+  void flush_decoded();
+
+  // Hash of the architectural state: registers, cycle count and memory.
+  uint64 state_digest() const;
+
+  // Batched execution: tight loops with no per-instruction callback that
+  // return the number of instructions executed. They stop early when the
+  // program halts. `Policy` picks the features compiled into the loop (see
+  // policy.h); the library ships run_instructions and run_cycles built for
+  // fast_policy and debug_policy.
+  template <class Policy = fast_policy> uint64 run_instructions(uint64 count);
+  // `predicate(cpu)` is asked before every instruction and sees the cpu as
+  // it stands then, `instructions` and the flags included, on every engine.
+  template <class Policy = fast_policy, class Predicate>
+  uint64 run_until(Predicate &&predicate);
+
+  // Runs whole instructions until at least `budget` cycles have elapsed and
+  // returns the cycles actually spent; the overshoot is at most one
+  // instruction and is meant to be carried into the next budget.
+  template <class Policy = fast_policy> uint64 run_cycles(uint64 budget);
+  uint64 run_frame(uint64 budget);
+
+  // Runs with breakpoints compiled in stop before an instruction at any of
+  // these addresses and set at_breakpoint; the next such run starts by
+  // executing that instruction.
+  void add_breakpoint(uint16 addr);
+  void remove_breakpoint(uint16 addr);
+  void clear_breakpoints();
+
+  // Runs with tracing compiled in record every instruction into `trace`;
+  // nullptr stops them.
+  void trace_to(trace_writer *trace) { tracer = trace; }
+
+  void add_interval_hook(uint64 interval, hook_t hook);
+  void add_frame_end_hook(hook_t hook);
+  void add_write_hook(uint16 addr, write_hook_t hook);
+  void clear_hooks();
+  bool has_hooks() const;
+
+  // Dirty tracking for video regions: writes that change a byte in
+  // [begin, end) are recorded, and consume_dirty hands each such address to
+  // `fn` once and clears it. A newly tracked region starts fully dirty.
+  void track_dirty(uint16 begin, uint16 end);
+  template <class Fn> uint32 consume_dirty(uint16 begin, uint16 end, Fn &&fn);
+
+  // Save states. Every save starts tracking which image pages are written
+  // next, so save_delta costs a page copy per page written since the
+  // previous save rather than 64 KB. Writes are tracked by watching every
+  // page until its first write; writes that bypass the cpu (memcpy into
+  // `memory`, bus remaps) are not seen. Pages not written since the last
+  // save stay watched, so once a cpu has saved, the bus is not flat and runs
+  // take the Paged bus path for good (see memory_bus::flat).
+  // Restoring restarts tracking from the restored state and re-arms
+  // interval hooks relative to its instruction count.
+  void save(save_state &state);
+  // Throws std::runtime_error if nothing has been saved yet.
+  void save_delta(state_delta &delta);
+  void restore(const save_state &state);
+  // Applies a delta taken on top of the state the cpu is currently in.
+  void restore(const state_delta &delta);
+
 public:
+  // Flag access for the engines. While one runs, Z and N are not kept in
+  // `status` but derived from the last result (see `zn`); `status` gets them
+  // back whenever code outside the engine can look: callbacks, predicates,
+  // write hooks, MMIO handlers, and when the run returns. Outside a run these
+  // use `status` alone, so the host may write it between runs.
   bool status_bit_get(flag flag);
   void status_bit_set(flag flag, bool v);
   void update_zero_negative_flag(uint8 reg);
+  // The full P byte, as PHP pushes it, and a P byte to take on, as PLP and
+  // RTI pull it.
+  uint8 current_status() const;
+  void load_status(uint8 value);
+  void branch(bool condition);
+  void branch(bool condition, uint8 offset);
 
 public:
   uint8 reg_a, reg_x, reg_y, sp, status;
   uint16 pc;
-  uint8 memory[0xFFFF];
+  // The bus's 64 KB image, mapped as RAM over the whole address space until
+  // the bus is remapped.
+  uint8 memory[0x10000];
+  memory_bus bus;
+
+  Engine engine;
+  bool halted;
+  bool at_breakpoint;
+  uint64 instructions;
+  uint64 cycles;
+
+private:
+  struct interval_hook {
+    uint64 interval;
+    uint64 next;
+    hook_t hook;
+  };
+
+  struct write_hook {
+    uint16 addr;
+    write_hook_t hook;
+  };
+
+  // run_cycles' predicate, the one the Jit engine can run native code
+  // under.
+  struct cycle_deadline {
+    uint64 target;
+    bool operator()(const cpu &c) const { return c.cycles >= target; }
+  };
+
+  // The stop run_batched runs a cycle_deadline batch under. It is plain
+  // enough for the decode cache interpreter to see how far it may skip.
+  struct deadline_stop {
+    uint64 remaining;
+    uint64 target;
+    bool operator()(const cpu &c) {
+      if (remaining == 0 || c.cycles >= target) {
+        return true;
+      }
+      remaining--;
+      return false;
+    }
+  };
+
+  // Makes `zn` the home of Z and N for the length of an engine's run. Runs
+  // may nest through hooks, which see status published.
+  class lazy_flags {
+  public:
+    explicit lazy_flags(cpu &c) : c(c), outer(c.flags_lazy) {
+      c.zn = zn_of(c.status);
+      c.flags_lazy = true;
+    }
+    ~lazy_flags() {
+      c.status = c.current_status();
+      c.flags_lazy = outer;
+    }
+    lazy_flags(const lazy_flags &) = delete;
+    lazy_flags &operator=(const lazy_flags &) = delete;
+
+  private:
+    cpu &c;
+    bool outer;
+  };
+
+  static constexpr uint8 ZN_BITS = 0x82;
+  static constexpr uint8 zn_bits(uint16 zn) {
+    return ((zn & 0xFF) == 0) << 1 | ((zn & 0x180) != 0) << 7;
+  }
+  static constexpr uint16 zn_of(uint8 status) {
+    const bool zero = status & 0x02;
+    const bool negative = status & 0x80;
+    return zero ? (negative ? 0x100 : 0x00) : (negative ? 0x80 : 0x01);
+  }
+  // Around code outside the engine: fold Z and N into status for it to
+  // see, and take them back in case it changed status.
+  void publish_flags();
+  void adopt_flags();
+
+  template <class Policy> bool observe();
+  bool step_switch();
+  template <class Policy, class Stop> uint64 interpret_switch(Stop &&stop);
+  template <class Policy, class Stop> uint64 interpret(Stop &&stop);
+  template <class Policy, class Stop> uint64 interpret_cached(Stop &&stop);
+  uint64 interpret_jit(uint64 budget, uint64 cycle_target);
+  void prepare_decoded();
+  const decoded_block &cached_block(uint16 addr);
+  decoded_block &decode_block(uint16 addr);
+  // Fast-forwards through an idle loop (see idle_loop) at its start, running
+  // at most `budget` instructions and stopping before any instruction that
+  // would start at or past `cycle_target`. Returns the instructions run;
+  // none if the loop is not worth skipping here.
+  uint64 skip_idle(const decoded_block &block, uint64 budget,
+                   uint64 cycle_target);
+  template <class Policy, class Predicate>
+  uint64 run_batched(uint64 limit, Predicate &&predicate);
+  uint8 read_slow(uint16 addr);
+  void watched_write(uint16 addr, uint8 val);
+  void watch_page(uint8 page, uint8 bits);
+  cpu_registers save_registers() const;
+  void restore_registers(const cpu_registers &registers);
+  void restore_page(uint8 page, const uint8 *data);
+  void start_snapshot_tracking();
+
+  enum page_watch_bits : uint8 {
+    WATCH_HOOK = 1 << 0,
+    WATCH_DIRTY = 1 << 1,
+    // Armed on every page by a save and cleared by the page's first write.
+    WATCH_SNAPSHOT = 1 << 2,
+    // RAM holding decoded code, and every page mirroring it.
+    WATCH_CODE = 1 << 3,
+  };
+
+  std::vector<interval_hook> interval_hooks;
+  std::vector<hook_t> frame_end_hooks;
+  std::vector<write_hook> write_hooks;
+  std::array<uint8, 0x100> page_watch;
+  std::array<uint64, 0x10000 / 64> dirty_bits;
+  std::array<uint64, 0x10000 / 64> breakpoint_bits;
+  trace_writer *tracer;
+  // Image pages written since the last save.
+  std::array<uint64, 0x100 / 64> snapshot_pages;
+  bool snapshot_tracking;
+  bool page_crossed;
+  // Created on the Cached or Jit engine's first run.
+  std::unique_ptr<decode_cache> decoded;
+  std::unique_ptr<jit_compiler> jit;
+  // Set when a write invalidates decoded code, so that the running block is
+  // left before its next instruction.
+  bool code_written;
+  // Z and N while an engine runs: Z is set when the low byte is zero and N
+  // when bit 7 or 8 is. Results are stored as they are, so setting both
+  // flags costs one store; bit 8 only encodes a P byte with Z and N both
+  // set, which no result can produce.
+  uint16 zn;
+  bool flags_lazy;
 };
 
+// Built once in the library rather than in every caller.
+extern template uint64 cpu::run_instructions<fast_policy>(uint64 count);
+extern template uint64 cpu::run_instructions<debug_policy>(uint64 count);
+extern template uint64 cpu::run_cycles<fast_policy>(uint64 budget);
+extern template uint64 cpu::run_cycles<debug_policy>(uint64 budget);
+
+// Memory accesses are forced inline: they sit in every handler of the
+// threaded interpreter, where the compiler's size heuristics give up.
+[[gnu::always_inline]] inline uint8 cpu::mem_read(uint16 addr) {
+  if (const uint8 *page = bus.read_page(addr)) [[likely]] {
+    return page[addr & 0xFF];
+  }
+  return read_slow(addr);
+}
+[[gnu::always_inline]] inline uint16 cpu::mem_read_uint16(uint16 addr) {
+  return static_cast<uint16>(mem_read(addr + 1) << 8) | mem_read(addr);
+}
+[[gnu::always_inline]] inline uint8 cpu::low_read(uint16 addr) {
+  return memory[addr];
+}
+// The page table is still checked so that watched pages take the slow path.
+[[gnu::always_inline]] inline void cpu::low_write(uint16 addr, uint8 val) {
+  if (bus.write_page(addr)) [[likely]] {
+    memory[addr] = val;
+    return;
+  }
+  watched_write(addr, val);
+}
+[[gnu::always_inline]] inline uint8 cpu::fetch(uint16 addr) const {
+  return bus.fetch(addr);
+}
+[[gnu::always_inline]] inline uint16 cpu::fetch_uint16(uint16 addr) const {
+  return static_cast<uint16>(fetch(addr + 1) << 8) | fetch(addr);
+}
+
+// Pages that are watched, ROM, MMIO or unmapped have no write pointer and
+// take the slow path.
+[[gnu::always_inline]] inline void cpu::mem_write(uint16 addr, uint8 val) {
+  if (uint8 *page = bus.write_page(addr)) [[likely]] {
+    page[addr & 0xFF] = val;
+    return;
+  }
+  watched_write(addr, val);
+}
+inline void cpu::mem_write_uint16(uint16 addr, uint16 val) {
+  mem_write(addr, val & 0xFF);
+  mem_write(addr + 1, val >> 8);
+}
+
+inline uint8 cpu::stack_pop() {
+  sp++;
+  return low_read(STACK + sp);
+}
+
+inline uint16 cpu::stack_pop_uint16() {
+  uint16 lo = stack_pop();
+  uint16 hi = stack_pop();
+  return hi << 8 | lo;
+}
+
+inline void cpu::stack_push(uint8 data) {
+  low_write(STACK + sp, data);
+  sp--;
+}
+
+inline void cpu::stack_push_uint16(uint16 data) {
+  stack_push(data >> 8);
+  stack_push(data & 0xff);
+}
+
+inline bool cpu::status_bit_get(flag flag) {
+  uint8 t = 1 << static_cast<int>(flag);
+  if ((t & ZN_BITS) && flags_lazy) [[likely]] {
+    return zn_bits(zn) & t;
+  }
+  return status & t;
+}
+
+inline void cpu::status_bit_set(flag flag, bool v) {
+  uint8 t = 1 << static_cast<int>(flag);
+  if ((t & ZN_BITS) && flags_lazy) [[likely]] {
+    const uint8 bits = zn_bits(zn);
+    zn = zn_of(v ? bits | t : bits & ~t);
+    return;
+  }
+  v ? status |= t : status &= ~t;
+}
+
+inline void cpu::update_zero_negative_flag(uint8 reg) {
+  zn = reg;
+  if (!flags_lazy) [[unlikely]] {
+    status = (status & ~ZN_BITS) | zn_bits(reg);
+  }
+}
+
+inline uint8 cpu::current_status() const {
+  return flags_lazy ? (status & ~ZN_BITS) | zn_bits(zn) : status;
+}
+
+inline void cpu::load_status(uint8 value) {
+  status = value;
+  zn = zn_of(value);
+}
+
+// pc points at the offset byte. A taken branch costs one extra cycle, and one
+// more when the target is on a different page than the next instruction.
+inline void cpu::branch(bool condition) { branch(condition, fetch(pc)); }
+
+inline void cpu::branch(bool condition, uint8 offset) {
+  if (condition) {
+    const uint16 next = pc + 1;
+    pc += (int8)offset + 1;
+    cycles += 1 + ((next & 0xFF00) != (pc & 0xFF00));
+  }
+}
+
+template <class Fn>
+uint32 cpu::consume_dirty(uint16 begin, uint16 end, Fn &&fn) {
+  uint32 consumed = 0;
+  for (uint32 word = begin / 64; word < (end + 63u) / 64; word++) {
+    uint64 bits = dirty_bits[word];
+    const uint32 base = word * 64;
+    if (base < begin) {
+      bits &= ~uint64{0} << (begin - base);
+    }
+    if (base + 64 > end) {
+      bits &= ~uint64{0} >> (base + 64 - end);
+    }
+    if (bits == 0) {
+      continue;
+    }
+
+    dirty_bits[word] &= ~bits;
+    consumed += std::popcount(bits);
+    for (; bits != 0; bits &= bits - 1) {
+      fn(static_cast<uint16>(base + std::countr_zero(bits)));
+    }
+  }
+  return consumed;
+}
+
 } // namespace nes_simulator
\ No newline at end of file
@@ -0,0 +1,273 @@
+#include "cpu/decode_cache.h"
+#include "cpu/cpu.h"
+#include "cpu/instructions.h"
+#include "cpu/opcode.h"
+#include <algorithm>
+
+namespace nes_simulator {
+
+namespace {
+
+bool polls(uint8 opcode) {
+  switch (opcode) {
+  case 0xA5: // LDA
+  case 0xAD:
+  case 0xA6: // LDX
+  case 0xAE:
+  case 0xA4: // LDY
+  case 0xAC:
+  case 0x24: // BIT
+  case 0x2C:
+  case 0xC5: // CMP
+  case 0xCD:
+  case 0xE4: // CPX
+  case 0xEC:
+  case 0xC4: // CPY
+  case 0xCC:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool counts(uint8 opcode) {
+  return opcode == 0xCA || opcode == 0x88 || opcode == 0xE8 ||
+         opcode == 0xC8;
+}
+
+void classify_idle(decoded_block &block) {
+  const std::size_t lap_ops = block.ops.size() - 1;
+  const micro_op &last = block.ops[lap_ops - 1];
+  const opcode_info &info = opcodes[last.handler];
+  const uint16 next = block.start + block.size;
+  const bool loops =
+      info.mode == AddressingMode::Relative
+          ? static_cast<uint16>(next + static_cast<int8>(last.operand)) ==
+                block.start
+          : info.opcode == OpcodeType::JMP_ABS && last.operand == block.start;
+  if (!loops) {
+    return;
+  }
+
+  // A taken branch costs one cycle more, and one more again across a page.
+  uint32 cycles = info.cycle + 2;
+  uint32 counters = 0, nops = 0;
+  for (std::size_t i = 0; i + 1 < lap_ops; i++) {
+    const uint8 opcode = block.ops[i].handler;
+    cycles += opcodes[opcode].cycle;
+    counters += counts(opcode);
+    nops += opcode == 0xEA;
+  }
+
+  if (last.handler == 0xD0 && counters == 1 && nops + 2 == lap_ops) {
+    block.idle = idle_loop::Count;
+  } else if (lap_ops == 1 ||
+             (lap_ops == 2 && polls(block.ops[0].handler))) {
+    block.idle = idle_loop::Poll;
+  } else {
+    return;
+  }
+  block.lap_cycles = cycles;
+}
+
+} // namespace
+
+decode_cache::decode_cache(uint64 mappings)
+    : blocks(), entries(), page_blocks(), code_bytes(), layout(mappings) {}
+
+decoded_block &decode_cache::decode(const memory_bus &bus, uint16 pc) {
+  retired.clear();
+  retire(pc);
+
+  auto block = std::make_unique<decoded_block>();
+  block->start = pc;
+  uint32 addr = pc;
+  for (;;) {
+    const uint8 opcode = bus.fetch(addr);
+    const opcode_info info = opcodes[opcode];
+    const uint16 operand = bus.fetch(addr + 1) | bus.fetch(addr + 2) << 8;
+    block->ops.push_back({opcode, operand});
+    addr += std::max<uint8>(info.bytes, 1);
+
+    const bool ends = is_control_flow(info.opcode) ||
+                      info.opcode == OpcodeType::BRK ||
+                      info.opcode == OpcodeType::UNKNOWN;
+    if (ends || block->ops.size() == MAX_BLOCK_OPS || addr >= 0x10000) {
+      break;
+    }
+  }
+  block->ops.push_back({BLOCK_END, 0});
+  block->size = addr - pc;
+  classify_idle(*block);
+
+  // A last instruction wrapping past $FFFF covers bytes at the bottom too.
+  for (uint32 i = pc; i < addr; i++) {
+    const uint16 byte = bus.ram_address(i);
+    code_bytes[byte / 64] |= uint64{1} << (byte % 64);
+    auto &starts = page_blocks[byte >> 8];
+    if (std::find(starts.begin(), starts.end(), pc) == starts.end()) {
+      starts.push_back(pc);
+    }
+  }
+
+  auto &entry = entries[pc >> 8];
+  if (!entry) {
+    entry = std::make_unique<entry_page>();
+  }
+  (*entry)[pc & 0xFF] = block.get();
+  return *blocks[pc >> 8].emplace_back(std::move(block));
+}
+
+bool decode_cache::invalidate(uint16 addr) {
+  if (!(code_bytes[addr / 64] >> (addr % 64) & 1)) {
+    return false;
+  }
+  invalidate_page(addr >> 8);
+  return true;
+}
+
+// Blocks reaching into a neighbouring page leave their bytes marked there;
+// a write to them later drops that page's blocks for nothing, which is only
+// a redundant decode.
+void decode_cache::invalidate_page(uint8 page) {
+  for (const uint16 start : page_blocks[page]) {
+    retire(start);
+  }
+  page_blocks[page].clear();
+  const uint32 first = (page << 8) / 64;
+  std::fill_n(&code_bytes[first], memory_bus::PAGE_SIZE / 64, 0);
+}
+
+// Every block is listed under its first page, so this costs the blocks there
+// are rather than a sweep of the 64K table.
+void decode_cache::clear(uint64 mappings) {
+  for (uint32 page = 0; page < page_blocks.size(); page++) {
+    if (!page_blocks[page].empty()) {
+      invalidate_page(page);
+    }
+  }
+  retired.clear();
+  layout = mappings;
+}
+
+void decode_cache::retire(uint16 start) {
+  auto &live = blocks[start >> 8];
+  for (auto &block : live) {
+    if (block->start == start) {
+      retired.push_back(std::move(block));
+      block = std::move(live.back());
+      live.pop_back();
+      (*entries[start >> 8])[start & 0xFF] = nullptr;
+      return;
+    }
+  }
+}
+
+// The slow half of cached_block, and where the interpreter goes after code
+// was written: starts over after a bus remap, decodes the block and watches
+// the RAM its bytes live in, through every page that maps onto it, so that
+// writes reach invalidate. ROM needs no watch, and MMIO and unmapped pages
+// only ever fetch as BRK.
+decoded_block &cpu::decode_block(uint16 addr) {
+  if (decoded->mappings() != bus.mappings()) {
+    flush_decoded();
+  }
+
+  decoded_block &block = decoded->decode(bus, addr);
+  static_assert(decode_cache::MAX_BLOCK_OPS * 3 <= memory_bus::PAGE_SIZE,
+                "a block spans at most two pages");
+  const uint8 first = addr >> 8;
+  const uint8 last = static_cast<uint16>(addr + block.size - 1) >> 8;
+  for (const uint8 page : {first, last}) {
+    const uint8 *ram = bus.ram_page(page << 8);
+    if (!ram || (page_watch[page] & WATCH_CODE)) {
+      continue;
+    }
+    for (uint32 mirror = 0; mirror < page_watch.size(); mirror++) {
+      if (bus.ram_page(mirror << 8) == ram) {
+        watch_page(mirror, page_watch[mirror] | WATCH_CODE);
+      }
+    }
+  }
+  return block;
+}
+
+void cpu::prepare_decoded() {
+  if (!decoded) {
+    decoded = std::make_unique<decode_cache>(bus.mappings());
+  } else if (decoded->mappings() != bus.mappings()) {
+    flush_decoded();
+  }
+}
+
+// Runs the first lap through the handlers, which tells whether the loop goes
+// round again and what a lap costs. Every later lap until the exit is the
+// same but for a Count loop's counter, so as many of them as can run before
+// the exit, the budget and the cycle target are added up at once. The stop
+// check before each instruction is never crossed: a lap is only skipped if
+// the cycles before its last instruction, let alone after it, stay below the
+// target. Whatever is left over, down to the lap that exits, is the
+// caller's to run.
+uint64 cpu::skip_idle(const decoded_block &block, uint64 budget,
+                      uint64 cycle_target) {
+  const uint64 lap = block.ops.size() - 1;
+  if (cycles >= cycle_target || budget / lap < 2 ||
+      (cycle_target - cycles - 1) / block.lap_cycles < 2) {
+    return 0;
+  }
+  if (block.idle == idle_loop::Poll && lap == 2) {
+    // Reads through a handler may return something new every time.
+    const micro_op &read = block.ops[0];
+    const uint16 addr = opcodes[read.handler].mode == AddressingMode::ZeroPage
+                            ? read.operand & 0xFF
+                            : read.operand;
+    if (!bus.read_table()[addr >> 8]) {
+      return 0;
+    }
+  }
+
+  const uint64 start = cycles;
+  for (const micro_op *op = block.ops.data();
+       op->handler != decode_cache::BLOCK_END; op++) {
+    pc++;
+    instruction_table[op->handler](*this);
+  }
+  if (pc != block.start) {
+    return lap;
+  }
+
+  const uint64 lap_cycles = cycles - start;
+  uint64 laps = std::min((budget - lap) / lap,
+                         (cycle_target - cycles - 1) / lap_cycles);
+  if (block.idle == idle_loop::Count) {
+    const auto counter = std::find_if(
+        block.ops.begin(), block.ops.end(),
+        [](const micro_op &op) { return op.handler != 0xEA; });
+    uint8 &reg =
+        counter->handler == 0xCA || counter->handler == 0xE8 ? reg_x : reg_y;
+    const bool down = counter->handler == 0xCA || counter->handler == 0x88;
+    // Laps still to take the branch back, each leaving the counter nonzero.
+    laps = std::min<uint64>(laps, down ? reg - 1 : 0xFF - reg);
+    reg = down ? reg - laps : reg + laps;
+    update_zero_negative_flag(reg);
+  }
+  cycles += laps * lap_cycles;
+  return lap + laps * lap;
+}
+
+// Native code lives as long as the blocks it was compiled from.
+void cpu::flush_decoded() {
+  for (uint32 page = 0; page < page_watch.size(); page++) {
+    if (page_watch[page] & WATCH_CODE) {
+      watch_page(page, page_watch[page] & ~WATCH_CODE);
+    }
+  }
+  if (decoded) {
+    decoded->clear(bus.mappings());
+  }
+  if (jit) {
+    jit->reset();
+  }
+}
+
+} // namespace nes_simulator
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <utils/types.h>
+#include <vector>
+
+namespace nes_simulator {
+
+class memory_bus;
+
+// One instruction of a decoded block. The opcode byte picks the handler and
+// the operand bytes ride along, so running it reads nothing from the image.
+struct micro_op {
+  // The opcode byte, or decode_cache::BLOCK_END after a block's last
+  // instruction.
+  uint16 handler;
+  // The operand bytes as a little-endian word; one-byte operands (immediates,
+  // zero page addresses, pointers, branch offsets) are the low byte.
+  uint16 operand;
+};
+
+struct jit_frame;
+
+// How a block that jumps or branches back to its own start spins, when a lap
+// does nothing but count a register or re-read one byte; see cpu::skip_idle.
+enum class idle_loop : uint8 {
+  None,
+  // NOPs around a single DEX, DEY, INX or INY, closed by BNE.
+  Count,
+  // At most one load, compare or BIT of a zero page or absolute byte, closed
+  // by a branch or JMP. Every lap leaves the same state behind.
+  Poll,
+};
+
+struct decoded_block {
+  uint16 start;
+  // Bytes of code the block was decoded from.
+  uint16 size;
+  std::vector<micro_op> ops;
+  idle_loop idle = idle_loop::None;
+  // For idle loops, a bound on the cycles of a lap.
+  uint16 lap_cycles = 0;
+  // The Jit engine's entries into the block, counted until it gets hot, and
+  // the code compiled then (null if its first instruction did not compile).
+  uint32 heat = 0;
+  void (*native)(jit_frame *frame) = nullptr;
+};
+
+// Guest basic blocks decoded into micro-ops, keyed by start address. A block
+// runs from its start through the first branch, jump, call, return or halt,
+// so only its last instruction can leave it anywhere but the next one.
+//
+// The cache only knows which bytes its blocks were decoded from, by the
+// image address writes to them land on (memory_bus::ram_address), so code
+// run from a RAM mirror is dropped by a write through any of its mirrors.
+// The cpu watches the pages mapping onto them and calls invalidate with that
+// address on every write there. Dropped blocks stay alive until the next
+// decode, since the interpreter may still be running the one that was
+// written to.
+class decode_cache {
+public:
+  static constexpr uint16 BLOCK_END = 0x100;
+  static constexpr uint32 MAX_BLOCK_OPS = 64;
+
+  // `mappings` is the bus layout (memory_bus::mappings) the blocks will be
+  // decoded under.
+  explicit decode_cache(uint64 mappings);
+
+  // The block at `pc`, or null.
+  decoded_block *find(uint16 pc) const {
+    const auto &page = entries[pc >> 8];
+    return page ? (*page)[pc & 0xFF] : nullptr;
+  }
+
+  // Decodes the block at `pc` as the bus fetches it. Not to be called while
+  // a block is running.
+  decoded_block &decode(const memory_bus &bus, uint16 pc);
+
+  // Drops the blocks on the page of `addr`, a RAM address as above, if a
+  // block covers that byte, and returns whether one did.
+  bool invalidate(uint16 addr);
+  void invalidate_page(uint8 page);
+
+  // Drops every block and starts over under a new bus layout. Not to be
+  // called while a block is running.
+  void clear(uint64 mappings);
+
+  uint64 mappings() const { return layout; }
+
+private:
+  void retire(uint16 start);
+
+  using entry_page = std::array<decoded_block *, 0x100>;
+
+  // Live blocks by the page they start on.
+  std::array<std::vector<std::unique_ptr<decoded_block>>, 0x100> blocks;
+  // Live blocks by start address, in pages allocated as code turns up on
+  // them.
+  std::array<std::unique_ptr<entry_page>, 0x100> entries;
+  // Start addresses of the blocks covering each page.
+  std::array<std::vector<uint16>, 0x100> page_blocks;
+  std::array<uint64, 0x10000 / 64> code_bytes;
+  std::vector<std::unique_ptr<decoded_block>> retired;
+  uint64 layout;
+};
+
+} // namespace nes_simulator
@@ -0,0 +1,491 @@
+#pragma once
+
+#include <array>
+#include <cpu/cpu.h>
+#include <cpu/opcode.h>
+#include <cpu/policy.h>
+#include <utility>
+#include <utils/types.h>
+
+namespace nes_simulator {
+
+// Instruction bytes through the page table, or straight from the image
+// while the bus is flat.
+template <bus_access Bus>
+[[gnu::always_inline]] inline uint8 code_byte(const cpu &c, uint16 addr) {
+  if constexpr (Bus == bus_access::Flat) {
+    return c.memory[addr];
+  } else {
+    return c.fetch(addr);
+  }
+}
+
+// Where an instruction's operand bytes come from. The interpreters read them
+// from the instruction stream at pc; the decode cache hands over the bytes it
+// read when it decoded the block.
+template <bus_access Bus = bus_access::Paged> struct stream_operand {
+  [[gnu::always_inline]] uint8 byte(cpu &c) const {
+    return code_byte<Bus>(c, c.pc);
+  }
+  [[gnu::always_inline]] uint16 word(cpu &c) const {
+    return static_cast<uint16>(code_byte<Bus>(c, c.pc + 1) << 8) |
+           code_byte<Bus>(c, c.pc);
+  }
+};
+
+struct decoded_operand {
+  uint16 value;
+
+  [[gnu::always_inline]] uint8 byte(cpu &) const { return value; }
+  [[gnu::always_inline]] uint16 word(cpu &) const { return value; }
+};
+
+// Compile-time counterpart of cpu::get_addr: the addressing mode is a template
+// argument, so each instantiation is just its own operand fetch. With
+// PagePenalty set, indexed modes charge the page-crossing cycle directly.
+template <AddressingMode Mode, bool PagePenalty = false, class Operand>
+[[gnu::always_inline]] inline uint16 operand_addr(cpu &c, Operand operand) {
+  if constexpr (Mode == AddressingMode::Immediate ||
+                Mode == AddressingMode::Relative ||
+                Mode == AddressingMode::Implied) {
+    return c.pc;
+  } else if constexpr (Mode == AddressingMode::ZeroPage) {
+    return operand.byte(c);
+  } else if constexpr (Mode == AddressingMode::Absolute) {
+    return operand.word(c);
+  } else if constexpr (Mode == AddressingMode::ZeroPage_X) {
+    return operand.byte(c) + c.reg_x;
+  } else if constexpr (Mode == AddressingMode::ZeroPage_Y) {
+    return operand.byte(c) + c.reg_y;
+  } else if constexpr (Mode == AddressingMode::Absolute_X ||
+                       Mode == AddressingMode::Absolute_Y) {
+    uint16 base = operand.word(c);
+    uint16 addr =
+        base + (Mode == AddressingMode::Absolute_X ? c.reg_x : c.reg_y);
+    if constexpr (PagePenalty) {
+      c.cycles += (base & 0xFF00) != (addr & 0xFF00);
+    }
+    return addr;
+  } else if constexpr (Mode == AddressingMode::Indirect_X) {
+    uint8 ptr = operand.byte(c) + c.reg_x;
+    return static_cast<uint16>(c.low_read(ptr + 1) << 8) | c.low_read(ptr);
+  } else if constexpr (Mode == AddressingMode::Indirect_Y) {
+    uint8 ptr = operand.byte(c);
+    uint16 base =
+        static_cast<uint16>(c.low_read(ptr + 1) << 8) | c.low_read(ptr);
+    uint16 addr = base + c.reg_y;
+    if constexpr (PagePenalty) {
+      c.cycles += (base & 0xFF00) != (addr & 0xFF00);
+    }
+    return addr;
+  }
+}
+
+constexpr bool is_zero_page(AddressingMode mode) {
+  return mode == AddressingMode::ZeroPage ||
+         mode == AddressingMode::ZeroPage_X ||
+         mode == AddressingMode::ZeroPage_Y;
+}
+
+// Data accesses through the bus, or straight into the image while it is
+// flat.
+template <bus_access Bus>
+[[gnu::always_inline]] inline uint8 bus_read(cpu &c, uint16 addr) {
+  if constexpr (Bus == bus_access::Flat) {
+    return c.memory[addr];
+  } else {
+    return c.mem_read(addr);
+  }
+}
+
+template <bus_access Bus>
+[[gnu::always_inline]] inline void bus_write(cpu &c, uint16 addr, uint8 val) {
+  if constexpr (Bus == bus_access::Flat) {
+    c.memory[addr] = val;
+  } else {
+    c.mem_write(addr, val);
+  }
+}
+
+template <bus_access Bus>
+[[gnu::always_inline]] inline void push(cpu &c, uint8 val) {
+  if constexpr (Bus == bus_access::Flat) {
+    c.memory[STACK + c.sp--] = val;
+  } else {
+    c.stack_push(val);
+  }
+}
+
+template <bus_access Bus>
+[[gnu::always_inline]] inline void push_uint16(cpu &c, uint16 val) {
+  push<Bus>(c, val >> 8);
+  push<Bus>(c, val & 0xff);
+}
+
+// Data accesses at an operand address: zero page modes stay in low RAM,
+// everything else goes through the bus.
+template <AddressingMode Mode, bus_access Bus = bus_access::Paged>
+[[gnu::always_inline]] inline uint8 load(cpu &c, uint16 addr) {
+  if constexpr (is_zero_page(Mode)) {
+    return c.low_read(addr);
+  } else {
+    return bus_read<Bus>(c, addr);
+  }
+}
+
+template <AddressingMode Mode, bus_access Bus = bus_access::Paged>
+[[gnu::always_inline]] inline void store(cpu &c, uint16 addr, uint8 val) {
+  if constexpr (is_zero_page(Mode) && Bus == bus_access::Paged) {
+    c.low_write(addr, val);
+  } else {
+    bus_write<Bus>(c, addr, val);
+  }
+}
+
+// The byte an instruction operates on; immediates come straight from the
+// instruction stream.
+template <AddressingMode Mode, bool PagePenalty = false,
+          bus_access Bus = bus_access::Paged, class Operand>
+[[gnu::always_inline]] inline uint8 read_operand(cpu &c, Operand operand) {
+  if constexpr (Mode == AddressingMode::Immediate) {
+    return operand.byte(c);
+  } else {
+    return load<Mode, Bus>(c, operand_addr<Mode, PagePenalty>(c, operand));
+  }
+}
+
+constexpr bool is_control_flow(OpcodeType type) {
+  switch (type) {
+  case OpcodeType::BCC:
+  case OpcodeType::BCS:
+  case OpcodeType::BEQ:
+  case OpcodeType::BMI:
+  case OpcodeType::BNE:
+  case OpcodeType::BPL:
+  case OpcodeType::BVC:
+  case OpcodeType::BVS:
+  case OpcodeType::JMP_ABS:
+  case OpcodeType::JMP_IND:
+  case OpcodeType::JSR:
+  case OpcodeType::RTI:
+  case OpcodeType::RTS:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Instructions that can write memory, and with it code the decode cache has
+// decoded.
+constexpr bool writes_memory(OpcodeType type) {
+  switch (type) {
+  case OpcodeType::STA:
+  case OpcodeType::STX:
+  case OpcodeType::STY:
+  case OpcodeType::INC:
+  case OpcodeType::DEC:
+  case OpcodeType::ASL:
+  case OpcodeType::LSR:
+  case OpcodeType::ROL:
+  case OpcodeType::ROR:
+  case OpcodeType::PHA:
+  case OpcodeType::PHP:
+  case OpcodeType::JSR:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Executes the instruction at opcode byte `Opcode`, with pc already past the
+// opcode byte and its operand bytes coming from `operand`. Mirrors one case
+// of cpu::run_switch, including its pc and cycle bookkeeping. Returns false
+// when the cpu halts (BRK or an unknown opcode).
+template <uint8 Opcode, bus_access Bus = bus_access::Paged, class Operand>
+[[gnu::always_inline]] inline bool execute(cpu &c, Operand operand) {
+  constexpr opcode_info info = opcodes[Opcode];
+  constexpr OpcodeType type = info.opcode;
+  constexpr AddressingMode mode = info.mode;
+  constexpr bool page_penalty = has_page_cross_penalty(type);
+
+  c.cycles += info.cycle;
+
+  if constexpr (type == OpcodeType::UNKNOWN || type == OpcodeType::BRK) {
+    return false;
+  }
+
+  const uint16 pc_before_op = c.pc;
+
+  if constexpr (type == OpcodeType::LDA) {
+    c.reg_a = read_operand<mode, page_penalty, Bus>(c, operand);
+    c.update_zero_negative_flag(c.reg_a);
+  } else if constexpr (type == OpcodeType::LDX) {
+    c.reg_x = read_operand<mode, page_penalty, Bus>(c, operand);
+    c.update_zero_negative_flag(c.reg_x);
+  } else if constexpr (type == OpcodeType::LDY) {
+    c.reg_y = read_operand<mode, page_penalty, Bus>(c, operand);
+    c.update_zero_negative_flag(c.reg_y);
+  } else if constexpr (type == OpcodeType::STA) {
+    store<mode, Bus>(c, operand_addr<mode, page_penalty>(c, operand), c.reg_a);
+  } else if constexpr (type == OpcodeType::STX) {
+    store<mode, Bus>(c, operand_addr<mode, page_penalty>(c, operand), c.reg_x);
+  } else if constexpr (type == OpcodeType::STY) {
+    store<mode, Bus>(c, operand_addr<mode, page_penalty>(c, operand), c.reg_y);
+  } else if constexpr (type == OpcodeType::ADC ||
+                       type == OpcodeType::SBC) {
+    uint8 base = read_operand<mode, page_penalty, Bus>(c, operand);
+    if constexpr (type == OpcodeType::SBC) {
+      base = -(base + 1);
+    }
+    uint16 tmp = static_cast<uint16>(c.reg_a) + base +
+                 c.status_bit_get(flag::CarryFlag);
+
+    c.status_bit_set(flag::CarryFlag, tmp > 0xff);
+    c.status_bit_set(flag::OverflowFlag,
+                     (static_cast<uint8>(tmp ^ base) &
+                      static_cast<uint8>(tmp ^ c.reg_a) & 0x80) != 0);
+
+    c.reg_a = tmp & 0xff;
+    c.update_zero_negative_flag(c.reg_a);
+  } else if constexpr (type == OpcodeType::AND) {
+    c.reg_a &= read_operand<mode, page_penalty, Bus>(c, operand);
+    c.update_zero_negative_flag(c.reg_a);
+  } else if constexpr (type == OpcodeType::ORA) {
+    c.reg_a |= read_operand<mode, page_penalty, Bus>(c, operand);
+    c.update_zero_negative_flag(c.reg_a);
+  } else if constexpr (type == OpcodeType::EOR) {
+    c.reg_a ^= read_operand<mode, page_penalty, Bus>(c, operand);
+    c.update_zero_negative_flag(c.reg_a);
+  } else if constexpr (type == OpcodeType::BCC || type == OpcodeType::BCS ||
+                       type == OpcodeType::BEQ || type == OpcodeType::BMI ||
+                       type == OpcodeType::BNE || type == OpcodeType::BPL ||
+                       type == OpcodeType::BVC || type == OpcodeType::BVS) {
+    constexpr flag tested = type == OpcodeType::BCC || type == OpcodeType::BCS
+                                ? flag::CarryFlag
+                            : type == OpcodeType::BEQ || type == OpcodeType::BNE
+                                ? flag::ZeroFlag
+                            : type == OpcodeType::BMI || type == OpcodeType::BPL
+                                ? flag::NegativeFlag
+                                : flag::OverflowFlag;
+    constexpr bool expected = type == OpcodeType::BCS ||
+                              type == OpcodeType::BEQ ||
+                              type == OpcodeType::BMI ||
+                              type == OpcodeType::BVS;
+    c.branch(c.status_bit_get(tested) == expected, operand.byte(c));
+  } else if constexpr (type == OpcodeType::JMP_ABS) {
+    c.pc = operand.word(c);
+  } else if constexpr (type == OpcodeType::JMP_IND) {
+    uint16 addr = operand.word(c);
+    if ((addr & 0xFF) == 0xFF) {
+      c.pc = (bus_read<Bus>(c, addr & 0xFF00) << 8) | bus_read<Bus>(c, addr);
+    } else {
+      c.pc = static_cast<uint16>(bus_read<Bus>(c, addr + 1) << 8) |
+             bus_read<Bus>(c, addr);
+    }
+  } else if constexpr (type == OpcodeType::JSR) {
+    push_uint16<Bus>(c, c.pc + 2 - 1);
+    c.pc = operand.word(c);
+  } else if constexpr (type == OpcodeType::NOP) {
+  } else if constexpr (type == OpcodeType::INX) {
+    c.reg_x += 1;
+    c.update_zero_negative_flag(c.reg_x);
+  } else if constexpr (type == OpcodeType::INY) {
+    c.reg_y += 1;
+    c.update_zero_negative_flag(c.reg_y);
+  } else if constexpr (type == OpcodeType::DEX) {
+    c.reg_x -= 1;
+    c.update_zero_negative_flag(c.reg_x);
+  } else if constexpr (type == OpcodeType::DEY) {
+    c.reg_y -= 1;
+    c.update_zero_negative_flag(c.reg_y);
+  } else if constexpr (type == OpcodeType::ASL) {
+    uint16 addr = operand_addr<mode, page_penalty>(c, operand);
+    uint8 data = load<mode, Bus>(c, addr);
+    c.status_bit_set(flag::CarryFlag, data & 0x80);
+
+    data <<= 1;
+    store<mode, Bus>(c, addr, data);
+    c.update_zero_negative_flag(data);
+  } else if constexpr (type == OpcodeType::ASL_ACC) {
+    c.status_bit_set(flag::CarryFlag, c.reg_a & 0x80);
+    c.reg_a <<= 1;
+    c.update_zero_negative_flag(c.reg_a);
+  } else if constexpr (type == OpcodeType::BIT) {
+    uint8 data = read_operand<mode, page_penalty, Bus>(c, operand);
+    uint8 tmp = c.reg_a & data;
+    c.status_bit_set(flag::ZeroFlag, tmp == 0);
+    c.status_bit_set(flag::NegativeFlag, data & 0x80);
+    c.status_bit_set(flag::OverflowFlag, data & 0x40);
+  } else if constexpr (type == OpcodeType::CLC) {
+    c.status_bit_set(flag::CarryFlag, false);
+  } else if constexpr (type == OpcodeType::CLD) {
+    c.status_bit_set(flag::DecimalModeFlag, false);
+  } else if constexpr (type == OpcodeType::CLI) {
+    c.status_bit_set(flag::InterruptDisable, false);
+  } else if constexpr (type == OpcodeType::SLC) {
+    c.status_bit_set(flag::CarryFlag, true);
+  } else if constexpr (type == OpcodeType::SLD) {
+    c.status_bit_set(flag::DecimalModeFlag, true);
+  } else if constexpr (type == OpcodeType::SLI) {
+    c.status_bit_set(flag::InterruptDisable, true);
+  } else if constexpr (type == OpcodeType::CLV) {
+    c.status_bit_set(flag::OverflowFlag, false);
+  } else if constexpr (type == OpcodeType::CMP || type == OpcodeType::CPX ||
+                       type == OpcodeType::CPY) {
+    const uint8 reg = type == OpcodeType::CMP   ? c.reg_a
+                      : type == OpcodeType::CPX ? c.reg_x
+                                                : c.reg_y;
+    uint8 data = read_operand<mode, page_penalty, Bus>(c, operand);
+    c.status_bit_set(flag::CarryFlag, reg >= data);
+    c.update_zero_negative_flag(reg - data);
+  } else if constexpr (type == OpcodeType::LSR_ACC) {
+    c.status_bit_set(flag::CarryFlag, c.reg_a & 1);
+    c.reg_a >>= 1;
+    c.update_zero_negative_flag(c.reg_a);
+  } else if constexpr (type == OpcodeType::LSR) {
+    uint16 addr = operand_addr<mode, page_penalty>(c, operand);
+    uint8 data = load<mode, Bus>(c, addr);
+    c.status_bit_set(flag::CarryFlag, data & 1);
+    data >>= 1;
+    store<mode, Bus>(c, addr, data);
+    c.update_zero_negative_flag(data);
+  } else if constexpr (type == OpcodeType::TAX) {
+    c.reg_x = c.reg_a;
+    c.update_zero_negative_flag(c.reg_x);
+  } else if constexpr (type == OpcodeType::TAY) {
+    c.reg_y = c.reg_a;
+    c.update_zero_negative_flag(c.reg_y);
+  } else if constexpr (type == OpcodeType::TSX) {
+    c.reg_x = c.sp;
+    c.update_zero_negative_flag(c.reg_x);
+  } else if constexpr (type == OpcodeType::TXA) {
+    c.reg_a = c.reg_x;
+    c.update_zero_negative_flag(c.reg_a);
+  } else if constexpr (type == OpcodeType::TXS) {
+    c.sp = c.reg_x;
+  } else if constexpr (type == OpcodeType::TYA) {
+    c.reg_a = c.reg_y;
+    c.update_zero_negative_flag(c.reg_a);
+  } else if constexpr (type == OpcodeType::PHA) {
+    push<Bus>(c, c.reg_a);
+  } else if constexpr (type == OpcodeType::PHP) {
+    push<Bus>(c, c.current_status());
+  } else if constexpr (type == OpcodeType::PLA) {
+    c.reg_a = c.stack_pop();
+    c.update_zero_negative_flag(c.reg_a);
+  } else if constexpr (type == OpcodeType::PLP) {
+    c.load_status(c.stack_pop());
+  } else if constexpr (type == OpcodeType::ROL_ACC) {
+    uint8 old_carry = c.status_bit_get(flag::CarryFlag);
+    c.status_bit_set(flag::CarryFlag, c.reg_a & 0x80);
+    c.reg_a = (c.reg_a << 1) | old_carry;
+    c.update_zero_negative_flag(c.reg_a);
+  } else if constexpr (type == OpcodeType::ROL) {
+    uint16 addr = operand_addr<mode, page_penalty>(c, operand);
+    uint8 data = load<mode, Bus>(c, addr);
+    uint8 old_carry = c.status_bit_get(flag::CarryFlag);
+    c.status_bit_set(flag::CarryFlag, data & 0x80);
+    data = (data << 1) | old_carry;
+    store<mode, Bus>(c, addr, data);
+    c.update_zero_negative_flag(data);
+  } else if constexpr (type == OpcodeType::ROR_ACC) {
+    uint8 old_carry = c.status_bit_get(flag::CarryFlag);
+    c.status_bit_set(flag::CarryFlag, c.reg_a & 1);
+    c.reg_a = (c.reg_a >> 1) | (old_carry << 7);
+    c.update_zero_negative_flag(c.reg_a);
+  } else if constexpr (type == OpcodeType::ROR) {
+    uint16 addr = operand_addr<mode, page_penalty>(c, operand);
+    uint8 data = load<mode, Bus>(c, addr);
+    uint8 old_carry = c.status_bit_get(flag::CarryFlag);
+    c.status_bit_set(flag::CarryFlag, data & 1);
+    data = (data >> 1) | (old_carry << 7);
+    store<mode, Bus>(c, addr, data);
+    c.update_zero_negative_flag(data);
+  } else if constexpr (type == OpcodeType::RTI) {
+    c.load_status(c.stack_pop());
+    c.status_bit_set(flag::BreakCommand, false);
+    c.status_bit_set(flag::BreakCommand2, true);
+    c.pc = c.stack_pop_uint16();
+  } else if constexpr (type == OpcodeType::RTS) {
+    c.pc = c.stack_pop_uint16() + 1;
+  } else if constexpr (type == OpcodeType::INC) {
+    uint16 addr = operand_addr<mode, page_penalty>(c, operand);
+    uint8 data = load<mode, Bus>(c, addr);
+    data++;
+    store<mode, Bus>(c, addr, data);
+    c.update_zero_negative_flag(data);
+  } else if constexpr (type == OpcodeType::DEC) {
+    uint16 addr = operand_addr<mode, page_penalty>(c, operand);
+    uint8 data = load<mode, Bus>(c, addr);
+    data--;
+    store<mode, Bus>(c, addr, data);
+    c.update_zero_negative_flag(data);
+  }
+
+  if constexpr (is_control_flow(type)) {
+    if (pc_before_op == c.pc) {
+      c.pc += info.bytes - 1;
+    }
+  } else {
+    c.pc += info.bytes - 1;
+  }
+  return true;
+}
+
+// Executes the instruction with its operand bytes read from the instruction
+// stream.
+template <uint8 Opcode, bus_access Bus = bus_access::Paged>
+[[gnu::always_inline]] inline bool execute(cpu &c) {
+  return execute<Opcode, Bus>(c, stream_operand<Bus>{});
+}
+
+using instruction_handler = bool (*)(cpu &);
+
+template <std::size_t... Opcodes>
+constexpr std::array<instruction_handler, 0x100>
+make_instruction_table(std::index_sequence<Opcodes...>) {
+  return {&execute<Opcodes>...};
+}
+
+// One specialized handler per opcode byte, indexed directly by the fetched
+// byte. Every entry exists, so dispatch never needs a bounds check.
+inline constexpr std::array<instruction_handler, 0x100> instruction_table =
+    make_instruction_table(std::make_index_sequence<0x100>{});
+
+// clang-format off
+#define NES_FOR_EACH_OPCODE(X)                                                 \
+  X(0x00) X(0x01) X(0x02) X(0x03) X(0x04) X(0x05) X(0x06) X(0x07)              \
+  X(0x08) X(0x09) X(0x0A) X(0x0B) X(0x0C) X(0x0D) X(0x0E) X(0x0F)              \
+  X(0x10) X(0x11) X(0x12) X(0x13) X(0x14) X(0x15) X(0x16) X(0x17)              \
+  X(0x18) X(0x19) X(0x1A) X(0x1B) X(0x1C) X(0x1D) X(0x1E) X(0x1F)              \
+  X(0x20) X(0x21) X(0x22) X(0x23) X(0x24) X(0x25) X(0x26) X(0x27)              \
+  X(0x28) X(0x29) X(0x2A) X(0x2B) X(0x2C) X(0x2D) X(0x2E) X(0x2F)              \
+  X(0x30) X(0x31) X(0x32) X(0x33) X(0x34) X(0x35) X(0x36) X(0x37)              \
+  X(0x38) X(0x39) X(0x3A) X(0x3B) X(0x3C) X(0x3D) X(0x3E) X(0x3F)              \
+  X(0x40) X(0x41) X(0x42) X(0x43) X(0x44) X(0x45) X(0x46) X(0x47)              \
+  X(0x48) X(0x49) X(0x4A) X(0x4B) X(0x4C) X(0x4D) X(0x4E) X(0x4F)              \
+  X(0x50) X(0x51) X(0x52) X(0x53) X(0x54) X(0x55) X(0x56) X(0x57)              \
+  X(0x58) X(0x59) X(0x5A) X(0x5B) X(0x5C) X(0x5D) X(0x5E) X(0x5F)              \
+  X(0x60) X(0x61) X(0x62) X(0x63) X(0x64) X(0x65) X(0x66) X(0x67)              \
+  X(0x68) X(0x69) X(0x6A) X(0x6B) X(0x6C) X(0x6D) X(0x6E) X(0x6F)              \
+  X(0x70) X(0x71) X(0x72) X(0x73) X(0x74) X(0x75) X(0x76) X(0x77)              \
+  X(0x78) X(0x79) X(0x7A) X(0x7B) X(0x7C) X(0x7D) X(0x7E) X(0x7F)              \
+  X(0x80) X(0x81) X(0x82) X(0x83) X(0x84) X(0x85) X(0x86) X(0x87)              \
+  X(0x88) X(0x89) X(0x8A) X(0x8B) X(0x8C) X(0x8D) X(0x8E) X(0x8F)              \
+  X(0x90) X(0x91) X(0x92) X(0x93) X(0x94) X(0x95) X(0x96) X(0x97)              \
+  X(0x98) X(0x99) X(0x9A) X(0x9B) X(0x9C) X(0x9D) X(0x9E) X(0x9F)              \
+  X(0xA0) X(0xA1) X(0xA2) X(0xA3) X(0xA4) X(0xA5) X(0xA6) X(0xA7)              \
+  X(0xA8) X(0xA9) X(0xAA) X(0xAB) X(0xAC) X(0xAD) X(0xAE) X(0xAF)              \
+  X(0xB0) X(0xB1) X(0xB2) X(0xB3) X(0xB4) X(0xB5) X(0xB6) X(0xB7)              \
+  X(0xB8) X(0xB9) X(0xBA) X(0xBB) X(0xBC) X(0xBD) X(0xBE) X(0xBF)              \
+  X(0xC0) X(0xC1) X(0xC2) X(0xC3) X(0xC4) X(0xC5) X(0xC6) X(0xC7)              \
+  X(0xC8) X(0xC9) X(0xCA) X(0xCB) X(0xCC) X(0xCD) X(0xCE) X(0xCF)              \
+  X(0xD0) X(0xD1) X(0xD2) X(0xD3) X(0xD4) X(0xD5) X(0xD6) X(0xD7)              \
+  X(0xD8) X(0xD9) X(0xDA) X(0xDB) X(0xDC) X(0xDD) X(0xDE) X(0xDF)              \
+  X(0xE0) X(0xE1) X(0xE2) X(0xE3) X(0xE4) X(0xE5) X(0xE6) X(0xE7)              \
+  X(0xE8) X(0xE9) X(0xEA) X(0xEB) X(0xEC) X(0xED) X(0xEE) X(0xEF)              \
+  X(0xF0) X(0xF1) X(0xF2) X(0xF3) X(0xF4) X(0xF5) X(0xF6) X(0xF7)              \
+  X(0xF8) X(0xF9) X(0xFA) X(0xFB) X(0xFC) X(0xFD) X(0xFE) X(0xFF)
+// clang-format on
+
+} // namespace nes_simulator
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <algorithm>
+#include <cpu/cpu.h>
+#include <cpu/instructions.h>
+#include <cpu/policy.h>
+#include <cpu/trace.h>
+#include <limits>
+#include <type_traits>
+#include <utils/types.h>
+
+namespace nes_simulator {
+
+// The policy's per-instruction features, before the instruction at pc runs.
+// False stops the run at a breakpoint. With none compiled in this is `true`
+// and vanishes from the loops.
+template <class Policy> [[gnu::always_inline]] inline bool cpu::observe() {
+  if constexpr (Policy::breakpoints) {
+    if (breakpoint_bits[pc / 64] >> (pc % 64) & 1) [[unlikely]] {
+      if (!at_breakpoint) {
+        at_breakpoint = true;
+        return false;
+      }
+    }
+    at_breakpoint = false;
+  }
+  if constexpr (Policy::trace) {
+    if (tracer) {
+      publish_flags();
+      tracer->record(*this);
+    }
+  }
+  return true;
+}
+
+// The switch loop under the stop protocol of interpret, for run_switch and
+// the batched entry points. Unlike the other loops it keeps `instructions`
+// current as it goes, so callbacks and predicates see the count of the
+// instruction about to run.
+template <class Policy, class Stop> uint64 cpu::interpret_switch(Stop &&stop) {
+  static_assert(Policy::bus == bus_access::Paged);
+  uint64 executed = 0;
+  if (halted) {
+    return executed;
+  }
+  lazy_flags flags(*this);
+  while (!stop(*this) && observe<Policy>()) {
+    executed++;
+    instructions++;
+    if (!step_switch()) {
+      halted = true;
+      break;
+    }
+  }
+  return executed;
+}
+
+// The threaded interpreter loop shared by run_threaded and the batched entry
+// points. `stop(cpu)` is checked before every instruction and is expected to
+// inline away; each instantiation gets its own copy of the dispatch labels.
+template <class Policy, class Stop> uint64 cpu::interpret(Stop &&stop) {
+#define LABEL_ADDRESS(opcode) &&op_##opcode,
+  static void *const dispatch[0x100] = {NES_FOR_EACH_OPCODE(LABEL_ADDRESS)};
+#undef LABEL_ADDRESS
+
+  uint64 executed = 0;
+  if (halted) {
+    return executed;
+  }
+  lazy_flags flags(*this);
+
+#define DISPATCH()                                                             \
+  do {                                                                         \
+    if (stop(*this) || !observe<Policy>()) {                                   \
+      instructions += executed;                                                \
+      return executed;                                                         \
+    }                                                                          \
+    executed++;                                                                \
+    goto *dispatch[code_byte<Policy::bus>(*this, pc++)];                       \
+  } while (0)
+
+#define HANDLER(opcode)                                                        \
+  op_##opcode:                                                                 \
+  if (!execute<opcode, Policy::bus>(*this)) {                                  \
+    halted = true;                                                             \
+    instructions += executed;                                                  \
+    return executed;                                                           \
+  }                                                                            \
+  DISPATCH();
+
+  DISPATCH();
+  NES_FOR_EACH_OPCODE(HANDLER)
+
+#undef HANDLER
+#undef DISPATCH
+}
+
+// The decode cache's counterpart of interpret, with the same handlers and the
+// same stop protocol. Each handler takes its operand from the micro-op and
+// steps to the next one; a block's BLOCK_END op looks up, or decodes, the
+// block at pc. Once a write has invalidated decoded code (or a store has
+// remapped the bus) the rest of the running block may be stale, so the next
+// dispatch decodes afresh from pc. Decoded code pages are watched, so the
+// bus is never flat here.
+template <class Policy, class Stop> uint64 cpu::interpret_cached(Stop &&stop) {
+  static_assert(Policy::bus == bus_access::Paged);
+#define LABEL_ADDRESS(opcode) &&cached_##opcode,
+  static void *const dispatch[0x101] = {
+      NES_FOR_EACH_OPCODE(LABEL_ADDRESS) &&block_end};
+#undef LABEL_ADDRESS
+
+  uint64 executed = 0;
+  if (halted) {
+    return executed;
+  }
+  lazy_flags flags(*this);
+  prepare_decoded();
+  const micro_op *op = cached_block(pc).ops.data();
+
+#define DISPATCH()                                                             \
+  do {                                                                         \
+    if (stop(*this) || !observe<Policy>()) {                                   \
+      instructions += executed;                                                \
+      return executed;                                                         \
+    }                                                                          \
+    if (code_written) [[unlikely]] {                                           \
+      code_written = false;                                                    \
+      op = decode_block(pc).ops.data();                                        \
+    }                                                                          \
+    executed++;                                                                \
+    pc++;                                                                      \
+    goto *dispatch[op->handler];                                               \
+  } while (0)
+
+#define HANDLER(byte)                                                          \
+  cached_##byte : {                                                            \
+    const uint16 operand = op++->operand;                                      \
+    if (!execute<byte>(*this, decoded_operand{operand})) {                     \
+      halted = true;                                                           \
+      instructions += executed;                                                \
+      return executed;                                                         \
+    }                                                                          \
+    if constexpr (writes_memory(opcodes[byte].opcode)) {                       \
+      code_written |= decoded->mappings() != bus.mappings();                   \
+    }                                                                          \
+  }                                                                            \
+  DISPATCH();
+
+  DISPATCH();
+  NES_FOR_EACH_OPCODE(HANDLER)
+
+  // Reached through DISPATCH, which has already checked `stop`, counted and
+  // stepped pc for the next block's first instruction. Under a deadline an
+  // idle loop is handed that instruction back and fast-forwarded, unless
+  // the policy has to see every instruction.
+block_end: {
+  const decoded_block &block = cached_block(pc - 1);
+  if constexpr (std::is_same_v<std::remove_cvref_t<Stop>, deadline_stop> &&
+                !Policy::per_instruction) {
+    if (block.idle != idle_loop::None) [[unlikely]] {
+      pc--;
+      executed--;
+      stop.remaining++;
+      const uint64 ran = skip_idle(block, stop.remaining, stop.target);
+      executed += ran;
+      stop.remaining -= ran;
+      op = cached_block(pc).ops.data();
+      DISPATCH();
+    }
+  }
+  op = block.ops.data();
+}
+  goto *dispatch[op->handler];
+
+#undef HANDLER
+#undef DISPATCH
+}
+
+// The bus layout is checked on entry and after stores rather than here, so
+// finding a decoded block is only the table lookup.
+[[gnu::always_inline]] inline const decoded_block &
+cpu::cached_block(uint16 addr) {
+  if (const decoded_block *block = decoded->find(addr)) [[likely]] {
+    return *block;
+  }
+  return decode_block(addr);
+}
+
+// Runs at most `limit` instructions or until `predicate(cpu)` holds, cutting
+// the run into batches at the next interval hook deadline so hooks fire
+// between instructions without a per-instruction check. Whether the bus is
+// flat is checked per batch: nothing outside the engine runs during a
+// deadline batch, and other predicates always get the paged bus.
+template <class Policy, class Predicate>
+uint64 cpu::run_batched(uint64 limit, Predicate &&predicate) {
+  using paged = typename Policy::paged;
+  uint64 executed = 0;
+  bool predicate_hit = false;
+  while (executed < limit && !halted && !predicate_hit) {
+    uint64 batch = limit - executed;
+    for (const auto &hook : interval_hooks) {
+      batch = std::min(batch, hook.next - instructions);
+    }
+
+    // Native code and idle loop skipping can only stop at a cycle deadline;
+    // other predicates, and policies that watch every instruction, run the
+    // Jit engine's blocks through the decode cache interpreter.
+    if constexpr (std::is_same_v<std::remove_cvref_t<Predicate>,
+                                 cycle_deadline>) {
+      deadline_stop stop{batch, predicate.target};
+      if (engine == Engine::Switch) {
+        executed += interpret_switch<paged>(stop);
+      } else if (engine == Engine::Jit && !Policy::per_instruction) {
+        executed += interpret_jit(batch, stop.target);
+      } else if (engine == Engine::Cached || engine == Engine::Jit) {
+        executed += interpret_cached<paged>(stop);
+      } else if (Policy::bus == bus_access::Flat && bus.flat()) {
+        executed += interpret<Policy>(stop);
+      } else {
+        executed += interpret<paged>(stop);
+      }
+      predicate_hit = predicate(*this);
+    } else {
+      // Only the switch loop keeps `instructions` current as it goes; for
+      // the others the predicate sees what the batch has run so far folded
+      // in, as it sees the flags published.
+      uint64 remaining = batch;
+      const bool counts_late = engine != Engine::Switch;
+      auto stop = [&](cpu &c) {
+        if (remaining == 0) {
+          return true;
+        }
+        c.publish_flags();
+        const uint64 pending = counts_late ? batch - remaining : 0;
+        c.instructions += pending;
+        const bool hit = predicate(c);
+        c.instructions -= pending;
+        if (hit) {
+          predicate_hit = true;
+          return true;
+        }
+        remaining--;
+        return false;
+      };
+      if (engine == Engine::Switch) {
+        executed += interpret_switch<paged>(stop);
+      } else if (engine == Engine::Cached || engine == Engine::Jit) {
+        executed += interpret_cached<paged>(stop);
+      } else {
+        executed += interpret<paged>(stop);
+      }
+    }
+
+    for (auto &hook : interval_hooks) {
+      if (instructions >= hook.next) {
+        hook.next += hook.interval;
+        hook.hook(*this);
+      }
+    }
+    if constexpr (Policy::breakpoints) {
+      if (at_breakpoint) {
+        break;
+      }
+    }
+  }
+  return executed;
+}
+
+template <class Policy, class Predicate>
+uint64 cpu::run_until(Predicate &&predicate) {
+  return run_batched<Policy>(std::numeric_limits<uint64>::max(),
+                             std::forward<Predicate>(predicate));
+}
+
+} // namespace nes_simulator
@@ -0,0 +1,937 @@
+#include "cpu/jit.h"
+#include "cpu/cpu.h"
+#include "cpu/instructions.h"
+#include "cpu/opcode.h"
+#include <cstdint>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <sys/mman.h>
+#endif
+
+namespace nes_simulator {
+
+#if defined(__x86_64__)
+namespace {
+
+constexpr std::size_t ARENA_SIZE = 4 << 20;
+// Comfortably more than a 64-instruction block with an exit per instruction.
+constexpr std::size_t MAX_BLOCK_CODE = 32 << 10;
+
+enum reg : uint8 {
+  RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+  R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+// Where the guest state lives while a block runs. RAX, RCX, RDX and R8 are
+// scratch.
+constexpr reg MEMORY = RBX;
+constexpr reg CYCLES = RBP;
+// P, with Z and N stale while they are pending in ZN.
+constexpr reg STATUS = RSI;
+// The byte Z and N were last set from.
+constexpr reg ZN = RDI;
+constexpr reg WRITES = R9;
+constexpr reg BUDGET = R10;
+constexpr reg READS = R11;
+constexpr reg REG_A = R12;
+constexpr reg REG_X = R13;
+constexpr reg REG_Y = R14;
+constexpr reg FRAME = R15;
+
+enum width { BYTE, WORD, DWORD, QWORD };
+enum alu_op : uint8 { ADD = 0, OR = 1, AND = 4, SUB = 5, XOR = 6, CMP = 7 };
+enum shift_op : uint8 { SHL = 4, SHR = 5 };
+enum condition : uint8 {
+  BELOW = 0x2,
+  ABOVE_EQUAL = 0x3,
+  EQUAL = 0x4,
+  NOT_EQUAL = 0x5,
+};
+
+struct mem {
+  reg base;
+  std::int32_t disp = 0;
+  int index = -1;
+  // log2 of the index scale.
+  uint8 scale = 0;
+};
+
+// Just the instruction forms the block compiler uses. Writes past the end of
+// the buffer are dropped and reported by overflowed().
+class assembler {
+public:
+  assembler(uint8 *code, std::size_t capacity)
+      : code(code), capacity(capacity), size(0) {}
+
+  std::size_t offset() const { return size; }
+  bool overflowed() const { return size > capacity; }
+
+  void mov(width w, reg dst, reg src) {
+    op(w, w == BYTE ? 0x88 : 0x89, src, dst);
+  }
+  void load(width w, reg dst, mem m) { op(w, w == BYTE ? 0x8A : 0x8B, dst, m); }
+  void store(width w, mem m, reg src) {
+    op(w, w == BYTE ? 0x88 : 0x89, src, m);
+  }
+  void store_imm(width w, mem m, uint16 imm) {
+    op(w, w == BYTE ? 0xC6 : 0xC7, 0, m);
+    w == BYTE ? emit(imm) : emit16(imm);
+  }
+  void mov_imm(reg dst, uint32 imm) {
+    if (dst >= R8) {
+      emit(0x41);
+    }
+    emit(0xB8 | (dst & 7));
+    emit32(imm);
+  }
+  // The BYTE form forces a REX prefix, so that SIL and DIL are addressable.
+  void movzx(reg dst, reg src) { op(BYTE, 0x0FB6, dst, src); }
+  void movzx(reg dst, mem m) { op(DWORD, 0x0FB6, dst, m); }
+  void movzx16(reg dst, reg src) { op(DWORD, 0x0FB7, dst, src); }
+  void lea(width w, reg dst, mem m) { op(w, 0x8D, dst, m); }
+
+  void alu(width w, alu_op o, reg dst, reg src) {
+    op(w, o << 3 | (w == BYTE ? 0 : 1), src, dst);
+  }
+  void alu(width w, alu_op o, reg dst, mem m) {
+    op(w, o << 3 | (w == BYTE ? 2 : 3), dst, m);
+  }
+  void alu(width w, alu_op o, reg dst, std::int32_t imm) {
+    const bool short_imm = w == BYTE || (imm >= -128 && imm <= 127);
+    op(w, w == BYTE ? 0x80 : short_imm ? 0x83 : 0x81, o, dst);
+    short_imm ? emit(imm) : emit32(imm);
+  }
+  void shift(shift_op s, reg dst, uint8 count) {
+    op(DWORD, 0xC1, s, dst);
+    emit(count);
+  }
+  void test(width w, reg a, reg b) { op(w, w == BYTE ? 0x84 : 0x85, b, a); }
+  void test_byte(reg r, uint8 imm) {
+    op(BYTE, 0xF6, 0, r);
+    emit(imm);
+  }
+  void setcc(condition c, reg dst) { op(BYTE, 0x0F90 | c, 0, dst); }
+
+  void push(reg r) {
+    if (r >= R8) {
+      emit(0x41);
+    }
+    emit(0x50 | (r & 7));
+  }
+  void pop(reg r) {
+    if (r >= R8) {
+      emit(0x41);
+    }
+    emit(0x58 | (r & 7));
+  }
+  void ret() { emit(0xC3); }
+
+  // Jumps with a rel32 to fill in later through bind; they return the
+  // offset just past the instruction.
+  std::size_t jcc(condition c) {
+    emit(0x0F);
+    emit(0x80 | c);
+    emit32(0);
+    return size;
+  }
+  std::size_t jmp() {
+    emit(0xE9);
+    emit32(0);
+    return size;
+  }
+  void bind(std::size_t jump, std::size_t target) {
+    const uint32 rel = static_cast<uint32>(target - jump);
+    for (int i = 0; i < 4; i++) {
+      if (jump - 4 + i < capacity) {
+        code[jump - 4 + i] = rel >> (8 * i);
+      }
+    }
+  }
+  void jmp_to(std::size_t target) { bind(jmp(), target); }
+
+private:
+  void emit(uint8 byte) {
+    if (size < capacity) {
+      code[size] = byte;
+    }
+    size++;
+  }
+  void emit16(uint16 v) {
+    emit(v);
+    emit(v >> 8);
+  }
+  void emit32(uint32 v) {
+    for (int i = 0; i < 4; i++) {
+      emit(v >> (8 * i));
+    }
+  }
+
+  // Prefixes and opcode; `field` is the ModRM reg field, a register or an
+  // opcode extension. Opcodes above 0xFF are 0x0F-escaped.
+  void prefix(width w, uint8 field, int index, uint8 base, bool base_is_byte,
+              uint16 opcode) {
+    if (w == WORD) {
+      emit(0x66);
+    }
+    const uint8 rex = (w == QWORD) << 3 | (field >> 3) << 2 |
+                      (index >= 0 ? index >> 3 : 0) << 1 | base >> 3;
+    const bool byte_reg =
+        w == BYTE && ((field >= 4 && field < 8) ||
+                      (base_is_byte && base >= 4 && base < 8));
+    if (rex || byte_reg) {
+      emit(0x40 | rex);
+    }
+    if (opcode > 0xFF) {
+      emit(opcode >> 8);
+    }
+    emit(opcode);
+  }
+
+  void op(width w, uint16 opcode, uint8 field, reg rm) {
+    prefix(w, field, -1, rm, true, opcode);
+    emit(0xC0 | (field & 7) << 3 | (rm & 7));
+  }
+
+  void op(width w, uint16 opcode, uint8 field, mem m) {
+    prefix(w, field, m.index, m.base, false, opcode);
+    const bool sib = m.index >= 0 || (m.base & 7) == RSP;
+    const uint8 mod = m.disp == 0 && (m.base & 7) != RBP ? 0
+                      : m.disp >= -128 && m.disp <= 127  ? 1
+                                                         : 2;
+    emit(mod << 6 | (field & 7) << 3 | (sib ? 4 : m.base & 7));
+    if (sib) {
+      emit(m.scale << 6 | (m.index >= 0 ? m.index & 7 : 4) << 3 |
+           (m.base & 7));
+    }
+    if (mod == 1) {
+      emit(m.disp);
+    } else if (mod == 2) {
+      emit32(m.disp);
+    }
+  }
+
+  uint8 *code;
+  std::size_t capacity;
+  std::size_t size;
+};
+
+bool is_branch(OpcodeType type) {
+  return is_control_flow(type) && type != OpcodeType::JMP_ABS &&
+         type != OpcodeType::JMP_IND && type != OpcodeType::JSR &&
+         type != OpcodeType::RTI && type != OpcodeType::RTS;
+}
+
+bool compiles(OpcodeType type) {
+  switch (type) {
+  case OpcodeType::LDA:
+  case OpcodeType::LDX:
+  case OpcodeType::LDY:
+  case OpcodeType::STA:
+  case OpcodeType::STX:
+  case OpcodeType::STY:
+  case OpcodeType::ADC:
+  case OpcodeType::SBC:
+  case OpcodeType::AND:
+  case OpcodeType::ORA:
+  case OpcodeType::EOR:
+  case OpcodeType::CMP:
+  case OpcodeType::CPX:
+  case OpcodeType::CPY:
+  case OpcodeType::INC:
+  case OpcodeType::DEC:
+  case OpcodeType::INX:
+  case OpcodeType::INY:
+  case OpcodeType::DEX:
+  case OpcodeType::DEY:
+  case OpcodeType::TAX:
+  case OpcodeType::TAY:
+  case OpcodeType::TXA:
+  case OpcodeType::TYA:
+  case OpcodeType::TSX:
+  case OpcodeType::TXS:
+  case OpcodeType::ASL_ACC:
+  case OpcodeType::LSR_ACC:
+  case OpcodeType::ROL_ACC:
+  case OpcodeType::ROR_ACC:
+  case OpcodeType::CLC:
+  case OpcodeType::CLD:
+  case OpcodeType::CLI:
+  case OpcodeType::CLV:
+  case OpcodeType::SLC:
+  case OpcodeType::SLD:
+  case OpcodeType::SLI:
+  case OpcodeType::NOP:
+  case OpcodeType::JMP_ABS:
+    return true;
+  default:
+    return is_branch(type);
+  }
+}
+
+// The most cycles an instruction can take.
+uint32 max_cycles(const opcode_info &info) {
+  return info.cycle + has_page_cross_penalty(info.opcode) +
+         (is_branch(info.opcode) ? 2 : 0);
+}
+
+// Translates one decoded block, following execute<> instruction by
+// instruction, quirks included.
+class block_compiler {
+public:
+  block_compiler(assembler &as, const decoded_block &block)
+      : as(as), block(block), count(0), index(0), addr(block.start),
+        zn_pending(false), loop(0) {}
+
+  // False if not even the first instruction compiles.
+  bool compile() {
+    uint32 lead = 0;
+    for (const micro_op &op : block.ops) {
+      if (op.handler == decode_cache::BLOCK_END ||
+          !compiles(opcodes[op.handler].opcode)) {
+        break;
+      }
+      if (count) {
+        lead += max_cycles(opcodes[block.ops[count - 1].handler]);
+      }
+      count++;
+    }
+    if (count == 0) {
+      return false;
+    }
+
+    prologue();
+
+    // Run only if all `count` instructions fit the budget and the last one
+    // still starts below the cycle target.
+    loop = as.offset();
+    as.alu(QWORD, CMP, BUDGET, count);
+    exits.push_back({as.jcc(BELOW), block.start, 0, false});
+    as.lea(QWORD, RAX, {CYCLES, static_cast<std::int32_t>(lead)});
+    as.alu(QWORD, CMP, RAX, {FRAME, offsetof(jit_frame, cycle_target)});
+    exits.push_back({as.jcc(ABOVE_EQUAL), block.start, 0, false});
+    as.alu(QWORD, SUB, BUDGET, count);
+
+    bool ended = false;
+    for (index = 0; index < count; index++) {
+      const micro_op &op = block.ops[index];
+      const opcode_info &info = opcodes[op.handler];
+      ended = instruction(info, op.operand);
+      addr += info.bytes;
+    }
+    if (!ended) {
+      leave(addr);
+    }
+
+    for (const side_exit &exit : exits) {
+      as.bind(exit.jump, as.offset());
+      if (exit.refund) {
+        as.alu(QWORD, ADD, BUDGET, exit.refund);
+      }
+      as.store_imm(WORD, {FRAME, offsetof(jit_frame, pc)}, exit.pc);
+      (exit.zn_pending ? to_flush : to_store).push_back(as.jmp());
+    }
+    epilogue();
+    return true;
+  }
+
+private:
+  struct side_exit {
+    std::size_t jump;
+    uint16 pc;
+    uint32 refund;
+    bool zn_pending;
+  };
+
+  void prologue() {
+    for (const reg r : {RBX, RBP, R12, R13, R14, R15}) {
+      as.push(r);
+    }
+    as.mov(QWORD, FRAME, RDI);
+    as.load(QWORD, MEMORY, {FRAME, offsetof(jit_frame, memory)});
+    as.load(QWORD, READS, {FRAME, offsetof(jit_frame, read_pages)});
+    as.load(QWORD, WRITES, {FRAME, offsetof(jit_frame, write_pages)});
+    as.load(QWORD, CYCLES, {FRAME, offsetof(jit_frame, cycles)});
+    as.load(QWORD, BUDGET, {FRAME, offsetof(jit_frame, budget)});
+    as.movzx(REG_A, {FRAME, offsetof(jit_frame, reg_a)});
+    as.movzx(REG_X, {FRAME, offsetof(jit_frame, reg_x)});
+    as.movzx(REG_Y, {FRAME, offsetof(jit_frame, reg_y)});
+    as.movzx(STATUS, {FRAME, offsetof(jit_frame, status)});
+  }
+
+  void epilogue() {
+    const std::size_t flush = as.offset();
+    flush_zn();
+    const std::size_t store = as.offset();
+    as.store(BYTE, {FRAME, offsetof(jit_frame, reg_a)}, REG_A);
+    as.store(BYTE, {FRAME, offsetof(jit_frame, reg_x)}, REG_X);
+    as.store(BYTE, {FRAME, offsetof(jit_frame, reg_y)}, REG_Y);
+    as.store(BYTE, {FRAME, offsetof(jit_frame, status)}, STATUS);
+    as.store(QWORD, {FRAME, offsetof(jit_frame, cycles)}, CYCLES);
+    as.store(QWORD, {FRAME, offsetof(jit_frame, budget)}, BUDGET);
+    for (const reg r : {R15, R14, R13, R12, RBP, RBX}) {
+      as.pop(r);
+    }
+    as.ret();
+
+    for (const std::size_t jump : to_flush) {
+      as.bind(jump, flush);
+    }
+    for (const std::size_t jump : to_store) {
+      as.bind(jump, store);
+    }
+  }
+
+  // Folds the pending Z and N into P.
+  void flush_zn() {
+    as.alu(DWORD, AND, STATUS, 0x7D);
+    as.mov(DWORD, RAX, ZN);
+    as.alu(DWORD, AND, RAX, 0x80);
+    as.alu(DWORD, OR, STATUS, RAX);
+    as.test(BYTE, ZN, ZN);
+    as.setcc(EQUAL, RAX);
+    as.movzx(RAX, RAX);
+    as.alu(DWORD, ADD, RAX, RAX);
+    as.alu(DWORD, OR, STATUS, RAX);
+  }
+
+  void set_zn(reg value) {
+    as.mov(DWORD, ZN, value);
+    zn_pending = true;
+  }
+
+  // Leaves the block before the current instruction, for the interpreter
+  // to run it.
+  void exit_if(condition c) {
+    exits.push_back({as.jcc(c), addr, count - index, zn_pending});
+  }
+
+  // Leaves the block after its last instruction, with pc at `target`.
+  void leave(uint16 target) {
+    as.store_imm(WORD, {FRAME, offsetof(jit_frame, pc)}, target);
+    (zn_pending ? to_flush : to_store).push_back(as.jmp());
+  }
+
+  void go(uint16 target) {
+    if (target != block.start) {
+      leave(target);
+      return;
+    }
+    if (zn_pending) {
+      flush_zn();
+    }
+    as.jmp_to(loop);
+  }
+
+  void charge(uint32 cycles) { as.alu(QWORD, ADD, CYCLES, cycles); }
+
+  // `dst` = table[ECX >> 8], leaving the block if that is null.
+  void page_of_ecx(reg dst, reg table) {
+    as.mov(DWORD, dst, RCX);
+    as.shift(SHR, dst, 8);
+    as.load(QWORD, dst, {table, 0, dst, 3});
+    as.test(QWORD, dst, dst);
+    exit_if(EQUAL);
+  }
+
+  // Emits the checks for the instruction's data access and returns where
+  // the byte is. Zero page modes read the image directly, like low_read;
+  // everything else goes through the page tables. For reads with a
+  // page-crossing penalty, R8 ends up holding it.
+  mem locate(const opcode_info &info, uint16 operand, bool write) {
+    const reg table = write ? WRITES : READS;
+    const bool penalty = !write && has_page_cross_penalty(info.opcode);
+    const uint8 zp = operand & 0xFF;
+    const reg index_reg =
+        info.mode == AddressingMode::ZeroPage_X ||
+                info.mode == AddressingMode::Absolute_X ||
+                info.mode == AddressingMode::Indirect_X
+            ? REG_X
+            : REG_Y;
+
+    switch (info.mode) {
+    case AddressingMode::ZeroPage:
+      if (!write) {
+        return {MEMORY, zp};
+      }
+      as.load(QWORD, RDX, {WRITES, 0});
+      as.test(QWORD, RDX, RDX);
+      exit_if(EQUAL);
+      return {RDX, zp};
+    case AddressingMode::ZeroPage_X:
+    case AddressingMode::ZeroPage_Y:
+      // Not wrapped to the zero page: up to $1FE.
+      if (!write) {
+        return {MEMORY, zp, index_reg};
+      }
+      as.lea(DWORD, RCX, {index_reg, zp});
+      break;
+    case AddressingMode::Absolute:
+      as.load(QWORD, RDX, {table, (operand >> 8) * 8});
+      as.test(QWORD, RDX, RDX);
+      exit_if(EQUAL);
+      return {RDX, operand & 0xFF};
+    case AddressingMode::Absolute_X:
+    case AddressingMode::Absolute_Y:
+      if (penalty) {
+        as.lea(DWORD, R8, {index_reg, zp});
+        as.shift(SHR, R8, 8);
+      }
+      as.lea(DWORD, RCX, {index_reg, operand});
+      as.movzx16(RCX, RCX);
+      break;
+    case AddressingMode::Indirect_X:
+      // The pointer wraps in the zero page; its high byte is read from
+      // ptr + 1 unwrapped.
+      as.lea(DWORD, RCX, {index_reg, zp});
+      as.movzx(RCX, RCX);
+      as.movzx(RDX, {MEMORY, 1, RCX});
+      as.shift(SHL, RDX, 8);
+      as.movzx(RCX, {MEMORY, 0, RCX});
+      as.alu(DWORD, OR, RCX, RDX);
+      break;
+    case AddressingMode::Indirect_Y:
+      as.movzx(RCX, {MEMORY, zp});
+      as.movzx(RDX, {MEMORY, zp + 1});
+      as.shift(SHL, RDX, 8);
+      as.alu(DWORD, OR, RCX, RDX);
+      if (penalty) {
+        as.movzx(R8, RCX);
+        as.alu(DWORD, ADD, R8, REG_Y);
+        as.shift(SHR, R8, 8);
+      }
+      as.alu(DWORD, ADD, RCX, REG_Y);
+      as.movzx16(RCX, RCX);
+      break;
+    default:
+      break;
+    }
+    page_of_ecx(RDX, table);
+    as.alu(DWORD, AND, RCX, 0xFF);
+    return {RDX, 0, RCX};
+  }
+
+  // The operand byte into EAX, charging the instruction's cycles.
+  void read_operand(const opcode_info &info, uint16 operand) {
+    if (info.mode == AddressingMode::Immediate) {
+      as.mov_imm(RAX, operand & 0xFF);
+      charge(info.cycle);
+      return;
+    }
+    as.movzx(RAX, locate(info, operand, false));
+    charge(info.cycle);
+    if (has_page_cross_penalty(info.opcode) &&
+        (info.mode == AddressingMode::Absolute_X ||
+         info.mode == AddressingMode::Absolute_Y ||
+         info.mode == AddressingMode::Indirect_Y)) {
+      as.alu(QWORD, ADD, CYCLES, R8);
+    }
+  }
+
+  void set_status(uint8 bit, bool value) {
+    if (value) {
+      as.alu(DWORD, OR, STATUS, bit);
+    } else {
+      as.alu(DWORD, AND, STATUS, static_cast<int8>(~bit));
+    }
+  }
+
+  // Sets C from bit `from` of `value`, which is clobbered.
+  void set_carry(reg value, uint8 from) {
+    if (from) {
+      as.shift(SHR, value, from);
+    }
+    as.alu(DWORD, AND, value, 1);
+    as.alu(DWORD, AND, STATUS, -2);
+    as.alu(DWORD, OR, STATUS, value);
+  }
+
+  // Returns true if the instruction left the block.
+  bool instruction(const opcode_info &info, uint16 operand) {
+    const reg target_reg = info.opcode == OpcodeType::LDX ||
+                                   info.opcode == OpcodeType::STX ||
+                                   info.opcode == OpcodeType::CPX
+                               ? REG_X
+                           : info.opcode == OpcodeType::LDY ||
+                                   info.opcode == OpcodeType::STY ||
+                                   info.opcode == OpcodeType::CPY
+                               ? REG_Y
+                               : REG_A;
+
+    switch (info.opcode) {
+    case OpcodeType::LDA:
+    case OpcodeType::LDX:
+    case OpcodeType::LDY:
+      read_operand(info, operand);
+      as.mov(DWORD, target_reg, RAX);
+      set_zn(target_reg);
+      break;
+    case OpcodeType::STA:
+    case OpcodeType::STX:
+    case OpcodeType::STY: {
+      const mem at = locate(info, operand, true);
+      charge(info.cycle);
+      as.store(BYTE, at, target_reg);
+      break;
+    }
+    case OpcodeType::ADC:
+    case OpcodeType::SBC:
+      read_operand(info, operand);
+      if (info.opcode == OpcodeType::SBC) {
+        as.alu(DWORD, XOR, RAX, 0xFF);
+      }
+      // tmp = A + operand + C; V is bit 7 of (tmp ^ operand) & (tmp ^ A),
+      // moved down to bit 6.
+      as.mov(DWORD, RCX, STATUS);
+      as.alu(DWORD, AND, RCX, 1);
+      as.alu(DWORD, ADD, RCX, RAX);
+      as.alu(DWORD, ADD, RCX, REG_A);
+      as.mov(DWORD, RDX, RCX);
+      as.alu(DWORD, XOR, RDX, RAX);
+      as.mov(DWORD, R8, RCX);
+      as.alu(DWORD, XOR, R8, REG_A);
+      as.alu(DWORD, AND, RDX, R8);
+      as.alu(DWORD, AND, RDX, 0x80);
+      as.shift(SHR, RDX, 1);
+      as.mov(DWORD, R8, RCX);
+      as.shift(SHR, R8, 8);
+      as.alu(DWORD, AND, STATUS, static_cast<int8>(~0x41));
+      as.alu(DWORD, OR, STATUS, RDX);
+      as.alu(DWORD, OR, STATUS, R8);
+      as.movzx(REG_A, RCX);
+      set_zn(REG_A);
+      break;
+    case OpcodeType::AND:
+    case OpcodeType::ORA:
+    case OpcodeType::EOR:
+      read_operand(info, operand);
+      as.alu(DWORD,
+             info.opcode == OpcodeType::AND   ? AND
+             : info.opcode == OpcodeType::ORA ? OR
+                                              : XOR,
+             REG_A, RAX);
+      set_zn(REG_A);
+      break;
+    case OpcodeType::CMP:
+    case OpcodeType::CPX:
+    case OpcodeType::CPY:
+      read_operand(info, operand);
+      as.mov(DWORD, RCX, target_reg);
+      as.alu(DWORD, SUB, RCX, RAX);
+      as.setcc(ABOVE_EQUAL, RDX);
+      as.movzx(RDX, RDX);
+      as.alu(DWORD, AND, STATUS, -2);
+      as.alu(DWORD, OR, STATUS, RDX);
+      as.movzx(ZN, RCX);
+      zn_pending = true;
+      break;
+    case OpcodeType::INC:
+    case OpcodeType::DEC: {
+      // A writable page is RAM, so the byte reads through the same pointer.
+      const mem at = locate(info, operand, true);
+      charge(info.cycle);
+      as.movzx(RAX, at);
+      as.alu(DWORD, info.opcode == OpcodeType::INC ? ADD : SUB, RAX, 1);
+      as.store(BYTE, at, RAX);
+      as.movzx(ZN, RAX);
+      zn_pending = true;
+      break;
+    }
+    case OpcodeType::INX:
+    case OpcodeType::INY:
+    case OpcodeType::DEX:
+    case OpcodeType::DEY: {
+      const reg r =
+          info.opcode == OpcodeType::INX || info.opcode == OpcodeType::DEX
+              ? REG_X
+              : REG_Y;
+      charge(info.cycle);
+      as.alu(DWORD,
+             info.opcode == OpcodeType::INX || info.opcode == OpcodeType::INY
+                 ? ADD
+                 : SUB,
+             r, 1);
+      as.movzx(r, r);
+      set_zn(r);
+      break;
+    }
+    case OpcodeType::TAX:
+    case OpcodeType::TAY:
+    case OpcodeType::TXA:
+    case OpcodeType::TYA: {
+      const reg dst = info.opcode == OpcodeType::TAX   ? REG_X
+                      : info.opcode == OpcodeType::TAY ? REG_Y
+                                                       : REG_A;
+      const reg src = info.opcode == OpcodeType::TXA   ? REG_X
+                      : info.opcode == OpcodeType::TYA ? REG_Y
+                                                       : REG_A;
+      charge(info.cycle);
+      as.mov(DWORD, dst, src);
+      set_zn(dst);
+      break;
+    }
+    case OpcodeType::TSX:
+      charge(info.cycle);
+      as.movzx(REG_X, {FRAME, offsetof(jit_frame, sp)});
+      set_zn(REG_X);
+      break;
+    case OpcodeType::TXS:
+      charge(info.cycle);
+      as.store(BYTE, {FRAME, offsetof(jit_frame, sp)}, REG_X);
+      break;
+    case OpcodeType::ASL_ACC:
+      charge(info.cycle);
+      as.mov(DWORD, RAX, REG_A);
+      set_carry(RAX, 7);
+      as.alu(DWORD, ADD, REG_A, REG_A);
+      as.movzx(REG_A, REG_A);
+      set_zn(REG_A);
+      break;
+    case OpcodeType::LSR_ACC:
+      charge(info.cycle);
+      as.mov(DWORD, RAX, REG_A);
+      set_carry(RAX, 0);
+      as.shift(SHR, REG_A, 1);
+      set_zn(REG_A);
+      break;
+    case OpcodeType::ROL_ACC:
+    case OpcodeType::ROR_ACC: {
+      const bool left = info.opcode == OpcodeType::ROL_ACC;
+      charge(info.cycle);
+      as.mov(DWORD, RCX, STATUS);
+      as.alu(DWORD, AND, RCX, 1);
+      as.mov(DWORD, RAX, REG_A);
+      set_carry(RAX, left ? 7 : 0);
+      if (left) {
+        as.alu(DWORD, ADD, REG_A, REG_A);
+      } else {
+        as.shift(SHR, REG_A, 1);
+        as.shift(SHL, RCX, 7);
+      }
+      as.alu(DWORD, OR, REG_A, RCX);
+      as.movzx(REG_A, REG_A);
+      set_zn(REG_A);
+      break;
+    }
+    case OpcodeType::CLC:
+    case OpcodeType::SLC:
+      charge(info.cycle);
+      set_status(1 << static_cast<int>(flag::CarryFlag),
+                 info.opcode == OpcodeType::SLC);
+      break;
+    case OpcodeType::CLD:
+    case OpcodeType::SLD:
+      charge(info.cycle);
+      set_status(1 << static_cast<int>(flag::DecimalModeFlag),
+                 info.opcode == OpcodeType::SLD);
+      break;
+    case OpcodeType::CLI:
+    case OpcodeType::SLI:
+      charge(info.cycle);
+      set_status(1 << static_cast<int>(flag::InterruptDisable),
+                 info.opcode == OpcodeType::SLI);
+      break;
+    case OpcodeType::CLV:
+      charge(info.cycle);
+      set_status(1 << static_cast<int>(flag::OverflowFlag), false);
+      break;
+    case OpcodeType::NOP:
+      charge(info.cycle);
+      break;
+    case OpcodeType::JMP_ABS:
+      charge(info.cycle);
+      // Like every control flow instruction, a jump to its own operand
+      // byte is taken to mean "not taken".
+      go(operand == static_cast<uint16>(addr + 1) ? addr + 3 : operand);
+      return true;
+    default:
+      branch(info, operand);
+      return true;
+    }
+    return false;
+  }
+
+  void branch(const opcode_info &info, uint16 operand) {
+    const OpcodeType type = info.opcode;
+    const uint16 next = addr + 2;
+    const uint16 raw = next + static_cast<int8>(operand & 0xFF);
+    const uint32 taken_cycles = 1 + ((next & 0xFF00) != (raw & 0xFF00));
+    const uint16 target = raw == static_cast<uint16>(addr + 1) ? next : raw;
+    charge(info.cycle);
+
+    // Which flag is tested and whether the branch wants it set.
+    bool expected = type == OpcodeType::BCS || type == OpcodeType::BEQ ||
+                    type == OpcodeType::BMI || type == OpcodeType::BVS;
+    if (type == OpcodeType::BEQ || type == OpcodeType::BNE) {
+      if (zn_pending) {
+        as.test(BYTE, ZN, ZN);
+        // ZF is the guest Z here, not its complement.
+        expected = !expected;
+      } else {
+        as.test_byte(STATUS, 1 << static_cast<int>(flag::ZeroFlag));
+      }
+    } else if (type == OpcodeType::BMI || type == OpcodeType::BPL) {
+      as.test_byte(zn_pending ? ZN : STATUS, 0x80);
+    } else if (type == OpcodeType::BCS || type == OpcodeType::BCC) {
+      as.test_byte(STATUS, 1 << static_cast<int>(flag::CarryFlag));
+    } else {
+      as.test_byte(STATUS, 1 << static_cast<int>(flag::OverflowFlag));
+    }
+    const std::size_t taken = as.jcc(expected ? NOT_EQUAL : EQUAL);
+    leave(next);
+    as.bind(taken, as.offset());
+    charge(taken_cycles);
+    go(target);
+  }
+
+  assembler &as;
+  const decoded_block &block;
+  std::vector<side_exit> exits;
+  // Jumps to the epilogue with Z and N pending, and with P up to date.
+  std::vector<std::size_t> to_flush;
+  std::vector<std::size_t> to_store;
+  uint32 count;
+  uint32 index;
+  uint16 addr;
+  bool zn_pending;
+  std::size_t loop;
+};
+
+} // namespace
+
+jit_compiler::jit_compiler() : arena(nullptr), capacity(0), used(0) {
+  void *map = mmap(nullptr, ARENA_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map != MAP_FAILED) {
+    arena = static_cast<uint8 *>(map);
+    capacity = ARENA_SIZE;
+  }
+}
+
+jit_compiler::~jit_compiler() {
+  if (arena) {
+    munmap(arena, capacity);
+  }
+}
+
+// The arena is writable only while a block is being emitted.
+jit_block jit_compiler::compile(const decoded_block &block) {
+  if (!arena || full() ||
+      mprotect(arena, capacity, PROT_READ | PROT_WRITE) != 0) {
+    return nullptr;
+  }
+  assembler as(arena + used, capacity - used);
+  const bool compiled =
+      block_compiler(as, block).compile() && !as.overflowed();
+  mprotect(arena, capacity, PROT_READ | PROT_EXEC);
+  if (!compiled) {
+    return nullptr;
+  }
+
+  const auto code = reinterpret_cast<jit_block>(arena + used);
+  used = (used + as.offset() + 15) & ~std::size_t{15};
+  return code;
+}
+
+bool jit_compiler::full() const {
+  return arena && capacity - used < MAX_BLOCK_CODE;
+}
+
+void jit_compiler::reset() { used = 0; }
+
+#else
+
+jit_compiler::jit_compiler() : arena(nullptr), capacity(0), used(0) {}
+jit_compiler::~jit_compiler() = default;
+jit_block jit_compiler::compile(const decoded_block &) { return nullptr; }
+bool jit_compiler::full() const { return false; }
+void jit_compiler::reset() {}
+
+#endif
+
+// The Jit engine's dispatcher. Each block it reaches runs as native code if
+// it has been compiled and the code agrees to run; otherwise, or from where
+// the code side-exited, the block is interpreted up to its end. A write that
+// drops decoded code or a bus remap ends the interpreted stretch early,
+// since the rest of the block may be stale.
+uint64 cpu::interpret_jit(uint64 budget, uint64 cycle_target) {
+  uint64 executed = 0;
+  if (halted) {
+    return executed;
+  }
+  lazy_flags flags(*this);
+  prepare_decoded();
+  if (!jit) {
+    jit = std::make_unique<jit_compiler>();
+  }
+
+  while (executed < budget && cycles < cycle_target) {
+    if (decoded->mappings() != bus.mappings()) {
+      flush_decoded();
+    }
+    decoded_block *block = decoded->find(pc);
+    if (!block) {
+      block = &decode_block(pc);
+    }
+
+    if (block->idle != idle_loop::None) {
+      if (const uint64 ran =
+              skip_idle(*block, budget - executed, cycle_target)) {
+        executed += ran;
+        continue;
+      }
+    }
+
+    if (block->heat < jit_compiler::HOT_ENTRIES &&
+        ++block->heat == jit_compiler::HOT_ENTRIES) {
+      if (jit->full()) {
+        flush_decoded();
+        continue;
+      }
+      block->native = jit->compile(*block);
+    }
+
+    if (block->native) {
+      jit_frame frame{memory,      bus.read_table(), bus.write_table(),
+                      cycles,      cycle_target,     budget - executed,
+                      pc,          reg_a,            reg_x,
+                      reg_y,       sp,               current_status()};
+      block->native(&frame);
+      const uint64 ran = budget - executed - frame.budget;
+      executed += ran;
+      cycles = frame.cycles;
+      pc = frame.pc;
+      reg_a = frame.reg_a;
+      reg_x = frame.reg_x;
+      reg_y = frame.reg_y;
+      sp = frame.sp;
+      load_status(frame.status);
+      if (ran != 0) {
+        continue;
+      }
+    }
+
+    const uint64 layout = bus.mappings();
+    for (const micro_op *op = block->ops.data();
+         op->handler != decode_cache::BLOCK_END; op++) {
+      if (executed == budget || cycles >= cycle_target) {
+        break;
+      }
+      executed++;
+      pc++;
+      if (!instruction_table[op->handler](*this)) {
+        halted = true;
+        instructions += executed;
+        return executed;
+      }
+      if (code_written || bus.mappings() != layout) {
+        code_written = false;
+        break;
+      }
+    }
+  }
+  instructions += executed;
+  return executed;
+}
+
+} // namespace nes_simulator
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cpu/decode_cache.h>
+#include <cstddef>
+#include <utils/types.h>
+
+namespace nes_simulator {
+
+// What a compiled block runs on. The cpu copies its registers in before the
+// call and back out after it; the block updates pc, cycles and budget too.
+struct jit_frame {
+  uint8 *memory;
+  const uint8 *const *read_pages;
+  uint8 *const *write_pages;
+  uint64 cycles;
+  // The block only runs while cycles stay below this, and takes at most
+  // `budget` instructions, which it subtracts as it goes.
+  uint64 cycle_target;
+  uint64 budget;
+  uint16 pc;
+  uint8 reg_a, reg_x, reg_y, sp, status;
+};
+
+using jit_block = void (*)(jit_frame *frame);
+
+// Compiles hot decoded blocks into x86-64 code, for the Jit engine.
+//
+// A compiled block covers the longest prefix of the decoded block made of
+// instructions it knows: loads, stores, register transfers, increments,
+// logic, compares, ADC/SBC, flag changes, accumulator shifts, branches and
+// JMP. Guest A, X, Y and P live in host registers for the whole block, and
+// Z and N are kept as the last result byte, only folded into P where a
+// branch tests them or the block exits. Data accesses go through the bus's
+// page tables; a null entry (MMIO, ROM writes, and watched pages, which
+// include every page holding decoded code) exits the block before the
+// instruction, leaving it to the interpreter. A block that branches back to
+// its own start loops natively.
+//
+// On entry, and on every lap of such a loop, the block checks that the whole
+// prefix fits the instruction budget and cannot cross the cycle target
+// before its last instruction; otherwise it returns without running
+// anything and the interpreter takes over. So the Jit engine stops on the
+// same instruction as the interpreters do.
+//
+// On hosts other than x86-64 nothing compiles and the engine runs the decode
+// cache interpreter alone.
+class jit_compiler {
+public:
+  // Entries into a decoded block before it is compiled.
+  static constexpr uint32 HOT_ENTRIES = 16;
+
+  jit_compiler();
+  ~jit_compiler();
+  jit_compiler(const jit_compiler &) = delete;
+  jit_compiler &operator=(const jit_compiler &) = delete;
+
+  // Native code for `block`, or null if its first instruction is not one the
+  // compiler knows.
+  jit_block compile(const decoded_block &block);
+
+  // Whether the code arena may not fit another block. The caller then drops
+  // every decoded block, with the code pointing into it, and calls reset.
+  bool full() const;
+  void reset();
+
+private:
+  uint8 *arena;
+  std::size_t capacity;
+  std::size_t used;
+};
+
+} // namespace nes_simulator
@@ -0,0 +1,712 @@
+#include "cpu/lockstep.h"
+#include "cpu/instructions.h"
+#include "cpu/opcode.h"
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NES_LOCKSTEP_X86 1
+#include <immintrin.h>
+#endif
+
+namespace nes_simulator {
+
+namespace {
+
+constexpr uint8 CARRY_BIT = 1 << static_cast<int>(flag::CarryFlag);
+constexpr uint8 ZERO_BIT = 1 << static_cast<int>(flag::ZeroFlag);
+constexpr uint8 OVERFLOW_BIT = 1 << static_cast<int>(flag::OverflowFlag);
+constexpr uint8 NEGATIVE_BIT = 1 << static_cast<int>(flag::NegativeFlag);
+
+constexpr bool vector_type(OpcodeType type) {
+  switch (type) {
+  case OpcodeType::LDA:
+  case OpcodeType::LDX:
+  case OpcodeType::LDY:
+  case OpcodeType::STA:
+  case OpcodeType::STX:
+  case OpcodeType::STY:
+  case OpcodeType::ADC:
+  case OpcodeType::SBC:
+  case OpcodeType::AND:
+  case OpcodeType::ORA:
+  case OpcodeType::EOR:
+  case OpcodeType::CMP:
+  case OpcodeType::CPX:
+  case OpcodeType::CPY:
+  case OpcodeType::INC:
+  case OpcodeType::DEC:
+  case OpcodeType::INX:
+  case OpcodeType::INY:
+  case OpcodeType::DEX:
+  case OpcodeType::DEY:
+  case OpcodeType::TAX:
+  case OpcodeType::TAY:
+  case OpcodeType::TSX:
+  case OpcodeType::TXA:
+  case OpcodeType::TXS:
+  case OpcodeType::TYA:
+  case OpcodeType::CLC:
+  case OpcodeType::CLD:
+  case OpcodeType::CLI:
+  case OpcodeType::CLV:
+  case OpcodeType::SLC:
+  case OpcodeType::SLD:
+  case OpcodeType::SLI:
+  case OpcodeType::NOP:
+  case OpcodeType::BCC:
+  case OpcodeType::BCS:
+  case OpcodeType::BEQ:
+  case OpcodeType::BMI:
+  case OpcodeType::BNE:
+  case OpcodeType::BPL:
+  case OpcodeType::BVC:
+  case OpcodeType::BVS:
+  case OpcodeType::JMP_ABS:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Opcode bytes the vector path handles; stack, shift and rotate
+// instructions go through the scalar handlers.
+constexpr auto vectorizable = [] {
+  std::array<bool, 0x100> table{};
+  for (int op = 0; op < 0x100; op++) {
+    table[op] = vector_type(opcodes[op].opcode);
+  }
+  return table;
+}();
+
+// The register-updating half of an instruction, applied to every lane in
+// `mask`: reg op= data, then flags. Compare leaves reg alone.
+enum class alu_op {
+  Load,
+  And,
+  Or,
+  Eor,
+  Adc,
+  Compare,
+  Add,
+};
+
+void alu_scalar(alu_op op, uint8 *reg, const uint8 *data, uint8 *status,
+                uint32 mask) {
+  for (; mask; mask &= mask - 1) {
+    const int i = std::countr_zero(mask);
+    const uint8 r = reg[i], d = data[i];
+    uint8 s = status[i];
+    uint8 result = 0;
+    switch (op) {
+    case alu_op::Load:
+      result = d;
+      break;
+    case alu_op::And:
+      result = r & d;
+      break;
+    case alu_op::Or:
+      result = r | d;
+      break;
+    case alu_op::Eor:
+      result = r ^ d;
+      break;
+    case alu_op::Adc: {
+      const uint16 tmp = r + d + (s & CARRY_BIT);
+      result = tmp;
+      s = (s & ~(CARRY_BIT | OVERFLOW_BIT)) | (tmp > 0xFF ? CARRY_BIT : 0) |
+          ((result ^ d) & (result ^ r) & 0x80 ? OVERFLOW_BIT : 0);
+      break;
+    }
+    case alu_op::Compare:
+      result = r - d;
+      s = (s & ~CARRY_BIT) | (r >= d ? CARRY_BIT : 0);
+      break;
+    case alu_op::Add:
+      result = r + d;
+      break;
+    }
+    status[i] = (s & ~(ZERO_BIT | NEGATIVE_BIT)) | (result ? 0 : ZERO_BIT) |
+                (result & NEGATIVE_BIT);
+    if (op != alu_op::Compare) {
+      reg[i] = result;
+    }
+  }
+}
+
+#ifdef NES_LOCKSTEP_X86
+
+// 0xFF in byte i where bit i of `mask` is set.
+__attribute__((target("avx2"))) __m256i lane_bytes(uint32 mask) {
+  const __m256i spread = _mm256_setr_epi8(
+      0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, //
+      2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+  const __m256i bits = _mm256_set1_epi64x(0x8040201008040201);
+  const __m256i bytes =
+      _mm256_shuffle_epi8(_mm256_set1_epi32(static_cast<int>(mask)), spread);
+  return _mm256_cmpeq_epi8(_mm256_and_si256(bytes, bits), bits);
+}
+
+// `bit` in every byte of `set` that has it.
+__attribute__((target("avx2"))) __m256i flag_bits(__m256i set, uint8 bit) {
+  return _mm256_and_si256(set, _mm256_set1_epi8(static_cast<char>(bit)));
+}
+
+__attribute__((target("avx2"))) void alu_avx2(alu_op op, uint8 *reg,
+                                              const uint8 *data,
+                                              uint8 *status, uint32 mask) {
+  const __m256i lanes = lane_bytes(mask);
+  const __m256i r = _mm256_load_si256((const __m256i *)reg);
+  const __m256i d = _mm256_load_si256((const __m256i *)data);
+  const __m256i s = _mm256_load_si256((const __m256i *)status);
+  const __m256i zero = _mm256_setzero_si256();
+
+  __m256i result = d;
+  __m256i new_status = s;
+  switch (op) {
+  case alu_op::Load:
+    break;
+  case alu_op::And:
+    result = _mm256_and_si256(r, d);
+    break;
+  case alu_op::Or:
+    result = _mm256_or_si256(r, d);
+    break;
+  case alu_op::Eor:
+    result = _mm256_xor_si256(r, d);
+    break;
+  case alu_op::Adc: {
+    // Carry out of r + d shows up as saturation; a carry in only carries
+    // out again when r + d is 0xFF.
+    const __m256i carry_in = flag_bits(s, CARRY_BIT);
+    const __m256i sum = _mm256_add_epi8(r, d);
+    const __m256i carry_sum =
+        _mm256_xor_si256(_mm256_cmpeq_epi8(_mm256_adds_epu8(r, d), sum),
+                         _mm256_set1_epi8(-1));
+    const __m256i carry_add =
+        _mm256_and_si256(_mm256_cmpeq_epi8(sum, _mm256_set1_epi8(-1)),
+                         _mm256_cmpeq_epi8(carry_in, _mm256_set1_epi8(1)));
+    result = _mm256_add_epi8(sum, carry_in);
+    const __m256i sign = _mm256_set1_epi8(static_cast<char>(0x80));
+    const __m256i overflow = _mm256_cmpeq_epi8(
+        _mm256_and_si256(_mm256_and_si256(_mm256_xor_si256(result, d),
+                                          _mm256_xor_si256(result, r)),
+                         sign),
+        sign);
+    new_status = _mm256_or_si256(
+        _mm256_andnot_si256(_mm256_set1_epi8(CARRY_BIT | OVERFLOW_BIT), s),
+        _mm256_or_si256(
+            flag_bits(_mm256_or_si256(carry_sum, carry_add), CARRY_BIT),
+            flag_bits(overflow, OVERFLOW_BIT)));
+    break;
+  }
+  case alu_op::Compare: {
+    const __m256i carry = _mm256_cmpeq_epi8(_mm256_max_epu8(r, d), r);
+    result = _mm256_sub_epi8(r, d);
+    new_status =
+        _mm256_or_si256(_mm256_andnot_si256(_mm256_set1_epi8(CARRY_BIT), s),
+                        flag_bits(carry, CARRY_BIT));
+    break;
+  }
+  case alu_op::Add:
+    result = _mm256_add_epi8(r, d);
+    break;
+  }
+
+  const __m256i zero_negative =
+      _mm256_set1_epi8(static_cast<char>(ZERO_BIT | NEGATIVE_BIT));
+  new_status = _mm256_or_si256(
+      _mm256_andnot_si256(zero_negative, new_status),
+      _mm256_or_si256(flag_bits(_mm256_cmpeq_epi8(result, zero), ZERO_BIT),
+                      flag_bits(result, NEGATIVE_BIT)));
+  _mm256_store_si256((__m256i *)status,
+                     _mm256_blendv_epi8(s, new_status, lanes));
+  if (op != alu_op::Compare) {
+    _mm256_store_si256((__m256i *)reg, _mm256_blendv_epi8(r, result, lanes));
+  }
+}
+
+bool has_avx2() {
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  return avx2;
+}
+
+#endif
+
+// reg, data and status hold MAX_LANES bytes and are 32-byte aligned.
+void alu(alu_op op, uint8 *reg, const uint8 *data, uint8 *status,
+         uint32 mask) {
+#ifdef NES_LOCKSTEP_X86
+  if (has_avx2()) {
+    alu_avx2(op, reg, data, status, mask);
+    return;
+  }
+#endif
+  alu_scalar(op, reg, data, status, mask);
+}
+
+} // namespace
+
+lockstep_cpu::lockstep_cpu(uint32 lanes)
+    : lane_count(lanes), reg_a(), reg_x(), reg_y(), sp(), status(), pc(),
+      cycles(), remaining(), halted(0), vector_count(0), scalar_count(0) {
+  if (lanes == 0 || lanes > MAX_LANES) {
+    throw std::runtime_error("lockstep lanes must be 1-" +
+                             std::to_string(MAX_LANES));
+  }
+  for (uint32 i = 0; i < lanes; i++) {
+    machines.push_back(std::make_unique<cpu>());
+  }
+}
+
+void lockstep_cpu::run_instructions(uint64 count) {
+  for (const auto &machine : machines) {
+    if (machine->has_hooks()) {
+      throw std::runtime_error("lockstep lanes cannot have hooks");
+    }
+  }
+
+  load_lanes();
+  std::array<uint64, MAX_LANES> start;
+  for (uint32 i = 0; i < lane_count; i++) {
+    start[i] = machines[i]->instructions;
+    remaining[i] = count;
+  }
+
+  while (const lane_mask active = active_lanes()) {
+    if (std::has_single_bit(active)) {
+      // Nothing left to share the work with.
+      const uint32 lane = std::countr_zero(active);
+      store_lanes();
+      const uint64 executed = machines[lane]->run_instructions(remaining[lane]);
+      remaining[lane] -= executed;
+      scalar_count += executed;
+      load_lanes();
+      break;
+    }
+
+    // Stepping the lane furthest behind gives the others a chance to be
+    // caught up with, and rejoin, at a common pc.
+    uint32 leader = std::countr_zero(active);
+    for (lane_mask rest = active; rest; rest &= rest - 1) {
+      const uint32 i = std::countr_zero(rest);
+      if (remaining[i] > remaining[leader]) {
+        leader = i;
+      }
+    }
+
+    const lane_mask group = group_at(active, leader);
+    if (!std::has_single_bit(group) && run_group(group, pc[leader])) {
+      continue;
+    }
+    for (lane_mask rest = group; rest; rest &= rest - 1) {
+      execute_scalar(std::countr_zero(rest));
+    }
+    scalar_count += std::popcount(group);
+  }
+  store_lanes();
+
+  for (uint32 i = 0; i < lane_count; i++) {
+    machines[i]->instructions = start[i] + count - remaining[i];
+  }
+}
+
+void lockstep_cpu::load_lanes() {
+  halted = 0;
+  for (uint32 i = 0; i < lane_count; i++) {
+    const cpu &c = *machines[i];
+    reg_a[i] = c.reg_a;
+    reg_x[i] = c.reg_x;
+    reg_y[i] = c.reg_y;
+    sp[i] = c.sp;
+    status[i] = c.status;
+    pc[i] = c.pc;
+    cycles[i] = c.cycles;
+    halted |= lane_mask{c.halted} << i;
+  }
+}
+
+void lockstep_cpu::store_lanes() {
+  for (uint32 i = 0; i < lane_count; i++) {
+    cpu &c = *machines[i];
+    c.reg_a = reg_a[i];
+    c.reg_x = reg_x[i];
+    c.reg_y = reg_y[i];
+    c.sp = sp[i];
+    c.status = status[i];
+    c.pc = pc[i];
+    c.cycles = cycles[i];
+    c.halted = halted >> i & 1;
+  }
+}
+
+lockstep_cpu::lane_mask lockstep_cpu::active_lanes() const {
+  lane_mask active = 0;
+  for (uint32 i = 0; i < lane_count; i++) {
+    active |= lane_mask{remaining[i] != 0} << i;
+  }
+  return active & ~halted;
+}
+
+// Lanes at the leader's pc whose instruction bytes there match the leader's,
+// so that one decode serves them all.
+lockstep_cpu::lane_mask lockstep_cpu::group_at(lane_mask active,
+                                                uint32 leader) const {
+  const uint16 at = pc[leader];
+  lane_mask at_pc = 0;
+  for (lane_mask rest = active; rest; rest &= rest - 1) {
+    const uint32 i = std::countr_zero(rest);
+    at_pc |= lane_mask{pc[i] == at} << i;
+  }
+  const cpu &first = *machines[leader];
+  return same_code(at_pc, at, opcodes[first.fetch(at)].bytes);
+}
+
+// The lanes of `group` whose `bytes` bytes at `at` match the first lane's.
+lockstep_cpu::lane_mask lockstep_cpu::same_code(lane_mask group, uint16 at,
+                                                 uint8 bytes) const {
+  const cpu &first = *machines[std::countr_zero(group)];
+  const uint16 second = at + 1, third = at + 2;
+  const uint8 a = first.fetch(at), b = first.fetch(second),
+              c = first.fetch(third);
+  lane_mask same = 0;
+  for (lane_mask rest = group; rest; rest &= rest - 1) {
+    const uint32 i = std::countr_zero(rest);
+    const cpu &lane = *machines[i];
+    same |= lane_mask{lane.fetch(at) == a &&
+                      (bytes < 2 || lane.fetch(second) == b) &&
+                      (bytes < 3 || lane.fetch(third) == c)}
+            << i;
+  }
+  return same;
+}
+
+// Runs the lanes of `group`, all at pc `at`, together for as long as they
+// agree on the path: pc, instruction cycles and the count are then shared and
+// only settled on the lanes when the run ends. The run stops at the first
+// instruction without a vector form, one whose bytes differ between lanes, a
+// branch the lanes take different ways, or when the lane with the fewest
+// instructions left is done. Returns the instructions run, 0 if the first
+// had no vector form.
+uint64 lockstep_cpu::run_group(lane_mask group, uint16 at) {
+  uint64 budget = ~uint64{0};
+  for (lane_mask rest = group; rest; rest &= rest - 1) {
+    budget = std::min(budget, remaining[std::countr_zero(rest)]);
+  }
+
+  const cpu &first = *machines[std::countr_zero(group)];
+  uint64 steps = 0, shared_cycles = 0;
+  bool split = false;
+  while (steps < budget) {
+    const uint8 opcode = first.fetch(at);
+    if (!vectorizable[opcode]) {
+      break;
+    }
+    // The group was formed on the first instruction's bytes.
+    if (steps && same_code(group, at, opcodes[opcode].bytes) != group) {
+      break;
+    }
+    const step result = execute_vector(opcode, at, group, shared_cycles);
+    steps++;
+    if (result == step::Split) {
+      split = true;
+      break;
+    }
+  }
+
+  for (lane_mask rest = group; rest; rest &= rest - 1) {
+    const uint32 i = std::countr_zero(rest);
+    remaining[i] -= steps;
+    cycles[i] += shared_cycles;
+    if (!split) {
+      pc[i] = at;
+    }
+  }
+  vector_count += steps * std::popcount(group);
+  return steps;
+}
+
+// One instruction at `at` for every lane in `group`, mirroring
+// execute<Opcode> with the operand bytes shared. Memory accesses go through
+// each lane's own cpu, so watches, MMIO and dirty tracking behave as in a
+// scalar run. Moves `at` past the instruction and adds its cycles to
+// `shared_cycles`, except for what differs by lane (page crossings), which
+// goes to the lane's own count. A branch the lanes take different ways
+// leaves `at` alone, sets each lane's pc and returns Split.
+lockstep_cpu::step lockstep_cpu::execute_vector(uint8 opcode, uint16 &at,
+                                                lane_mask group,
+                                                uint64 &shared_cycles) {
+  const opcode_info info = opcodes[opcode];
+  const OpcodeType type = info.opcode;
+  const AddressingMode mode = info.mode;
+  const cpu &first = *machines[std::countr_zero(group)];
+  const uint8 operand = first.fetch(at + 1);
+  const uint16 operand16 = operand | first.fetch(at + 2) << 8;
+  const bool zero_page = is_zero_page(mode);
+  shared_cycles += info.cycle;
+
+  alignas(32) uint16 addr[MAX_LANES];
+  const uint16 base = zero_page ? operand : operand16;
+  const uint8 *index = mode == AddressingMode::ZeroPage_X ||
+                               mode == AddressingMode::Absolute_X
+                           ? reg_x.data()
+                       : mode == AddressingMode::ZeroPage_Y ||
+                               mode == AddressingMode::Absolute_Y
+                           ? reg_y.data()
+                           : nullptr;
+  if (index) {
+    for (uint32 i = 0; i < MAX_LANES; i++) {
+      addr[i] = base + index[i];
+    }
+    if (!zero_page && has_page_cross_penalty(type)) {
+      for (lane_mask rest = group; rest; rest &= rest - 1) {
+        const uint32 i = std::countr_zero(rest);
+        cycles[i] += (base & 0xFF00) != (addr[i] & 0xFF00);
+      }
+    }
+  } else if (mode == AddressingMode::Indirect_X ||
+             mode == AddressingMode::Indirect_Y) {
+    // The pointer reads wrap (or not) exactly as operand_addr's.
+    const bool indexed_pointer = mode == AddressingMode::Indirect_X;
+    for (lane_mask rest = group; rest; rest &= rest - 1) {
+      const uint32 i = std::countr_zero(rest);
+      cpu &c = *machines[i];
+      const uint8 ptr = operand + (indexed_pointer ? reg_x[i] : 0);
+      const uint16 pointer =
+          static_cast<uint16>(c.low_read(ptr + 1) << 8) | c.low_read(ptr);
+      addr[i] = pointer + (indexed_pointer ? 0 : reg_y[i]);
+      if (!indexed_pointer && has_page_cross_penalty(type)) {
+        cycles[i] += (pointer & 0xFF00) != (addr[i] & 0xFF00);
+      }
+    }
+  } else {
+    for (uint32 i = 0; i < MAX_LANES; i++) {
+      addr[i] = base;
+    }
+  }
+
+  alignas(32) uint8 data[MAX_LANES] = {};
+  auto read_data = [&] {
+    if (mode == AddressingMode::Immediate) {
+      std::fill_n(data, MAX_LANES, operand);
+      return;
+    }
+    for (lane_mask rest = group; rest; rest &= rest - 1) {
+      const uint32 i = std::countr_zero(rest);
+      cpu &c = *machines[i];
+      data[i] = zero_page ? c.low_read(addr[i]) : c.mem_read(addr[i]);
+    }
+  };
+  auto write = [&](const uint8 *values) {
+    for (lane_mask rest = group; rest; rest &= rest - 1) {
+      const uint32 i = std::countr_zero(rest);
+      cpu &c = *machines[i];
+      zero_page ? c.low_write(addr[i], values[i])
+                : c.mem_write(addr[i], values[i]);
+    }
+  };
+  auto set_flag = [&](uint8 bit, bool value) {
+    for (lane_mask rest = group; rest; rest &= rest - 1) {
+      const uint32 i = std::countr_zero(rest);
+      status[i] = value ? status[i] | bit : status[i] & ~bit;
+    }
+  };
+
+  switch (type) {
+  case OpcodeType::LDA:
+    read_data();
+    alu(alu_op::Load, reg_a.data(), data, status.data(), group);
+    break;
+  case OpcodeType::LDX:
+    read_data();
+    alu(alu_op::Load, reg_x.data(), data, status.data(), group);
+    break;
+  case OpcodeType::LDY:
+    read_data();
+    alu(alu_op::Load, reg_y.data(), data, status.data(), group);
+    break;
+  case OpcodeType::STA:
+    write(reg_a.data());
+    break;
+  case OpcodeType::STX:
+    write(reg_x.data());
+    break;
+  case OpcodeType::STY:
+    write(reg_y.data());
+    break;
+  case OpcodeType::ADC:
+  case OpcodeType::SBC:
+    read_data();
+    if (type == OpcodeType::SBC) {
+      for (uint8 &d : data) {
+        d = -(d + 1);
+      }
+    }
+    alu(alu_op::Adc, reg_a.data(), data, status.data(), group);
+    break;
+  case OpcodeType::AND:
+    read_data();
+    alu(alu_op::And, reg_a.data(), data, status.data(), group);
+    break;
+  case OpcodeType::ORA:
+    read_data();
+    alu(alu_op::Or, reg_a.data(), data, status.data(), group);
+    break;
+  case OpcodeType::EOR:
+    read_data();
+    alu(alu_op::Eor, reg_a.data(), data, status.data(), group);
+    break;
+  case OpcodeType::CMP:
+    read_data();
+    alu(alu_op::Compare, reg_a.data(), data, status.data(), group);
+    break;
+  case OpcodeType::CPX:
+    read_data();
+    alu(alu_op::Compare, reg_x.data(), data, status.data(), group);
+    break;
+  case OpcodeType::CPY:
+    read_data();
+    alu(alu_op::Compare, reg_y.data(), data, status.data(), group);
+    break;
+  case OpcodeType::INC:
+  case OpcodeType::DEC: {
+    read_data();
+    alignas(32) uint8 values[MAX_LANES];
+    for (uint32 i = 0; i < MAX_LANES; i++) {
+      values[i] = data[i] + (type == OpcodeType::INC ? 1 : -1);
+    }
+    write(values);
+    // Flags only: load the new values into a scratch register.
+    alu(alu_op::Load, values, values, status.data(), group);
+    break;
+  }
+  case OpcodeType::INX:
+  case OpcodeType::DEX:
+    std::fill_n(data, MAX_LANES, type == OpcodeType::INX ? 1 : 0xFF);
+    alu(alu_op::Add, reg_x.data(), data, status.data(), group);
+    break;
+  case OpcodeType::INY:
+  case OpcodeType::DEY:
+    std::fill_n(data, MAX_LANES, type == OpcodeType::INY ? 1 : 0xFF);
+    alu(alu_op::Add, reg_y.data(), data, status.data(), group);
+    break;
+  case OpcodeType::TAX:
+    alu(alu_op::Load, reg_x.data(), reg_a.data(), status.data(), group);
+    break;
+  case OpcodeType::TAY:
+    alu(alu_op::Load, reg_y.data(), reg_a.data(), status.data(), group);
+    break;
+  case OpcodeType::TSX:
+    alu(alu_op::Load, reg_x.data(), sp.data(), status.data(), group);
+    break;
+  case OpcodeType::TXA:
+    alu(alu_op::Load, reg_a.data(), reg_x.data(), status.data(), group);
+    break;
+  case OpcodeType::TXS:
+    // The one transfer that leaves the flags alone.
+    for (lane_mask rest = group; rest; rest &= rest - 1) {
+      const uint32 i = std::countr_zero(rest);
+      sp[i] = reg_x[i];
+    }
+    break;
+  case OpcodeType::TYA:
+    alu(alu_op::Load, reg_a.data(), reg_y.data(), status.data(), group);
+    break;
+  case OpcodeType::CLC:
+  case OpcodeType::SLC:
+    set_flag(CARRY_BIT, type == OpcodeType::SLC);
+    break;
+  case OpcodeType::CLD:
+  case OpcodeType::SLD:
+    set_flag(1 << static_cast<int>(flag::DecimalModeFlag),
+             type == OpcodeType::SLD);
+    break;
+  case OpcodeType::CLI:
+  case OpcodeType::SLI:
+    set_flag(1 << static_cast<int>(flag::InterruptDisable),
+             type == OpcodeType::SLI);
+    break;
+  case OpcodeType::CLV:
+    set_flag(OVERFLOW_BIT, false);
+    break;
+  case OpcodeType::JMP_ABS:
+    // Like the scalar handler, skips the operand when the target is the
+    // byte after the opcode.
+    at = operand16 == static_cast<uint16>(at + 1) ? at + info.bytes
+                                                   : operand16;
+    return step::Uniform;
+  case OpcodeType::NOP:
+    break;
+  default: {
+    // Branches: the same test as execute<Opcode>, lane by lane.
+    const bool expected = type == OpcodeType::BCS ||
+                          type == OpcodeType::BEQ ||
+                          type == OpcodeType::BMI || type == OpcodeType::BVS;
+    const uint8 tested = type == OpcodeType::BCC || type == OpcodeType::BCS
+                             ? CARRY_BIT
+                         : type == OpcodeType::BEQ || type == OpcodeType::BNE
+                             ? ZERO_BIT
+                         : type == OpcodeType::BMI || type == OpcodeType::BPL
+                             ? NEGATIVE_BIT
+                             : OVERFLOW_BIT;
+    lane_mask taken = 0;
+    for (lane_mask rest = group; rest; rest &= rest - 1) {
+      const uint32 i = std::countr_zero(rest);
+      taken |= lane_mask{((status[i] & tested) != 0) == expected} << i;
+    }
+    const uint16 next = at + info.bytes;
+    uint16 target = next + static_cast<int8>(operand);
+    const uint8 extra = 1 + ((next & 0xFF00) != (target & 0xFF00));
+    // An offset of -1 lands back on the offset byte, which the scalar
+    // handler then skips like an untaken branch.
+    if (target == static_cast<uint16>(at + 1)) {
+      target = next;
+    }
+    if (taken == 0 || taken == group) {
+      at = taken ? target : next;
+      shared_cycles += taken ? extra : 0;
+      return step::Uniform;
+    }
+    for (lane_mask rest = group; rest; rest &= rest - 1) {
+      const uint32 i = std::countr_zero(rest);
+      const bool jump = taken >> i & 1;
+      pc[i] = jump ? target : next;
+      cycles[i] += jump ? extra : 0;
+    }
+    return step::Split;
+  }
+  }
+  at += info.bytes;
+  return step::Uniform;
+}
+
+void lockstep_cpu::execute_scalar(uint32 lane) {
+  cpu &c = *machines[lane];
+  c.reg_a = reg_a[lane];
+  c.reg_x = reg_x[lane];
+  c.reg_y = reg_y[lane];
+  c.sp = sp[lane];
+  c.status = status[lane];
+  c.pc = pc[lane];
+  c.cycles = cycles[lane];
+
+  // Through the cpu's own entry point, which keeps its flags in the form
+  // the handlers expect.
+  c.run_instructions(1);
+  if (c.halted) {
+    halted |= lane_mask{1} << lane;
+  }
+  remaining[lane]--;
+
+  reg_a[lane] = c.reg_a;
+  reg_x[lane] = c.reg_x;
+  reg_y[lane] = c.reg_y;
+  sp[lane] = c.sp;
+  status[lane] = c.status;
+  pc[lane] = c.pc;
+  cycles[lane] = c.cycles;
+}
+
+} // namespace nes_simulator
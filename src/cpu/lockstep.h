@@ -0,0 +1,84 @@
+#pragma once
+
+#include <array>
+#include <cpu/cpu.h>
+#include <memory>
+#include <utils/types.h>
+#include <vector>
+
+namespace nes_simulator {
+
+// Runs up to 32 machines through the same program together, for workloads
+// that replay one program under many input streams.
+//
+// Registers and flags live in structure-of-arrays form, one byte per lane.
+// Each round picks the lane furthest behind and gathers every lane stopped at
+// the same pc on the same instruction bytes; the group then runs together,
+// sharing one pc, while it stays on a common path. The common loads, stores,
+// ALU operations, flag changes, branches and jumps run as vector operations
+// over the lanes (AVX2 where the host has it), and anything else runs through
+// the scalar handlers one lane at a time. Lanes whose branches go different
+// ways simply end up in different groups until their pcs meet again.
+//
+// Each lane is a full cpu owning its memory and bus, and lane(i) after a run
+// is bit-identical to a cpu that ran the same instructions on its own.
+class lockstep_cpu {
+public:
+  static constexpr uint32 MAX_LANES = 32;
+
+  // Throws std::runtime_error unless 1 <= lanes <= MAX_LANES.
+  explicit lockstep_cpu(uint32 lanes);
+
+  uint32 lanes() const { return lane_count; }
+
+  // The machine behind a lane, for loading programs, resetting and writing
+  // inputs between runs. Lanes must not have hooks: interval hooks would be
+  // skipped and write hooks would see stale registers.
+  cpu &lane(uint32 index) { return *machines[index]; }
+  const cpu &lane(uint32 index) const { return *machines[index]; }
+
+  // Runs every lane for `count` instructions or until it halts, like
+  // lane(i).run_instructions(count). Throws std::runtime_error if a lane has
+  // hooks.
+  void run_instructions(uint64 count);
+
+  // Lane-instructions run by the vector path and by the scalar fallback.
+  uint64 vector_instructions() const { return vector_count; }
+  uint64 scalar_instructions() const { return scalar_count; }
+
+private:
+  using lane_mask = uint32;
+
+  enum class step {
+    Uniform,
+    Split,
+  };
+
+  void load_lanes();
+  void store_lanes();
+  lane_mask active_lanes() const;
+  lane_mask group_at(lane_mask active, uint32 leader) const;
+  lane_mask same_code(lane_mask group, uint16 at, uint8 bytes) const;
+  uint64 run_group(lane_mask group, uint16 at);
+  step execute_vector(uint8 opcode, uint16 &at, lane_mask group,
+                      uint64 &shared_cycles);
+  void execute_scalar(uint32 lane);
+
+  uint32 lane_count;
+  std::vector<std::unique_ptr<cpu>> machines;
+
+  alignas(32) std::array<uint8, MAX_LANES> reg_a;
+  alignas(32) std::array<uint8, MAX_LANES> reg_x;
+  alignas(32) std::array<uint8, MAX_LANES> reg_y;
+  alignas(32) std::array<uint8, MAX_LANES> sp;
+  alignas(32) std::array<uint8, MAX_LANES> status;
+  alignas(32) std::array<uint16, MAX_LANES> pc;
+  std::array<uint64, MAX_LANES> cycles;
+  std::array<uint64, MAX_LANES> remaining;
+  lane_mask halted;
+
+  uint64 vector_count;
+  uint64 scalar_count;
+};
+
+} // namespace nes_simulator
@@ -5,7 +5,10 @@
 
 namespace nes_simulator {
 
+// UNKNOWN is the zero value so every byte without an entry in opcodes[]
+// (unofficial opcodes, 0xFF) decodes to it; all engines halt on it like BRK.
 enum class OpcodeType {
+  UNKNOWN,
   ADC,
   LDA,
   AND,
@@ -76,7 +79,27 @@ struct opcode_info {
   AddressingMode mode;
 };
 
-const opcode_info opcodes[0xFF] = {
+// Read instructions take one extra cycle when an indexed address crosses a
+// page boundary; stores and read-modify-write instructions always pay it and
+// have it folded into opcode_info::cycle.
+constexpr bool has_page_cross_penalty(OpcodeType type) {
+  switch (type) {
+  case OpcodeType::ADC:
+  case OpcodeType::SBC:
+  case OpcodeType::AND:
+  case OpcodeType::ORA:
+  case OpcodeType::EOR:
+  case OpcodeType::LDA:
+  case OpcodeType::LDX:
+  case OpcodeType::LDY:
+  case OpcodeType::CMP:
+    return true;
+  default:
+    return false;
+  }
+}
+
+inline constexpr opcode_info opcodes[0x100] = {
     [0x69] = {OpcodeType::ADC, 2, 2, AddressingMode::Immediate},
     [0x65] = {OpcodeType::ADC, 2, 3, AddressingMode::ZeroPage},
     [0x75] = {OpcodeType::ADC, 2, 4, AddressingMode::ZeroPage_X},
@@ -194,10 +217,10 @@ const opcode_info opcodes[0xFF] = {
     [0x85] = {OpcodeType::STA, 2, 3, AddressingMode::ZeroPage},
     [0x95] = {OpcodeType::STA, 2, 4, AddressingMode::ZeroPage_X},
     [0x8D] = {OpcodeType::STA, 3, 4, AddressingMode::Absolute},
-    [0x9D] = {OpcodeType::STA, 3, 4, AddressingMode::Absolute_X},
-    [0x99] = {OpcodeType::STA, 3, 4, AddressingMode::Absolute_Y},
+    [0x9D] = {OpcodeType::STA, 3, 5, AddressingMode::Absolute_X},
+    [0x99] = {OpcodeType::STA, 3, 5, AddressingMode::Absolute_Y},
     [0x81] = {OpcodeType::STA, 2, 6, AddressingMode::Indirect_X},
-    [0x91] = {OpcodeType::STA, 2, 5, AddressingMode::Indirect_Y},
+    [0x91] = {OpcodeType::STA, 2, 6, AddressingMode::Indirect_Y},
 
     [0x86] = {OpcodeType::STX, 2, 3, AddressingMode::ZeroPage},
     [0x96] = {OpcodeType::STX, 2, 4, AddressingMode::ZeroPage_Y},
@@ -240,10 +263,10 @@ const opcode_info opcodes[0xFF] = {
     [0x48] = {OpcodeType::PHA, 1, 3, AddressingMode::Implied},
     [0x08] = {OpcodeType::PHP, 1, 3, AddressingMode::Implied},
 
-    [0x68] = {OpcodeType::PLA, 1, 3, AddressingMode::Implied},
-    [0x28] = {OpcodeType::PLP, 1, 3, AddressingMode::Implied},
+    [0x68] = {OpcodeType::PLA, 1, 4, AddressingMode::Implied},
+    [0x28] = {OpcodeType::PLP, 1, 4, AddressingMode::Implied},
 
-    [0x00] = {OpcodeType::BRK, 1, 1, AddressingMode::Implied},
+    [0x00] = {OpcodeType::BRK, 1, 7, AddressingMode::Implied},
 
     [0x2A] = {OpcodeType::ROL_ACC, 1, 2, AddressingMode::Implied},
 
@@ -0,0 +1,50 @@
+#pragma once
+
+namespace nes_simulator {
+
+// How the interpreters reach memory.
+enum class bus_access {
+  // Every data access looks up its page in the bus, so ROM, MMIO, mirrors
+  // and watched pages (dirty tracking, save deltas, decoded code, write
+  // hooks) take the slow path.
+  Paged,
+  // Data accesses index the 64 KB image directly. Only right while the bus
+  // is flat (see memory_bus::flat), so runs check that before every batch
+  // and fall back to Paged when it is not.
+  Flat,
+};
+
+// Compile-time features of an interpreter run. Each is a template argument
+// of the engines' loops, so a run without one has no trace of it, not even
+// a test-and-branch; a feature that is on costs its check only in the
+// instantiations that ask for it.
+//
+//   Bus          how data accesses reach memory.
+//   Trace        record every instruction into the cpu's trace_writer, if
+//                one is set (cpu::trace_to).
+//   Breakpoints  stop before instructions at breakpoint addresses
+//                (cpu::add_breakpoint).
+//
+// Hooks are not a feature: interval hooks cut a run into batches and write
+// hooks sit behind watched pages, so neither costs anything per instruction.
+//
+// Anything that watches instructions one by one has to see each of them, so
+// such runs take the Jit engine's blocks through the decode cache
+// interpreter and do not fast-forward idle loops.
+template <bus_access Bus, bool Trace, bool Breakpoints> struct cpu_policy {
+  static constexpr bus_access bus = Bus;
+  static constexpr bool trace = Trace;
+  static constexpr bool breakpoints = Breakpoints;
+  static constexpr bool per_instruction = Trace || Breakpoints;
+
+  // The same features over the paged bus, for runs where the bus is not
+  // flat or code outside the engine runs between instructions.
+  using paged = cpu_policy<bus_access::Paged, Trace, Breakpoints>;
+};
+
+// What the batched entry points run by default: nothing but the program.
+using fast_policy = cpu_policy<bus_access::Flat, false, false>;
+// Tracing and breakpoints, for debuggers and trace tooling.
+using debug_policy = cpu_policy<bus_access::Paged, true, true>;
+
+} // namespace nes_simulator
@@ -0,0 +1,168 @@
+#include "cpu/profiler.h"
+#include "cpu/opcode.h"
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+namespace nes_simulator {
+
+profiler::profiler()
+    : per_pc(0x10000), total_cycles(0), pending(false), pending_pc(0),
+      pending_opcode(0), pending_cycles(0) {}
+
+void profiler::sample(const cpu &cpu) {
+  settle(cpu);
+  if (nodes.empty()) {
+    nodes.push_back({cpu.pc, 0, {}, {}});
+    stack.push_back({0, cpu.sp});
+  }
+  pending = true;
+  pending_pc = cpu.pc;
+  pending_opcode = cpu.fetch(cpu.pc);
+  pending_cycles = cpu.cycles;
+}
+
+void profiler::settle(const cpu &cpu) {
+  if (!pending) {
+    return;
+  }
+  pending = false;
+  const uint64 spent = cpu.cycles - pending_cycles;
+  auto &here = per_pc[pending_pc];
+  here.instructions++;
+  here.cycles += spent;
+  auto &self = nodes[stack.back().node].self;
+  self.instructions++;
+  self.cycles += spent;
+  total_cycles += spent;
+  follow(pending_opcode, pending_pc, cpu);
+}
+
+// `cpu` is as the instruction at `from` left it. The bottom frame is where
+// profiling began and is never closed.
+void profiler::follow(uint8 opcode, uint16 from, const cpu &cpu) {
+  const auto &info = opcodes[opcode];
+  const auto close_from = [&](uint8 sp) {
+    for (std::size_t i = stack.size(); i-- > 1;) {
+      if (stack[i].sp == sp) {
+        stack.resize(i);
+        return true;
+      }
+    }
+    return false;
+  };
+
+  switch (info.opcode) {
+  case OpcodeType::JSR: {
+    // A frame returning to the same sp has had its return address
+    // overwritten, so it and everything it called are gone.
+    const uint8 sp = cpu.sp + 2;
+    close_from(sp);
+    stack.push_back({child(stack.back().node, cpu.pc), sp});
+    break;
+  }
+  case OpcodeType::RTS:
+  case OpcodeType::RTI:
+    if (!close_from(cpu.sp) && stack.size() > 1) {
+      stack.pop_back();
+    }
+    break;
+  case OpcodeType::JMP_ABS:
+  case OpcodeType::JMP_IND:
+    if (cpu.pc <= from) {
+      back_edges[uint32{from} << 16 | cpu.pc]++;
+    }
+    break;
+  default:
+    // An untaken branch falls through past itself.
+    if (info.mode == AddressingMode::Relative && cpu.pc <= from) {
+      back_edges[uint32{from} << 16 | cpu.pc]++;
+    }
+    break;
+  }
+}
+
+uint32 profiler::child(uint32 node, uint16 function) {
+  for (const uint32 id : nodes[node].children) {
+    if (nodes[id].function == function) {
+      return id;
+    }
+  }
+  const uint32 id = nodes.size();
+  nodes.push_back({function, node, {}, {}});
+  nodes[node].children.push_back(id);
+  return id;
+}
+
+void profiler::write_folded(std::ostream &out) const {
+  std::vector<uint16> path;
+  for (uint32 id = 0; id < nodes.size(); id++) {
+    if (nodes[id].self.cycles == 0) {
+      continue;
+    }
+    path.clear();
+    for (uint32 at = id;; at = nodes[at].parent) {
+      path.push_back(nodes[at].function);
+      if (at == 0) {
+        break;
+      }
+    }
+
+    std::string line;
+    char name[8];
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+      std::snprintf(name, sizeof(name), "$%04X", *it);
+      if (!line.empty()) {
+        line += ';';
+      }
+      line += name;
+    }
+    out << line << ' ' << nodes[id].self.cycles << '\n';
+  }
+}
+
+void profiler::write_hot_loops(std::ostream &out, uint32 count) const {
+  struct loop {
+    uint16 begin, end;
+    uint64 iterations;
+    uint64 cycles;
+  };
+  std::vector<loop> loops;
+  loops.reserve(back_edges.size());
+  for (const auto &[edge, taken] : back_edges) {
+    const uint16 end = edge >> 16;
+    const uint16 begin = edge;
+    uint64 cycles = 0;
+    for (uint32 pc = begin; pc <= end; pc++) {
+      cycles += per_pc[pc].cycles;
+    }
+    loops.push_back({begin, end, taken, cycles});
+  }
+  std::sort(loops.begin(), loops.end(), [](const loop &a, const loop &b) {
+    return a.cycles != b.cycles ? a.cycles > b.cycles : a.begin < b.begin;
+  });
+  if (loops.size() > count) {
+    loops.resize(count);
+  }
+
+  char line[96];
+  for (const auto &l : loops) {
+    std::snprintf(line, sizeof(line),
+                  "loop $%04X-$%04X iterations %llu cycles %llu %.1f%%\n",
+                  l.begin, l.end, (unsigned long long)l.iterations,
+                  (unsigned long long)l.cycles,
+                  total_cycles ? 100.0 * l.cycles / total_cycles : 0.0);
+    out << line;
+  }
+}
+
+void profiler::clear() {
+  std::fill(per_pc.begin(), per_pc.end(), counts{});
+  nodes.clear();
+  stack.clear();
+  back_edges.clear();
+  total_cycles = 0;
+  pending = false;
+}
+
+} // namespace nes_simulator
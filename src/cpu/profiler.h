@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cpu/cpu.h>
+#include <ostream>
+#include <unordered_map>
+#include <utils/types.h>
+#include <vector>
+
+namespace nes_simulator {
+
+// Counts where guest code spends its time: instructions and cycles per
+// address in a flat 64K table, the same per guest call stack, and the taken
+// backward branches and jumps that close loops.
+//
+// Every instruction is counted rather than sampled, so profiles are exact
+// and reproduce run to run. An instruction is noted before it runs and
+// charged at the next one, when its cycles and the pc and sp it left are
+// known. Calls are followed through JSR and RTS/RTI: each JSR opens a frame
+// that remembers the sp to return to, and a return closes the frames down to
+// the one whose sp it restored, so code that drops return addresses by hand
+// or returns through pushed addresses unwinds no further than it should.
+//
+// It hooks in through run_until: profiled() wraps the predicate, and runs
+// without it are untouched. As a run() callback,
+// sample() does the same, with settle() called once the run is over.
+class profiler {
+public:
+  struct counts {
+    uint64 instructions;
+    uint64 cycles;
+  };
+
+  profiler();
+
+  // Charges the previous instruction and notes the one at the cpu's pc,
+  // which is about to run.
+  void sample(const cpu &cpu);
+  // Charges the last noted instruction, if any. Runs that end on a halt
+  // return without asking the predicate again, so call this after them.
+  void settle(const cpu &cpu);
+
+  template <class Predicate> auto profiled(Predicate predicate) {
+    return [this, predicate](cpu &c) mutable {
+      if (predicate(c)) {
+        settle(c);
+        return true;
+      }
+      sample(c);
+      return false;
+    };
+  }
+
+  const counts &at(uint16 pc) const { return per_pc[pc]; }
+
+  // One line per call stack that ran code, outermost function first, in the
+  // folded format flamegraph.pl reads, weighted by cycles:
+  //
+  //   $0600;$0606;$060D 1234
+  //
+  // Functions are named by their entry address; the outermost is where
+  // profiling began.
+  void write_folded(std::ostream &out) const;
+
+  // The `count` loops that took the most cycles, one per backward edge:
+  //
+  //   loop $0650-$0672 iterations <n> cycles <n> <percent>%
+  //
+  // A loop's cycles are those spent on the addresses it spans, which leaves
+  // out subroutines it calls.
+  void write_hot_loops(std::ostream &out, uint32 count) const;
+
+  void clear();
+
+private:
+  struct call_node {
+    uint16 function;
+    uint32 parent;
+    std::vector<uint32> children;
+    counts self;
+  };
+
+  struct frame {
+    uint32 node;
+    // The sp the matching return restores.
+    uint8 sp;
+  };
+
+  uint32 child(uint32 node, uint16 function);
+  void follow(uint8 opcode, uint16 from, const cpu &cpu);
+
+  std::vector<counts> per_pc;
+  std::vector<call_node> nodes;
+  std::vector<frame> stack;
+  // Taken backward edges as from << 16 | to.
+  std::unordered_map<uint32, uint64> back_edges;
+  uint64 total_cycles;
+
+  bool pending;
+  uint16 pending_pc;
+  uint8 pending_opcode;
+  uint64 pending_cycles;
+};
+
+} // namespace nes_simulator
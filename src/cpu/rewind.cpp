@@ -0,0 +1,169 @@
+#include "cpu/rewind.h"
+#include "cpu/cpu.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace nes_simulator {
+
+namespace {
+
+constexpr uint32 PAGE_SIZE = memory_bus::PAGE_SIZE;
+
+struct record_header {
+  // The frame before this record's, which applying it restores.
+  cpu_registers registers;
+  uint32 pages;
+};
+
+// A page of XOR is a series of tokens: a count of zero bytes, a count of
+// literal bytes, then the literals. Each token covers at least one byte, so
+// a page packs into at most 3 * PAGE_SIZE bytes.
+constexpr std::size_t MAX_PACKED_PAGE = 3 * PAGE_SIZE;
+constexpr std::size_t MAX_RECORD =
+    sizeof(record_header) + 0x100 * (1 + MAX_PACKED_PAGE);
+
+uint8 *pack_xor(const uint8 *xor_page, uint8 *out) {
+  for (uint32 i = 0; i < PAGE_SIZE;) {
+    uint8 zeros = 0, literals = 0;
+    while (i < PAGE_SIZE && xor_page[i] == 0 && zeros < 255) {
+      zeros++;
+      i++;
+    }
+    const uint8 *begin = xor_page + i;
+    while (i < PAGE_SIZE && xor_page[i] != 0 && literals < 255) {
+      literals++;
+      i++;
+    }
+    *out++ = zeros;
+    *out++ = literals;
+    out = std::copy_n(begin, literals, out);
+  }
+  return out;
+}
+
+const uint8 *unpack_xor(const uint8 *in, uint8 *page) {
+  for (uint32 i = 0; i < PAGE_SIZE;) {
+    i += *in++;
+    const uint8 literals = *in++;
+    for (uint8 n = 0; n < literals; n++) {
+      page[i++] ^= *in++;
+    }
+  }
+  return in;
+}
+
+} // namespace
+
+rewind_buffer::rewind_buffer(uint32 max_frames, std::size_t max_bytes)
+    : ring(max_bytes), records(max_frames), first(0), count(0), used(0),
+      current(std::make_unique<save_state>()), has_state(false), delta(),
+      scratch(MAX_RECORD) {
+  if (max_frames == 0 || max_bytes == 0) {
+    throw std::runtime_error("rewind buffer needs room for one frame");
+  }
+  delta.pages.reserve(0x100);
+  delta.data.reserve(0x100 * PAGE_SIZE);
+}
+
+void rewind_buffer::record(cpu &cpu) {
+  if (!has_state) {
+    cpu.save(*current);
+    has_state = true;
+    return;
+  }
+  cpu.save_delta(delta);
+  push(encode());
+}
+
+// Packs the XOR of every changed page of `delta` against `current` into
+// `scratch`, then rolls `current` forward to `delta`.
+std::size_t rewind_buffer::encode() {
+  uint8 *out = scratch.data() + sizeof(record_header);
+  uint32 pages = 0;
+  for (std::size_t i = 0; i < delta.pages.size(); i++) {
+    const uint8 *now = &delta.data[i * PAGE_SIZE];
+    uint8 *was = &current->memory[delta.pages[i] << 8];
+    uint8 xor_page[PAGE_SIZE];
+    uint8 changed = 0;
+    for (uint32 j = 0; j < PAGE_SIZE; j++) {
+      xor_page[j] = now[j] ^ was[j];
+      changed |= xor_page[j];
+    }
+    // Written but restored to the same bytes.
+    if (!changed) {
+      continue;
+    }
+    *out++ = delta.pages[i];
+    out = pack_xor(xor_page, out);
+    std::memcpy(was, now, PAGE_SIZE);
+    pages++;
+  }
+
+  const record_header header{current->registers, pages};
+  std::memcpy(scratch.data(), &header, sizeof(header));
+  current->registers = delta.registers;
+  return out - scratch.data();
+}
+
+void rewind_buffer::push(std::size_t size) {
+  // A record that can never fit breaks the chain back to older frames.
+  if (size > ring.size()) {
+    count = used = 0;
+    return;
+  }
+  while (count == records.size() || ring.size() - used < size) {
+    used -= records[first].size;
+    first = (first + 1) % records.size();
+    count--;
+  }
+
+  std::size_t offset = 0;
+  if (count) {
+    const auto &newest = records[(first + count - 1) % records.size()];
+    offset = (newest.offset + newest.size) % ring.size();
+  }
+  const std::size_t head = std::min(size, ring.size() - offset);
+  std::memcpy(ring.data() + offset, scratch.data(), head);
+  std::memcpy(ring.data(), scratch.data() + head, size - head);
+
+  records[(first + count) % records.size()] = {offset, size};
+  count++;
+  used += size;
+}
+
+bool rewind_buffer::step_back(cpu &cpu) {
+  if (!has_state) {
+    return false;
+  }
+  if (count == 0) {
+    cpu.restore(*current);
+    return false;
+  }
+
+  const auto newest = records[(first + count - 1) % records.size()];
+  const std::size_t head = std::min(newest.size, ring.size() - newest.offset);
+  std::memcpy(scratch.data(), ring.data() + newest.offset, head);
+  std::memcpy(scratch.data() + head, ring.data(), newest.size - head);
+  count--;
+  used -= newest.size;
+
+  record_header header;
+  std::memcpy(&header, scratch.data(), sizeof(header));
+  const uint8 *in = scratch.data() + sizeof(header);
+  for (uint32 i = 0; i < header.pages; i++) {
+    const uint8 page = *in++;
+    in = unpack_xor(in, &current->memory[page << 8]);
+  }
+  current->registers = header.registers;
+  cpu.restore(*current);
+  return true;
+}
+
+void rewind_buffer::clear() {
+  first = count = 0;
+  used = 0;
+  has_state = false;
+}
+
+} // namespace nes_simulator
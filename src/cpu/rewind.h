@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cpu/save_state.h>
+#include <cstddef>
+#include <memory>
+#include <utils/types.h>
+#include <vector>
+
+namespace nes_simulator {
+
+class cpu;
+
+// Keeps the most recent per-frame states of a cpu so it can be stepped
+// backwards a frame at a time.
+//
+// Only the newest state is held in full. Each older frame is a record of
+// the pages that differ from the frame after it, XORed against that frame
+// and packed as runs of zero and literal bytes; applying the records newest
+// first walks back through history, and the oldest can be dropped without
+// touching the rest. Records live in a byte ring of fixed size, so memory
+// use is set at construction and recording allocates nothing.
+//
+// Recording saves the cpu every frame, so the pages the program has not
+// written since stay watched and the cpu's runs take the Paged bus path,
+// never the Flat one (see memory_bus::flat).
+class rewind_buffer {
+public:
+  // Holds at most `max_frames` steps back in at most `max_bytes` of records;
+  // the oldest records are dropped to make room.
+  rewind_buffer(uint32 max_frames, std::size_t max_bytes);
+
+  // Call once per frame. The first call after construction or clear() takes
+  // a full snapshot; later ones record the difference from the previous
+  // call, using the cpu's save_delta.
+  void record(cpu &cpu);
+
+  // Restores the cpu to the frame recorded before the newest one, which then
+  // becomes the newest. Returns false, restoring the oldest frame held, once
+  // the history is used up.
+  bool step_back(cpu &cpu);
+
+  void clear();
+
+  uint32 frames() const { return count; }
+  std::size_t bytes_used() const { return used; }
+
+private:
+  struct record_span {
+    std::size_t offset;
+    std::size_t size;
+  };
+
+  std::size_t encode();
+  void push(std::size_t size);
+
+  std::vector<uint8> ring;
+  std::vector<record_span> records;
+  uint32 first;
+  uint32 count;
+  std::size_t used;
+
+  // The newest frame in full; records are applied to it when stepping back.
+  std::unique_ptr<save_state> current;
+  bool has_state;
+  state_delta delta;
+  std::vector<uint8> scratch;
+};
+
+} // namespace nes_simulator
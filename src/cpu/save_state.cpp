@@ -0,0 +1,104 @@
+#include "cpu/save_state.h"
+#include "cpu/cpu.h"
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+
+namespace nes_simulator {
+
+void save_state::apply(const state_delta &delta) {
+  registers = delta.registers;
+  for (std::size_t i = 0; i < delta.pages.size(); i++) {
+    std::memcpy(&memory[delta.pages[i] << 8],
+                &delta.data[i * memory_bus::PAGE_SIZE], memory_bus::PAGE_SIZE);
+  }
+}
+
+void cpu::save(save_state &state) {
+  state.registers = save_registers();
+  std::memcpy(state.memory.data(), memory, sizeof(memory));
+  start_snapshot_tracking();
+}
+
+void cpu::save_delta(state_delta &delta) {
+  if (!snapshot_tracking) {
+    throw std::runtime_error("save_delta needs a previous save");
+  }
+
+  delta.registers = save_registers();
+  delta.pages.clear();
+  delta.data.clear();
+  for (uint32 word = 0; word < snapshot_pages.size(); word++) {
+    for (uint64 bits = snapshot_pages[word]; bits; bits &= bits - 1) {
+      const uint32 page = word * 64 + std::countr_zero(bits);
+      delta.pages.push_back(page);
+      delta.data.insert(delta.data.end(), memory + (page << 8),
+                        memory + (page << 8) + memory_bus::PAGE_SIZE);
+    }
+  }
+  start_snapshot_tracking();
+}
+
+void cpu::restore(const save_state &state) {
+  for (uint32 page = 0; page < 0x100; page++) {
+    restore_page(page, &state.memory[page << 8]);
+  }
+  restore_registers(state.registers);
+  start_snapshot_tracking();
+}
+
+void cpu::restore(const state_delta &delta) {
+  for (std::size_t i = 0; i < delta.pages.size(); i++) {
+    restore_page(delta.pages[i], &delta.data[i * memory_bus::PAGE_SIZE]);
+  }
+  restore_registers(delta.registers);
+  start_snapshot_tracking();
+}
+
+cpu_registers cpu::save_registers() const {
+  return {reg_a, reg_x, reg_y, sp, status, pc, halted, instructions, cycles};
+}
+
+void cpu::restore_registers(const cpu_registers &registers) {
+  reg_a = registers.reg_a;
+  reg_x = registers.reg_x;
+  reg_y = registers.reg_y;
+  sp = registers.sp;
+  status = registers.status;
+  pc = registers.pc;
+  halted = registers.halted;
+  instructions = registers.instructions;
+  cycles = registers.cycles;
+  for (auto &hook : interval_hooks) {
+    hook.next = instructions + hook.interval;
+  }
+}
+
+// Bytes that change under a dirty-tracked region are marked dirty, as if the
+// program had written them.
+void cpu::restore_page(uint8 page, const uint8 *data) {
+  uint8 *dest = memory + (page << 8);
+  if (page_watch[page] & WATCH_DIRTY) {
+    for (uint32 i = 0; i < memory_bus::PAGE_SIZE; i++) {
+      if (dest[i] != data[i]) {
+        const uint32 addr = (page << 8) + i;
+        dirty_bits[addr / 64] |= uint64{1} << (addr % 64);
+      }
+    }
+  }
+  if (decoded) {
+    decoded->invalidate_page(page);
+  }
+  std::memcpy(dest, data, memory_bus::PAGE_SIZE);
+}
+
+void cpu::start_snapshot_tracking() {
+  snapshot_pages = {};
+  snapshot_tracking = true;
+  for (uint32 page = 0; page < page_watch.size(); page++) {
+    watch_page(page, page_watch[page] | WATCH_SNAPSHOT);
+  }
+}
+
+} // namespace nes_simulator
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <array>
+#include <utils/types.h>
+#include <vector>
+
+namespace nes_simulator {
+
+struct cpu_registers {
+  uint8 reg_a, reg_x, reg_y, sp, status;
+  uint16 pc;
+  bool halted;
+  uint64 instructions;
+  uint64 cycles;
+};
+
+struct state_delta;
+
+// A full snapshot: the registers and the whole 64 KB image. The bus mapping
+// is not part of it, so a state only restores onto a cpu mapped the same way.
+// At 64 KB it is best kept on the heap.
+struct save_state {
+  cpu_registers registers;
+  std::array<uint8, 0x10000> memory;
+
+  // Rolls the snapshot forward to the point `delta` was taken.
+  void apply(const state_delta &delta);
+};
+
+// The registers plus the image pages written since the previous snapshot, in
+// ascending page order. Applied on top of that snapshot, it gives the machine
+// at the time it was taken.
+struct state_delta {
+  cpu_registers registers;
+  std::vector<uint8> pages;
+  // 256 bytes per entry of `pages`.
+  std::vector<uint8> data;
+};
+
+} // namespace nes_simulator
@@ -0,0 +1,118 @@
+#include "cpu/trace.h"
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <iterator>
+#include <stdexcept>
+
+namespace nes_simulator {
+
+trace_writer::trace_writer(const std::string &path, uint32 capacity)
+    : ring(std::make_unique<trace_record[]>(
+          std::bit_ceil(std::max(capacity, 1u)))),
+      mask(std::bit_ceil(std::max(capacity, 1u)) - 1),
+      file(std::fopen(path.c_str(), "wb")), head(0), tail_seen(0), tail(0),
+      stopping(false), failed(false) {
+  if (!file) {
+    throw std::runtime_error("cannot create " + path);
+  }
+  trace_header header{};
+  std::copy_n(trace_header::MAGIC, sizeof(header.magic), header.magic);
+  header.version = trace_header::VERSION;
+  header.record_size = sizeof(trace_record);
+  if (std::fwrite(&header, sizeof(header), 1, file) != 1) {
+    std::fclose(file);
+    throw std::runtime_error("cannot write " + path);
+  }
+  writer = std::thread(&trace_writer::drain, this);
+}
+
+trace_writer::~trace_writer() {
+  try {
+    close();
+  } catch (const std::runtime_error &) {
+  }
+}
+
+void trace_writer::close() {
+  if (!file) {
+    return;
+  }
+  stopping.store(true, std::memory_order_release);
+  writer.join();
+  failed |= std::fclose(file) != 0;
+  file = nullptr;
+  if (failed) {
+    throw std::runtime_error("trace write failed");
+  }
+}
+
+void trace_writer::wait_for_room(uint64 slot) {
+  for (;;) {
+    tail_seen = tail.load(std::memory_order_acquire);
+    if (slot - tail_seen <= mask) {
+      return;
+    }
+    std::this_thread::yield();
+  }
+}
+
+// Writes whatever the producer has published, a contiguous run of the ring
+// at a time, and naps when there is none. `stopping` is read before `head`,
+// so the pass that sees it set also sees the last record.
+void trace_writer::drain() {
+  uint64 written = 0;
+  for (;;) {
+    const bool last = stopping.load(std::memory_order_acquire);
+    const uint64 end = head.load(std::memory_order_acquire);
+    if (end == written) {
+      if (last) {
+        return;
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+      continue;
+    }
+
+    const uint64 begin = written & mask;
+    const uint64 count = std::min(end - written, mask + 1 - begin);
+    if (!failed && std::fwrite(&ring[begin], sizeof(trace_record), count,
+                               file) != count) {
+      failed = true;
+    }
+    written += count;
+    tail.store(written, std::memory_order_release);
+  }
+}
+
+trace_reader::trace_reader(const std::string &path)
+    : file(std::fopen(path.c_str(), "rb")) {
+  if (!file) {
+    throw std::runtime_error("cannot open " + path);
+  }
+  trace_header header;
+  if (std::fread(&header, sizeof(header), 1, file) != 1 ||
+      !std::equal(std::begin(header.magic), std::end(header.magic),
+                  trace_header::MAGIC)) {
+    std::fclose(file);
+    throw std::runtime_error(path + " is not a trace file");
+  }
+  if (header.version != trace_header::VERSION ||
+      header.record_size != sizeof(trace_record)) {
+    std::fclose(file);
+    throw std::runtime_error("unsupported trace version " +
+                             std::to_string(header.version));
+  }
+}
+
+trace_reader::~trace_reader() { std::fclose(file); }
+
+std::size_t trace_reader::read(trace_record *records, std::size_t count) {
+  const std::size_t got =
+      std::fread(records, sizeof(trace_record), count, file);
+  if (got < count && std::ferror(file)) {
+    throw std::runtime_error("cannot read trace");
+  }
+  return got;
+}
+
+} // namespace nes_simulator
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <cpu/cpu.h>
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utils/types.h>
+
+namespace nes_simulator {
+
+// One executed instruction, as the cpu stood before running it. The two
+// bytes after the opcode are kept whatever its length; the opcode table
+// says how many belong to it.
+struct trace_record {
+  uint16 pc;
+  uint8 opcode;
+  uint8 reg_a, reg_x, reg_y, status, sp;
+  uint16 operand;
+  // The cycle count, split so that the record packs into 16 bytes.
+  uint16 cycles_high;
+  uint32 cycles_low;
+
+  uint64 cycles() const { return uint64{cycles_high} << 32 | cycles_low; }
+};
+static_assert(sizeof(trace_record) == 16);
+
+// A trace file is this header followed by records in host byte order.
+struct trace_header {
+  static constexpr char MAGIC[8] = {'N', 'E', 'S', 'T', 'R', 'A', 'C', 'E'};
+  static constexpr uint32 VERSION = 1;
+
+  char magic[8];
+  uint32 version;
+  uint32 record_size;
+};
+
+// Writes a binary instruction trace. The emulation thread appends records to
+// a single-producer, single-consumer ring and a writer thread drains it to
+// the file, so recording an instruction is a few stores and no I/O; when the
+// writer falls behind, the emulation thread waits for room rather than drop
+// records.
+//
+// Tracing is compiled into the engines: runs under a policy with Trace on
+// (debug_policy) record every instruction into the writer given to
+// cpu::trace_to before running it. Runs under other policies are the
+// untraced engines, untouched. The Jit engine runs only its interpreter
+// under such a policy, so a traced run is as exact as any other.
+class trace_writer {
+public:
+  // Throws std::runtime_error if the file cannot be created. `capacity` is
+  // rounded up to a power of two.
+  explicit trace_writer(const std::string &path, uint32 capacity = 1 << 18);
+  ~trace_writer();
+  trace_writer(const trace_writer &) = delete;
+  trace_writer &operator=(const trace_writer &) = delete;
+
+  void record(const cpu &cpu);
+
+  // Drains the ring, stops the writer and closes the file. Throws
+  // std::runtime_error if a write failed. The destructor does the same but
+  // cannot report failure.
+  void close();
+
+  uint64 records() const { return head.load(std::memory_order_relaxed); }
+
+private:
+  void wait_for_room(uint64 slot);
+  void drain();
+
+  std::unique_ptr<trace_record[]> ring;
+  uint64 mask;
+  std::FILE *file;
+
+  // Counts of records appended and written, each on its own cache line. The
+  // producer keeps its last look at `tail` so that it only reads the
+  // writer's line when the ring may be full.
+  alignas(64) std::atomic<uint64> head;
+  uint64 tail_seen;
+  alignas(64) std::atomic<uint64> tail;
+  std::atomic<bool> stopping;
+  bool failed;
+  std::thread writer;
+};
+
+// Reads a trace file back, a block of records at a time.
+class trace_reader {
+public:
+  // Throws std::runtime_error if the file cannot be opened or does not
+  // start with a trace header of this version and record size.
+  explicit trace_reader(const std::string &path);
+  ~trace_reader();
+  trace_reader(const trace_reader &) = delete;
+  trace_reader &operator=(const trace_reader &) = delete;
+
+  // Reads up to `count` records into `records` and returns how many it
+  // read, 0 at the end of the file. Throws std::runtime_error if reading
+  // fails.
+  std::size_t read(trace_record *records, std::size_t count);
+
+private:
+  std::FILE *file;
+};
+
+inline void trace_writer::record(const cpu &cpu) {
+  const uint64 slot = head.load(std::memory_order_relaxed);
+  if (slot - tail_seen > mask) {
+    wait_for_room(slot);
+  }
+  trace_record &r = ring[slot & mask];
+  r.pc = cpu.pc;
+  r.opcode = cpu.fetch(cpu.pc);
+  r.reg_a = cpu.reg_a;
+  r.reg_x = cpu.reg_x;
+  r.reg_y = cpu.reg_y;
+  r.status = cpu.status;
+  r.sp = cpu.sp;
+  r.operand = cpu.fetch(cpu.pc + 1) | cpu.fetch(cpu.pc + 2) << 8;
+  r.cycles_high = cpu.cycles >> 32;
+  r.cycles_low = cpu.cycles;
+  head.store(slot + 1, std::memory_order_release);
+}
+
+} // namespace nes_simulator
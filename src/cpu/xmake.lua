@@ -1,3 +1,4 @@
 target("cpu")
   set_kind("static")
-  add_files("*.cpp")
\ No newline at end of file
+  add_files("*.cpp")
+  add_syslinks("pthread", {public = true})
\ No newline at end of file
@@ -0,0 +1,59 @@
+#include "frontend/frame_scheduler.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+namespace nes_simulator {
+
+frame_scheduler::frame_scheduler(double frame_rate,
+                                 clock::duration spin_window)
+    : period(std::chrono::duration_cast<clock::duration>(
+          std::chrono::duration<double>(1.0 / frame_rate))),
+      spin_window(spin_window), deadline(clock::now() + period), frames(0),
+      missed(0), lateness_mean(0), lateness_m2(0), lateness_max(0) {}
+
+void frame_scheduler::wait_for_next_frame() {
+  if (clock::now() < deadline - spin_window) {
+    std::this_thread::sleep_until(deadline - spin_window);
+  }
+  while (clock::now() < deadline) {
+    std::this_thread::yield();
+  }
+
+  const auto now = clock::now();
+  record_lateness(
+      std::chrono::duration<double, std::micro>(now - deadline).count());
+
+  deadline += period;
+  // After a stall longer than a frame, re-anchor on the current time instead
+  // of running a burst of back-to-back frames to catch up.
+  if (now >= deadline) {
+    missed += (now - deadline) / period + 1;
+    deadline = now + period;
+  }
+}
+
+void frame_scheduler::record_lateness(double lateness_us) {
+  frames++;
+  const double delta = lateness_us - lateness_mean;
+  lateness_mean += delta / frames;
+  lateness_m2 += delta * (lateness_us - lateness_mean);
+  lateness_max = std::max(lateness_max, lateness_us);
+}
+
+frame_stats frame_scheduler::stats() const {
+  return {
+      frames,
+      missed,
+      lateness_mean,
+      frames > 1 ? std::sqrt(lateness_m2 / (frames - 1)) : 0.0,
+      lateness_max,
+  };
+}
+
+void frame_scheduler::reset_stats() {
+  frames = missed = 0;
+  lateness_mean = lateness_m2 = lateness_max = 0;
+}
+
+} // namespace nes_simulator
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <chrono>
+#include <utils/types.h>
+
+namespace nes_simulator {
+
+struct frame_stats {
+  uint64 frames;
+  uint64 missed;
+  // How late wait_for_next_frame woke up relative to each deadline.
+  double mean_lateness_us;
+  double jitter_us;
+  double max_lateness_us;
+};
+
+// Paces a host loop to a fixed frame rate. Each wait sleeps until shortly
+// before the deadline and spins the rest of the way, since sleep_until alone
+// routinely oversleeps by the scheduler's granularity.
+class frame_scheduler {
+public:
+  using clock = std::chrono::steady_clock;
+
+  explicit frame_scheduler(double frame_rate,
+                           clock::duration spin_window =
+                               std::chrono::microseconds(1500));
+
+  void wait_for_next_frame();
+
+  frame_stats stats() const;
+  void reset_stats();
+
+private:
+  void record_lateness(double lateness_us);
+
+  clock::duration period;
+  clock::duration spin_window;
+  clock::time_point deadline;
+
+  uint64 frames;
+  uint64 missed;
+  double lateness_mean;
+  double lateness_m2;
+  double lateness_max;
+};
+
+} // namespace nes_simulator
@@ -0,0 +1,156 @@
+#include "frontend/movie.h"
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+namespace nes_simulator {
+
+namespace {
+
+void put_varint(std::FILE *file, uint64 value) {
+  while (value >= 0x80) {
+    std::fputc(static_cast<int>(value & 0x7f) | 0x80, file);
+    value >>= 7;
+  }
+  std::fputc(static_cast<int>(value), file);
+}
+
+// False at the end of the file, including part way through a value.
+bool get_varint(std::FILE *file, uint64 &value) {
+  value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    const int byte = std::fgetc(file);
+    if (byte == EOF) {
+      return false;
+    }
+    value |= uint64(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  throw std::runtime_error("bad movie event");
+}
+
+} // namespace
+
+movie_writer::movie_writer(const std::string &path, const movie_header &header)
+    : file(std::fopen(path.c_str(), "wb")), last_frame(0) {
+  if (!file) {
+    throw std::runtime_error("cannot create " + path);
+  }
+  movie_header out = header;
+  std::copy_n(movie_header::MAGIC, sizeof(out.magic), out.magic);
+  out.version = movie_header::VERSION;
+  if (std::fwrite(&out, sizeof(out), 1, file) != 1) {
+    std::fclose(file);
+    throw std::runtime_error("cannot write " + path);
+  }
+}
+
+movie_writer::~movie_writer() {
+  try {
+    close(last_frame + 1);
+  } catch (const std::runtime_error &) {
+  }
+}
+
+void movie_writer::write(const movie_event &event) {
+  std::fputc(static_cast<int>(event.kind), file);
+  put_varint(file, event.frame - last_frame);
+  last_frame = event.frame;
+  switch (event.kind) {
+  case movie_event::type::Key:
+    std::fputc(event.key, file);
+    break;
+  case movie_event::type::Screen:
+    for (int shift = 0; shift < 64; shift += 8) {
+      std::fputc(static_cast<int>(event.hash >> shift & 0xff), file);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+void movie_writer::close(uint64 frames) {
+  if (!file) {
+    return;
+  }
+  write({movie_event::type::End, frames, 0, 0});
+  const bool failed = std::ferror(file) != 0;
+  const bool closed = std::fclose(file) == 0;
+  file = nullptr;
+  if (failed || !closed) {
+    throw std::runtime_error("movie write failed");
+  }
+}
+
+movie_reader::movie_reader(const std::string &path)
+    : file(std::fopen(path.c_str(), "rb")), head{}, last_frame(0),
+      ended(false) {
+  if (!file) {
+    throw std::runtime_error("cannot open " + path);
+  }
+  if (std::fread(&head, sizeof(head), 1, file) != 1 ||
+      !std::equal(std::begin(head.magic), std::end(head.magic),
+                  movie_header::MAGIC)) {
+    std::fclose(file);
+    throw std::runtime_error(path + " is not a movie");
+  }
+  if (head.version != movie_header::VERSION) {
+    std::fclose(file);
+    throw std::runtime_error("unsupported movie version " +
+                             std::to_string(head.version));
+  }
+}
+
+movie_reader::~movie_reader() { std::fclose(file); }
+
+std::optional<movie_event> movie_reader::next() {
+  if (ended) {
+    return std::nullopt;
+  }
+  const int tag = std::fgetc(file);
+  uint64 delta;
+  if (tag == EOF || !get_varint(file, delta)) {
+    ended = true;
+    return std::nullopt;
+  }
+
+  movie_event event{static_cast<movie_event::type>(tag), last_frame + delta,
+                    0, 0};
+  last_frame = event.frame;
+  switch (event.kind) {
+  case movie_event::type::Key: {
+    const int key = std::fgetc(file);
+    if (key == EOF) {
+      ended = true;
+      return std::nullopt;
+    }
+    event.key = key;
+    break;
+  }
+  case movie_event::type::Screen: {
+    uint8 bytes[8];
+    if (std::fread(bytes, 1, sizeof(bytes), file) != sizeof(bytes)) {
+      ended = true;
+      return std::nullopt;
+    }
+    for (int i = 7; i >= 0; i--) {
+      event.hash = event.hash << 8 | bytes[i];
+    }
+    break;
+  }
+  case movie_event::type::RewindStart:
+  case movie_event::type::RewindStop:
+    break;
+  case movie_event::type::End:
+    ended = true;
+    break;
+  default:
+    throw std::runtime_error("bad movie event tag " + std::to_string(tag));
+  }
+  return event;
+}
+
+} // namespace nes_simulator
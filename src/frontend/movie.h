@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <utils/types.h>
+
+namespace nes_simulator {
+
+// A movie file is this header followed by a stream of events, each a tag
+// byte, the frames since the previous event as an unsigned LEB128, and the
+// tag's payload: the key byte for Key, the screen hash in little-endian for
+// Screen, nothing for the rest. Frames with nothing to record take no
+// space, so a movie grows with input and screen changes, not with time.
+//
+// The header holds everything else a frame depends on: the RNG seed, the
+// clock that sizes each frame's cycle budget, the rewind buffer's limits,
+// and the state digest of the machine it started from, so a replay of
+// another program fails up front rather than at the first frame.
+struct movie_header {
+  static constexpr char MAGIC[8] = {'N', 'E', 'S', 'M', 'O', 'V', 'I', 'E'};
+  // Version 2 feeds RANDOM before every instruction, not once a frame.
+  static constexpr uint32 VERSION = 2;
+
+  char magic[8];
+  uint32 version;
+  uint32 seed;
+  uint64 cpu_frequency;
+  uint64 start_digest;
+  uint32 rewind_frames;
+  uint32 rewind_bytes;
+};
+
+struct movie_event {
+  enum class type : uint8 {
+    // Written to the input address at the start of the frame.
+    Key,
+    // The frame steps back instead of running, this frame and on.
+    RewindStart,
+    RewindStop,
+    // The screen hash after the frame, written when it changed.
+    Screen,
+    // The movie's length, as the frame number one past the last.
+    End,
+  };
+
+  type kind;
+  uint64 frame;
+  uint8 key;
+  uint64 hash;
+};
+
+// Appends events in frame order through stdio's buffer, so a frame costs a
+// few bytes of memcpy and the file is written a block at a time.
+class movie_writer {
+public:
+  // Throws std::runtime_error if the file cannot be created.
+  movie_writer(const std::string &path, const movie_header &header);
+  ~movie_writer();
+  movie_writer(const movie_writer &) = delete;
+  movie_writer &operator=(const movie_writer &) = delete;
+
+  void write(const movie_event &event);
+
+  // Writes the End event and closes the file. Throws std::runtime_error if
+  // a write failed. The destructor does the same, ending the movie with the
+  // frame of its last event, but cannot report failure.
+  void close(uint64 frames);
+
+private:
+  std::FILE *file;
+  uint64 last_frame;
+};
+
+class movie_reader {
+public:
+  // Throws std::runtime_error if the file cannot be opened or does not
+  // start with a movie header of this version.
+  explicit movie_reader(const std::string &path);
+  ~movie_reader();
+  movie_reader(const movie_reader &) = delete;
+  movie_reader &operator=(const movie_reader &) = delete;
+
+  const movie_header &header() const { return head; }
+
+  // The next event, or nothing after End. A movie cut short, by a crash
+  // while recording, ends after its last whole event. Throws
+  // std::runtime_error on an unknown tag.
+  std::optional<movie_event> next();
+
+private:
+  std::FILE *file;
+  movie_header head;
+  uint64 last_frame;
+  bool ended;
+};
+
+} // namespace nes_simulator
@@ -0,0 +1,330 @@
+#include "frontend/palette.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NES_PALETTE_X86 1
+#include <immintrin.h>
+#endif
+
+namespace nes_simulator {
+
+palette::palette() : colors(), nibble(true) {}
+
+palette::palette(std::span<const uint32> colors) : colors(), nibble(true) {
+  for (std::size_t i = 0; i < this->colors.size(); i++) {
+    this->colors[i] = colors.empty() ? 0 : colors[i % colors.size()];
+  }
+  for (std::size_t i = 0; i < this->colors.size(); i++) {
+    nibble = nibble && this->colors[i] == this->colors[i & 0xF];
+  }
+}
+
+namespace {
+
+// Every kernel handles a prefix of whole blocks and returns how many pixels it
+// converted; the scalar loop finishes the tail. Blocks are 8, 16 or 32 pixels
+// starting at a multiple of their size, so their mask bits never straddle a
+// 64-bit word.
+void set_mask_bits(uint64 *change_mask, std::size_t pos, uint64 bits) {
+  if (change_mask != nullptr) {
+    change_mask[pos / 64] |= bits << (pos % 64);
+  }
+}
+
+bool rgba32_scalar(const uint8 *src, uint32 *dst, std::size_t begin,
+                   std::size_t count, const palette &pal,
+                   uint64 *change_mask) {
+  bool changed = false;
+  for (std::size_t i = begin; i < count; i++) {
+    const uint32 color = pal[src[i]];
+    if (dst[i] != color) {
+      dst[i] = color;
+      set_mask_bits(change_mask, i, 1);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+bool rgb24_scalar(const uint8 *src, uint8 *dst, std::size_t begin,
+                  std::size_t count, const palette &pal, uint64 *change_mask) {
+  bool changed = false;
+  for (std::size_t i = begin; i < count; i++) {
+    const uint32 color = pal[src[i]];
+    uint8 *pixel = dst + i * 3;
+    const uint8 r = color, g = color >> 8, b = color >> 16;
+    if (pixel[0] != r || pixel[1] != g || pixel[2] != b) {
+      pixel[0] = r;
+      pixel[1] = g;
+      pixel[2] = b;
+      set_mask_bits(change_mask, i, 1);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+#ifdef NES_PALETTE_X86
+
+// The 16 colors of a nibble-indexed palette split into one byte table per
+// channel, ready for pshufb.
+struct channel_tables {
+  alignas(16) uint8 bytes[4][16];
+
+  explicit channel_tables(const palette &pal) {
+    for (int i = 0; i < 16; i++) {
+      for (int channel = 0; channel < 4; channel++) {
+        bytes[channel][i] = pal[i] >> (channel * 8);
+      }
+    }
+  }
+};
+
+__attribute__((target("ssse3"))) std::size_t
+rgba32_ssse3(const uint8 *src, uint32 *dst, std::size_t count,
+             const palette &pal, uint64 *change_mask, bool &changed) {
+  const channel_tables tables(pal);
+  const __m128i r_table = _mm_load_si128((const __m128i *)tables.bytes[0]);
+  const __m128i g_table = _mm_load_si128((const __m128i *)tables.bytes[1]);
+  const __m128i b_table = _mm_load_si128((const __m128i *)tables.bytes[2]);
+  const __m128i a_table = _mm_load_si128((const __m128i *)tables.bytes[3]);
+  const __m128i low_nibble = _mm_set1_epi8(0x0F);
+
+  std::size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m128i index = _mm_and_si128(
+        _mm_loadu_si128((const __m128i *)(src + i)), low_nibble);
+    const __m128i r = _mm_shuffle_epi8(r_table, index);
+    const __m128i g = _mm_shuffle_epi8(g_table, index);
+    const __m128i b = _mm_shuffle_epi8(b_table, index);
+    const __m128i a = _mm_shuffle_epi8(a_table, index);
+
+    const __m128i rg_lo = _mm_unpacklo_epi8(r, g);
+    const __m128i rg_hi = _mm_unpackhi_epi8(r, g);
+    const __m128i ba_lo = _mm_unpacklo_epi8(b, a);
+    const __m128i ba_hi = _mm_unpackhi_epi8(b, a);
+    const __m128i pixels[4] = {
+        _mm_unpacklo_epi16(rg_lo, ba_lo),
+        _mm_unpackhi_epi16(rg_lo, ba_lo),
+        _mm_unpacklo_epi16(rg_hi, ba_hi),
+        _mm_unpackhi_epi16(rg_hi, ba_hi),
+    };
+
+    uint64 bits = 0;
+    for (int k = 0; k < 4; k++) {
+      __m128i *out = (__m128i *)(dst + i + k * 4);
+      const __m128i same = _mm_cmpeq_epi32(_mm_loadu_si128(out), pixels[k]);
+      bits |= uint64(~_mm_movemask_ps(_mm_castsi128_ps(same)) & 0xF) << k * 4;
+      _mm_storeu_si128(out, pixels[k]);
+    }
+    if (bits != 0) {
+      set_mask_bits(change_mask, i, bits);
+      changed = true;
+    }
+  }
+  return i;
+}
+
+// pshufb masks that interleave 16 R, G and B bytes into 48 RGB24 bytes:
+// masks[v][channel] builds output vector v from that channel's vector.
+struct rgb24_interleave_masks {
+  alignas(16) int8 masks[3][3][16];
+
+  rgb24_interleave_masks() {
+    for (int v = 0; v < 3; v++) {
+      for (int k = 0; k < 16; k++) {
+        const int byte = v * 16 + k;
+        for (int channel = 0; channel < 3; channel++) {
+          masks[v][channel][k] = byte % 3 == channel ? byte / 3 : -1;
+        }
+      }
+    }
+  }
+};
+
+__attribute__((target("ssse3"))) std::size_t
+rgb24_ssse3(const uint8 *src, uint8 *dst, std::size_t count,
+            const palette &pal, uint64 *change_mask, bool &changed) {
+  static const rgb24_interleave_masks interleave;
+  const channel_tables tables(pal);
+  __m128i channel_tables[3];
+  __m128i masks[3][3];
+  for (int channel = 0; channel < 3; channel++) {
+    channel_tables[channel] =
+        _mm_load_si128((const __m128i *)tables.bytes[channel]);
+    for (int v = 0; v < 3; v++) {
+      masks[v][channel] =
+          _mm_load_si128((const __m128i *)interleave.masks[v][channel]);
+    }
+  }
+  const __m128i low_nibble = _mm_set1_epi8(0x0F);
+
+  std::size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m128i index = _mm_and_si128(
+        _mm_loadu_si128((const __m128i *)(src + i)), low_nibble);
+    __m128i channels[3];
+    for (int channel = 0; channel < 3; channel++) {
+      channels[channel] = _mm_shuffle_epi8(channel_tables[channel], index);
+    }
+
+    uint64 differing_bytes = 0;
+    for (int v = 0; v < 3; v++) {
+      const __m128i out = _mm_or_si128(
+          _mm_or_si128(_mm_shuffle_epi8(channels[0], masks[v][0]),
+                       _mm_shuffle_epi8(channels[1], masks[v][1])),
+          _mm_shuffle_epi8(channels[2], masks[v][2]));
+      __m128i *target = (__m128i *)(dst + i * 3 + v * 16);
+      const __m128i same = _mm_cmpeq_epi8(_mm_loadu_si128(target), out);
+      differing_bytes |= uint64(~_mm_movemask_epi8(same) & 0xFFFF) << v * 16;
+      _mm_storeu_si128(target, out);
+    }
+
+    if (differing_bytes != 0) {
+      uint64 bits = 0;
+      for (int pixel = 0; pixel < 16; pixel++) {
+        bits |= uint64((differing_bytes >> pixel * 3 & 7) != 0) << pixel;
+      }
+      set_mask_bits(change_mask, i, bits);
+      changed = true;
+    }
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) std::size_t
+rgba32_avx2_nibble(const uint8 *src, uint32 *dst, std::size_t count,
+                   const palette &pal, uint64 *change_mask, bool &changed) {
+  const channel_tables tables(pal);
+  __m256i channel_tables[4];
+  for (int channel = 0; channel < 4; channel++) {
+    channel_tables[channel] = _mm256_broadcastsi128_si256(
+        _mm_load_si128((const __m128i *)tables.bytes[channel]));
+  }
+  const __m256i low_nibble = _mm256_set1_epi8(0x0F);
+
+  std::size_t i = 0;
+  for (; i + 32 <= count; i += 32) {
+    const __m256i index = _mm256_and_si256(
+        _mm256_loadu_si256((const __m256i *)(src + i)), low_nibble);
+    const __m256i r = _mm256_shuffle_epi8(channel_tables[0], index);
+    const __m256i g = _mm256_shuffle_epi8(channel_tables[1], index);
+    const __m256i b = _mm256_shuffle_epi8(channel_tables[2], index);
+    const __m256i a = _mm256_shuffle_epi8(channel_tables[3], index);
+
+    // Unpacks work within 128-bit lanes, so q0..q3 hold pixels
+    // {0-3, 16-19}, {4-7, 20-23}, {8-11, 24-27} and {12-15, 28-31}.
+    const __m256i rg_lo = _mm256_unpacklo_epi8(r, g);
+    const __m256i rg_hi = _mm256_unpackhi_epi8(r, g);
+    const __m256i ba_lo = _mm256_unpacklo_epi8(b, a);
+    const __m256i ba_hi = _mm256_unpackhi_epi8(b, a);
+    const __m256i q0 = _mm256_unpacklo_epi16(rg_lo, ba_lo);
+    const __m256i q1 = _mm256_unpackhi_epi16(rg_lo, ba_lo);
+    const __m256i q2 = _mm256_unpacklo_epi16(rg_hi, ba_hi);
+    const __m256i q3 = _mm256_unpackhi_epi16(rg_hi, ba_hi);
+    const __m256i pixels[4] = {
+        _mm256_permute2x128_si256(q0, q1, 0x20),
+        _mm256_permute2x128_si256(q2, q3, 0x20),
+        _mm256_permute2x128_si256(q0, q1, 0x31),
+        _mm256_permute2x128_si256(q2, q3, 0x31),
+    };
+
+    uint64 bits = 0;
+    for (int k = 0; k < 4; k++) {
+      __m256i *out = (__m256i *)(dst + i + k * 8);
+      const __m256i same =
+          _mm256_cmpeq_epi32(_mm256_loadu_si256(out), pixels[k]);
+      bits |= uint64(~_mm256_movemask_ps(_mm256_castsi256_ps(same)) & 0xFF)
+              << k * 8;
+      _mm256_storeu_si256(out, pixels[k]);
+    }
+    if (bits != 0) {
+      set_mask_bits(change_mask, i, bits);
+      changed = true;
+    }
+  }
+  return i;
+}
+
+__attribute__((target("avx2"))) std::size_t
+rgba32_avx2_gather(const uint8 *src, uint32 *dst, std::size_t count,
+                   const palette &pal, uint64 *change_mask, bool &changed) {
+  const int *colors = reinterpret_cast<const int *>(pal.data());
+
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256i index =
+        _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+    const __m256i pixels = _mm256_i32gather_epi32(colors, index, 4);
+
+    __m256i *out = (__m256i *)(dst + i);
+    const __m256i same = _mm256_cmpeq_epi32(_mm256_loadu_si256(out), pixels);
+    const uint64 bits =
+        ~_mm256_movemask_ps(_mm256_castsi256_ps(same)) & 0xFF;
+    _mm256_storeu_si256(out, pixels);
+    if (bits != 0) {
+      set_mask_bits(change_mask, i, bits);
+      changed = true;
+    }
+  }
+  return i;
+}
+
+#endif
+
+void clear_mask(uint64 *change_mask, std::size_t count) {
+  if (change_mask != nullptr) {
+    memset(change_mask, 0, (count + 63) / 64 * sizeof(uint64));
+  }
+}
+
+} // namespace
+
+palette_isa host_palette_isa() {
+#ifdef NES_PALETTE_X86
+  static const palette_isa detected =
+      __builtin_cpu_supports("avx2")    ? palette_isa::Avx2
+      : __builtin_cpu_supports("ssse3") ? palette_isa::Ssse3
+                                        : palette_isa::Scalar;
+  return detected;
+#else
+  return palette_isa::Scalar;
+#endif
+}
+
+bool expand_palette_rgba32(const uint8 *src, uint32 *dst, std::size_t count,
+                           const palette &pal, uint64 *change_mask,
+                           palette_isa isa) {
+  clear_mask(change_mask, count);
+  bool changed = false;
+  std::size_t done = 0;
+#ifdef NES_PALETTE_X86
+  isa = std::min(isa, host_palette_isa());
+  if (isa == palette_isa::Avx2) {
+    done = pal.nibble_indexed()
+               ? rgba32_avx2_nibble(src, dst, count, pal, change_mask, changed)
+               : rgba32_avx2_gather(src, dst, count, pal, change_mask, changed);
+  } else if (isa == palette_isa::Ssse3 && pal.nibble_indexed()) {
+    done = rgba32_ssse3(src, dst, count, pal, change_mask, changed);
+  }
+#endif
+  return rgba32_scalar(src, dst, done, count, pal, change_mask) || changed;
+}
+
+bool expand_palette_rgb24(const uint8 *src, uint8 *dst, std::size_t count,
+                          const palette &pal, uint64 *change_mask,
+                          palette_isa isa) {
+  clear_mask(change_mask, count);
+  bool changed = false;
+  std::size_t done = 0;
+#ifdef NES_PALETTE_X86
+  isa = std::min(isa, host_palette_isa());
+  if (isa >= palette_isa::Ssse3 && pal.nibble_indexed()) {
+    done = rgb24_ssse3(src, dst, count, pal, change_mask, changed);
+  }
+#endif
+  return rgb24_scalar(src, dst, done, count, pal, change_mask) || changed;
+}
+
+} // namespace nes_simulator
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <span>
+#include <utils/types.h>
+
+namespace nes_simulator {
+
+// Colors are RGBA32 values whose bytes are R, G, B, A in memory order
+// (SDL_PIXELFORMAT_RGBA32).
+constexpr uint32 rgba(uint8 r, uint8 g, uint8 b, uint8 a = 0xFF) {
+  return r | g << 8 | b << 16 | static_cast<uint32>(a) << 24;
+}
+
+class palette {
+public:
+  palette();
+  // A palette of n colors maps index i to colors[i % n].
+  explicit palette(std::span<const uint32> colors);
+
+  uint32 operator[](uint8 index) const { return colors[index]; }
+  const uint32 *data() const { return colors.data(); }
+
+  // True when index i and i & 0xF share a color, which lets the SIMD kernels
+  // look colors up with in-register byte shuffles instead of gathers.
+  bool nibble_indexed() const { return nibble; }
+
+private:
+  std::array<uint32, 0x100> colors;
+  bool nibble;
+};
+
+// The instruction sets the expansion kernels can use, in rising order.
+enum class palette_isa { Scalar, Ssse3, Avx2 };
+
+// The best the host supports, which expansion uses by default.
+palette_isa host_palette_isa();
+
+// Expand `count` palette indices into pixels, overwriting `dst`. When
+// `change_mask` is non-null it receives one bit per pixel (bit i of word
+// i / 64), set where the new pixel differs from what `dst` held; it must hold
+// (count + 63) / 64 words. Returns whether any pixel changed.
+//
+// `isa` caps the kernels used, so that tests and benchmarks can compare
+// them; a cap above what the host supports is lowered to it.
+bool expand_palette_rgba32(const uint8 *src, uint32 *dst, std::size_t count,
+                           const palette &pal, uint64 *change_mask = nullptr,
+                           palette_isa isa = host_palette_isa());
+bool expand_palette_rgb24(const uint8 *src, uint8 *dst, std::size_t count,
+                          const palette &pal, uint64 *change_mask = nullptr,
+                          palette_isa isa = host_palette_isa());
+
+} // namespace nes_simulator
@@ -0,0 +1,77 @@
+#include "frontend/snake_session.h"
+#include "utils/hash.h"
+#include "utils/random.h"
+
+namespace nes_simulator {
+
+void add_random_feed(nes_simulator::cpu &cpu, uint32 seed) {
+  // Interval hooks run after the instructions they count, so the first
+  // byte goes in now.
+  pcg32 random(seed);
+  cpu.mem_write(snake::RANDOM, snake::random_byte(random()));
+  cpu.add_interval_hook(1, [random](nes_simulator::cpu &c) mutable {
+    c.mem_write(snake::RANDOM, snake::random_byte(random()));
+  });
+}
+
+snake_session::snake_session(nes_simulator::cpu &cpu, uint64 cpu_frequency,
+                             uint32 seed, uint32 rewind_frames,
+                             uint32 rewind_bytes)
+    : cpu(cpu), cpu_frequency(cpu_frequency),
+      cycles_per_frame(cpu_frequency / NTSC_FRAME_RATE), cycle_credit(0),
+      seed(seed), start_digest(cpu.state_digest()),
+      rewind_frames(rewind_frames), rewind_bytes(rewind_bytes),
+      rewind(rewind_frames, rewind_bytes), rewinding(false), frame(0),
+      recording(nullptr), hash_recorded(false), recorded_hash(0) {
+  add_random_feed(cpu, seed);
+}
+
+movie_header snake_session::header() const {
+  movie_header header{};
+  header.seed = seed;
+  header.cpu_frequency = cpu_frequency;
+  header.start_digest = start_digest;
+  header.rewind_frames = rewind_frames;
+  header.rewind_bytes = rewind_bytes;
+  return header;
+}
+
+void snake_session::record_to(movie_writer *movie) {
+  recording = movie;
+  hash_recorded = false;
+}
+
+void snake_session::press(uint8 key) {
+  cpu.mem_write(snake::INPUT, key);
+  if (recording) {
+    recording->write({movie_event::type::Key, frame, key, 0});
+  }
+}
+
+void snake_session::set_rewinding(bool on) {
+  if (on == rewinding) {
+    return;
+  }
+  rewinding = on;
+  if (recording) {
+    recording->write({on ? movie_event::type::RewindStart
+                         : movie_event::type::RewindStop,
+                      frame, 0, 0});
+  }
+}
+
+uint64 snake_session::screen_hash() const {
+  return fnv1a(&cpu.memory[snake::SCREEN_BEGIN],
+               snake::SCREEN_END - snake::SCREEN_BEGIN);
+}
+
+void snake_session::end_frame(uint64 hash) {
+  if (recording && (!hash_recorded || hash != recorded_hash)) {
+    recording->write({movie_event::type::Screen, frame, 0, hash});
+    hash_recorded = true;
+    recorded_hash = hash;
+  }
+  frame++;
+}
+
+} // namespace nes_simulator
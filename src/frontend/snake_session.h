@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cpu/cpu.h>
+#include <cpu/rewind.h>
+#include <frontend/movie.h>
+#include <programs/snake.h>
+#include <utils/types.h>
+
+namespace nes_simulator {
+
+// Writes a fresh byte from a pcg32 seeded with `seed` to RANDOM before every
+// instruction the cpu runs from here on. The game reads RANDOM twice in a
+// row to place the apple, so a byte written once a frame would give both
+// coordinates from the same draw. The hook owns its generator.
+void add_random_feed(nes_simulator::cpu &cpu, uint32 seed);
+
+// The snake game as the SDL front end plays it, one frame at a time: the
+// key pressed, RANDOM fed from a seeded pcg32 (add_random_feed), the
+// frame's share of the cycle clock, and a rewind buffer to step back
+// through. Everything a
+// frame does follows from the header fields and the presses and rewinds, so
+// a session that records into a movie and one replaying it run the same
+// instructions.
+class snake_session {
+public:
+  // The cpu must have the snake program loaded and reset; the session adds
+  // its random feed to the cpu's interval hooks. The default
+  // rewind limits keep ten seconds of frames; the game dirties a few pages
+  // per frame, so 4 MB is far more than that needs.
+  snake_session(nes_simulator::cpu &cpu, uint64 cpu_frequency, uint32 seed,
+                uint32 rewind_frames = 10 * 60,
+                uint32 rewind_bytes = 4 << 20);
+
+  // The header a movie of this session starts with.
+  movie_header header() const;
+
+  // Records every press, rewind and screen change from here on, into a
+  // movie started with header(); nullptr stops recording.
+  void record_to(movie_writer *movie);
+
+  void press(uint8 key);
+  void set_rewinding(bool on);
+
+  // Runs one frame, or steps back one while rewinding, and returns the
+  // screen hash after it. `run(cpu, budget)` runs the frame's budget and
+  // returns the cycles spent.
+  template <class Run> uint64 run_frame(Run &&run);
+  uint64 run_frame() {
+    return run_frame([](nes_simulator::cpu &c, uint64 budget) {
+      return c.run_frame(budget);
+    });
+  }
+
+  uint64 frames() const { return frame; }
+  uint64 screen_hash() const;
+
+private:
+  void end_frame(uint64 hash);
+
+  nes_simulator::cpu &cpu;
+  uint64 cpu_frequency;
+  double cycles_per_frame;
+  double cycle_credit;
+  uint32 seed;
+  uint64 start_digest;
+  uint32 rewind_frames;
+  uint32 rewind_bytes;
+  rewind_buffer rewind;
+  bool rewinding;
+
+  uint64 frame;
+  movie_writer *recording;
+  bool hash_recorded;
+  uint64 recorded_hash;
+};
+
+// Cycles overshot by the last instruction of a frame are paid back from the
+// next frame's budget. Frames after the game halts run nothing.
+template <class Run> uint64 snake_session::run_frame(Run &&run) {
+  if (rewinding) {
+    rewind.step_back(cpu);
+  } else if (!cpu.halted) {
+    cycle_credit += cycles_per_frame;
+    if (cycle_credit > 0) {
+      cycle_credit -= run(cpu, static_cast<uint64>(cycle_credit));
+    }
+    rewind.record(cpu);
+  }
+  const uint64 hash = screen_hash();
+  end_frame(hash);
+  return hash;
+}
+
+} // namespace nes_simulator
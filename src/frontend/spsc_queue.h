@@ -0,0 +1,58 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <optional>
+
+namespace nes_simulator {
+
+// A bounded queue between one producer thread and one consumer thread. push
+// and pop are wait-free: a few loads and one release store, with no retry
+// loop, so neither side can hold the other up. Each side keeps its last look
+// at the other's index and only reads the other's cache line again when the
+// queue looks full (or empty) by that.
+template <class T, std::size_t Capacity> class spsc_queue {
+  static_assert(std::has_single_bit(Capacity),
+                "capacity must be a power of two");
+
+public:
+  // False, leaving the queue as it was, if it is full.
+  bool push(const T &item) {
+    const std::size_t h = head.load(std::memory_order_relaxed);
+    if (h - tail_seen == Capacity) {
+      tail_seen = tail.load(std::memory_order_acquire);
+      if (h - tail_seen == Capacity) {
+        return false;
+      }
+    }
+    slots[h % Capacity] = item;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  std::optional<T> pop() {
+    const std::size_t t = tail.load(std::memory_order_relaxed);
+    if (t == head_seen) {
+      head_seen = head.load(std::memory_order_acquire);
+      if (t == head_seen) {
+        return std::nullopt;
+      }
+    }
+    T item = slots[t % Capacity];
+    tail.store(t + 1, std::memory_order_release);
+    return item;
+  }
+
+private:
+  // Written by the producer.
+  alignas(64) std::atomic<std::size_t> head{0};
+  std::size_t tail_seen = 0;
+  // Written by the consumer.
+  alignas(64) std::atomic<std::size_t> tail{0};
+  std::size_t head_seen = 0;
+  alignas(64) std::array<T, Capacity> slots{};
+};
+
+} // namespace nes_simulator
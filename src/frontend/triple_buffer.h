@@ -0,0 +1,56 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <utils/types.h>
+
+namespace nes_simulator {
+
+// Hands the newest complete value from one producer thread to one consumer
+// thread without either ever waiting on the other. Of the three slots, the
+// producer owns one to write into, the consumer owns one to read from, and
+// the third holds the latest published value. Publishing and acquiring each
+// swap an owned slot with the middle one in a single atomic exchange, so the
+// producer can run ahead, overwriting values that were never read, and the
+// consumer can read the same value again when nothing new has come.
+template <class T> class triple_buffer {
+public:
+  // The slot to fill before the next publish. Its old contents are whatever
+  // was published some time ago, not necessarily the last value.
+  T &write_slot() { return slots[writing]; }
+
+  // Makes the write slot the newest value. False if that replaced a value
+  // the consumer never acquired.
+  bool publish() {
+    const uint8 previous =
+        middle.exchange(writing | FRESH, std::memory_order_acq_rel);
+    writing = previous & INDEX;
+    return !(previous & FRESH);
+  }
+
+  // Takes the newest value, if one was published since the last call. False
+  // leaves read_slot() as it was.
+  bool acquire() {
+    if (!(middle.load(std::memory_order_relaxed) & FRESH)) {
+      return false;
+    }
+    reading = middle.exchange(reading, std::memory_order_acq_rel) & INDEX;
+    return true;
+  }
+
+  const T &read_slot() const { return slots[reading]; }
+
+private:
+  static constexpr uint8 INDEX = 0x03;
+  static constexpr uint8 FRESH = 0x04;
+
+  std::array<T, 3> slots{};
+  // Touched by the producer only.
+  alignas(64) uint8 writing = 0;
+  // The middle slot's index, with FRESH set until the consumer takes it.
+  alignas(64) std::atomic<uint8> middle{1};
+  // Touched by the consumer only.
+  alignas(64) uint8 reading = 2;
+};
+
+} // namespace nes_simulator
@@ -0,0 +1,4 @@
+target("frontend")
+  set_kind("static")
+  add_files("*.cpp")
+  add_deps("cpu")
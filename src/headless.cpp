@@ -0,0 +1,569 @@
+#include "cartridge/cartridge.h"
+#include "cpu/cpu.h"
+#include "cpu/interpreter.h"
+#include "cpu/profiler.h"
+#include "cpu/trace.h"
+#include "frontend/movie.h"
+#include "frontend/snake_session.h"
+#include "programs/snake.h"
+#include "runner/batch_runner.h"
+#include "utils/hash.h"
+#include "utils/random.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utils/types.h>
+#include <vector>
+
+// Runs a program with the snake memory map and no window, as fast as the host
+// allows. Frames are defined by the same emulated clock the SDL front end
+// uses; after every frame the screen bytes are hashed, and a digest of the
+// whole machine is printed at the end:
+//
+//   frame <n> <screen hash>
+//   digest <state digest> frames <n> instructions <n> cycles <n>
+//
+// An input script holds "<frame> <key>" lines (key: w/a/s/d or a byte value);
+// each key is written to the input address at the start of that frame. The
+// random address gets a fresh byte from a pcg32 seeded with --seed before
+// every instruction, as in the SDL front end (see add_random_feed).
+//
+// With --rom, an NROM cartridge runs on the NES memory map instead, with
+// nothing behind the PPU and APU registers; frames then hash the 2 KB of
+// internal RAM, and no input or randomness is injected.
+//
+// With --sessions N, N independent machines run the same program on a
+// thread pool (--threads, default one per core), each for the cycles of
+// --frames frames. Session i draws its randomness from seed + i, written
+// every 100 instructions rather than before each one, and takes no input
+// script:
+//
+//   session <i> <state digest> instructions <n> cycles <n>
+//
+// --engine picks the cpu engine (switch, threaded, cached or jit; threaded by
+// default). With --check ENGINE, a second machine runs the same frames and
+// inputs on another engine, and the run fails at the first frame after which
+// the two machines differ. --check switch compares against the switch loop,
+// the reference every other engine must match:
+//
+//   check frame <n> <engine> <registers> <check engine> <registers>
+//
+// --trace FILE records every instruction the machine runs into a binary
+// trace (see cpu/trace.h), which tracelog prints in the nestest log format.
+// --profile FILE writes the machine's guest call stacks in folded form for
+// flamegraph.pl (see cpu/profiler.h) and lists its hottest loops on stderr.
+//
+// --replay MOVIE plays back a movie recorded by the SDL front end (main
+// --record=MOVIE), taking the seed and clock from the movie instead of the
+// options, and fails at the first frame whose screen hash differs from the
+// recording:
+//
+//   replay frame <n> screen <hash> expected <hash>
+
+namespace snake = nes_simulator::snake;
+
+namespace {
+
+struct options {
+  std::string program;
+  std::string rom;
+  std::string input;
+  nes_simulator::uint64 frames = 600;
+  nes_simulator::uint64 instructions = 0;
+  nes_simulator::uint64 cpu_frequency = 16000;
+  nes_simulator::uint32 seed = 1;
+  nes_simulator::uint32 sessions = 0;
+  nes_simulator::uint32 threads = 0;
+  nes_simulator::Engine engine = nes_simulator::Engine::Threaded;
+  std::optional<nes_simulator::Engine> check;
+  std::string trace;
+  std::string profile;
+  std::string replay;
+  bool frame_hashes = true;
+};
+
+// The program every machine starts from: a cartridge, or code loaded at
+// $0600. A cartridge is mapped once and shared by all sessions.
+struct program_source {
+  std::unique_ptr<nes_simulator::cartridge> cartridge;
+  std::vector<nes_simulator::uint8> code;
+
+  void setup(nes_simulator::cpu &cpu) const {
+    if (cartridge) {
+      cpu.bus.map_ram(0x0000, 0x2000, 0x800);
+      cpu.bus.unmap(0x2000, 0x6000);
+      cartridge->map(cpu);
+    } else {
+      cpu.load(code.data(), code.size());
+    }
+    cpu.reset();
+  }
+};
+
+void usage() {
+  std::cerr << "usage: headless [--program FILE | --rom FILE] [--frames N] "
+               "[--instructions N] [--input SCRIPT] [--seed N] "
+               "[--cpu-hz N] [--no-frame-hashes] [--sessions N] "
+               "[--threads N] [--engine NAME] [--check NAME] [--trace FILE] "
+               "[--profile FILE] [--replay MOVIE]"
+            << std::endl;
+}
+
+std::vector<nes_simulator::uint8> read_file(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("cannot open " + path);
+  }
+  return {std::istreambuf_iterator<char>(file),
+          std::istreambuf_iterator<char>()};
+}
+
+std::map<nes_simulator::uint64, nes_simulator::uint8>
+read_input_script(const std::string &path) {
+  std::ifstream file(path);
+  if (!file) {
+    throw std::runtime_error("cannot open " + path);
+  }
+
+  std::map<nes_simulator::uint64, nes_simulator::uint8> script;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream fields(line);
+    nes_simulator::uint64 frame;
+    std::string key;
+    if (!(fields >> frame >> key)) {
+      throw std::runtime_error("bad input script line: " + line);
+    }
+
+    if (key == "w") {
+      script[frame] = snake::KEY_UP;
+    } else if (key == "s") {
+      script[frame] = snake::KEY_DOWN;
+    } else if (key == "a") {
+      script[frame] = snake::KEY_LEFT;
+    } else if (key == "d") {
+      script[frame] = snake::KEY_RIGHT;
+    } else {
+      script[frame] = std::stoul(key, nullptr, 0);
+    }
+  }
+  return script;
+}
+
+options parse_options(int argc, char *argv[]) {
+  options opts;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    auto value = [&]() -> std::string {
+      if (i + 1 >= argc) {
+        throw std::runtime_error(arg + " needs a value");
+      }
+      return argv[++i];
+    };
+
+    if (arg == "--program") {
+      opts.program = value();
+    } else if (arg == "--rom") {
+      opts.rom = value();
+    } else if (arg == "--input") {
+      opts.input = value();
+    } else if (arg == "--frames") {
+      opts.frames = std::stoull(value());
+    } else if (arg == "--instructions") {
+      opts.instructions = std::stoull(value());
+    } else if (arg == "--seed") {
+      opts.seed = std::stoul(value());
+    } else if (arg == "--cpu-hz") {
+      opts.cpu_frequency = std::stoull(value());
+    } else if (arg == "--sessions") {
+      opts.sessions = std::stoul(value());
+    } else if (arg == "--threads") {
+      opts.threads = std::stoul(value());
+    } else if (arg == "--engine") {
+      opts.engine = nes_simulator::parse_engine(value());
+    } else if (arg == "--check") {
+      opts.check = nes_simulator::parse_engine(value());
+    } else if (arg == "--trace") {
+      opts.trace = value();
+    } else if (arg == "--profile") {
+      opts.profile = value();
+    } else if (arg == "--replay") {
+      opts.replay = value();
+    } else if (arg == "--no-frame-hashes") {
+      opts.frame_hashes = false;
+    } else {
+      usage();
+      throw std::runtime_error("unknown option " + arg);
+    }
+  }
+  if (opts.sessions && !opts.input.empty()) {
+    throw std::runtime_error("--input does not apply to --sessions");
+  }
+  if (opts.sessions && opts.check) {
+    throw std::runtime_error("--check does not apply to --sessions");
+  }
+  if (opts.sessions && (!opts.trace.empty() || !opts.profile.empty())) {
+    throw std::runtime_error(
+        "--trace and --profile do not apply to --sessions");
+  }
+  if (!opts.replay.empty() &&
+      (opts.sessions || opts.check || !opts.input.empty() ||
+       !opts.rom.empty())) {
+    throw std::runtime_error(
+        "--replay does not take --sessions, --check, --input or --rom");
+  }
+  return opts;
+}
+
+program_source open_program(const options &opts) {
+  program_source source;
+  if (!opts.rom.empty()) {
+    source.cartridge = std::make_unique<nes_simulator::cartridge>(opts.rom);
+  } else if (opts.program.empty()) {
+    source.code.assign(std::begin(snake::game_code),
+                       std::end(snake::game_code));
+  } else {
+    source.code = read_file(opts.program);
+  }
+  return source;
+}
+
+// What watches every instruction a machine runs. The trace is compiled into
+// the run (debug_policy, recording into the writer the machine was given
+// with trace_to); the profiler wraps the run's predicate.
+struct observers {
+  nes_simulator::trace_writer *trace = nullptr;
+  nes_simulator::profiler *profile = nullptr;
+};
+
+template <class Predicate>
+void run_observed(nes_simulator::cpu &cpu, Predicate done,
+                  const observers &watch) {
+  if (watch.profile) {
+    auto profiled = watch.profile->profiled(done);
+    if (watch.trace) {
+      cpu.run_until<nes_simulator::debug_policy>(profiled);
+    } else {
+      cpu.run_until(profiled);
+    }
+    watch.profile->settle(cpu);
+  } else if (watch.trace) {
+    cpu.run_until<nes_simulator::debug_policy>(done);
+  } else {
+    cpu.run_until(done);
+  }
+}
+
+// Runs whole instructions for `budget` cycles, or up to the instruction
+// limit, and returns the cycles spent. Without a limit or a profile this is
+// run_cycles, the entry point the Jit engine runs native code under when
+// nothing is traced.
+nes_simulator::uint64 run_budget(nes_simulator::cpu &cpu,
+                                 nes_simulator::uint64 budget,
+                                 nes_simulator::uint64 instruction_limit,
+                                 const observers &watch) {
+  if (instruction_limit == ~nes_simulator::uint64{0} && !watch.profile) {
+    return watch.trace ? cpu.run_cycles<nes_simulator::debug_policy>(budget)
+                       : cpu.run_cycles(budget);
+  }
+  // The instruction limit is counted down here, so it holds exactly on every
+  // engine whatever wraps the predicate.
+  const auto target = cpu.cycles + budget;
+  const auto before = cpu.cycles;
+  auto left = instruction_limit - cpu.instructions;
+  run_observed(
+      cpu,
+      [&](const nes_simulator::cpu &c) {
+        if (c.cycles >= target || left == 0) {
+          return true;
+        }
+        left--;
+        return false;
+      },
+      watch);
+  return cpu.cycles - before;
+}
+
+std::string describe(const nes_simulator::cpu &cpu) {
+  char text[160];
+  std::snprintf(text, sizeof(text),
+                "pc=%04x a=%02x x=%02x y=%02x sp=%02x p=%02x "
+                "instructions=%llu cycles=%llu digest=%016llx",
+                cpu.pc, cpu.reg_a, cpu.reg_x, cpu.reg_y, cpu.sp, cpu.status,
+                (unsigned long long)cpu.instructions,
+                (unsigned long long)cpu.cycles,
+                (unsigned long long)cpu.state_digest());
+  return text;
+}
+
+// Closes the trace and writes the profile once the run is over.
+void finish(const options &opts, const observers &watch) {
+  if (watch.trace) {
+    watch.trace->close();
+  }
+  if (watch.profile) {
+    std::ofstream folded(opts.profile);
+    watch.profile->write_folded(folded);
+    if (!folded.flush()) {
+      throw std::runtime_error("cannot write " + opts.profile);
+    }
+    watch.profile->write_hot_loops(std::cerr, 10);
+  }
+}
+
+// Replays the whole movie. Presses and rewinds are applied at the start of
+// their frame and screen hashes checked at its end, the order snake_session
+// records them in.
+int run_replay(const options &opts, const program_source &source,
+               const observers &watch) {
+  nes_simulator::movie_reader movie(opts.replay);
+  const auto &header = movie.header();
+  auto cpu = std::make_unique<nes_simulator::cpu>();
+  cpu->engine = opts.engine;
+  cpu->trace_to(watch.trace);
+  source.setup(*cpu);
+  if (cpu->state_digest() != header.start_digest) {
+    throw std::runtime_error(opts.replay +
+                             " was recorded from another program");
+  }
+  nes_simulator::snake_session session(*cpu, header.cpu_frequency,
+                                       header.seed, header.rewind_frames,
+                                       header.rewind_bytes);
+  const auto run = [&](nes_simulator::cpu &c, nes_simulator::uint64 budget) {
+    return run_budget(c, budget, ~nes_simulator::uint64{0}, watch);
+  };
+
+  using event_type = nes_simulator::movie_event::type;
+  auto event = movie.next();
+  std::optional<nes_simulator::uint64> expected;
+  const auto start = std::chrono::steady_clock::now();
+  // The End event is on the frame after the last; a movie cut short ends
+  // with its last event.
+  while (event && !(event->kind == event_type::End &&
+                    event->frame == session.frames())) {
+    const auto frame = session.frames();
+    if (event->frame < frame) {
+      throw std::runtime_error("movie events out of order at frame " +
+                               std::to_string(event->frame));
+    }
+    for (; event && event->frame == frame; event = movie.next()) {
+      if (event->kind == event_type::Key) {
+        session.press(event->key);
+      } else if (event->kind == event_type::RewindStart) {
+        session.set_rewinding(true);
+      } else if (event->kind == event_type::RewindStop) {
+        session.set_rewinding(false);
+      } else {
+        break;
+      }
+    }
+
+    const auto hash = session.run_frame(run);
+    if (event && event->kind == event_type::Screen && event->frame == frame) {
+      expected = event->hash;
+      event = movie.next();
+    }
+    if (expected && hash != *expected) {
+      std::printf("replay frame %llu screen %016llx expected %016llx\n",
+                  (unsigned long long)session.frames(),
+                  (unsigned long long)hash, (unsigned long long)*expected);
+      return 1;
+    }
+    if (opts.frame_hashes) {
+      std::printf("frame %llu %016llx\n", (unsigned long long)session.frames(),
+                  (unsigned long long)hash);
+    }
+  }
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  std::printf("digest %016llx frames %llu instructions %llu cycles %llu\n",
+              (unsigned long long)cpu->state_digest(),
+              (unsigned long long)session.frames(),
+              (unsigned long long)cpu->instructions,
+              (unsigned long long)cpu->cycles);
+  std::fprintf(stderr, "%.3fs, %.1f M instructions/s\n", elapsed.count(),
+               cpu->instructions / elapsed.count() / 1e6);
+  return 0;
+}
+
+int run_sessions(const options &opts, const program_source &source) {
+  const auto cycles = static_cast<nes_simulator::uint64>(
+      opts.frames * (opts.cpu_frequency / nes_simulator::NTSC_FRAME_RATE));
+  std::vector<nes_simulator::batch_job> jobs(opts.sessions);
+  for (nes_simulator::uint32 i = 0; i < opts.sessions; i++) {
+    jobs[i].setup = [&opts, &source, seed = opts.seed + i](
+                        nes_simulator::cpu &cpu) {
+      cpu.engine = opts.engine;
+      source.setup(cpu);
+      if (!source.cartridge) {
+        cpu.add_interval_hook(
+            100, [random = nes_simulator::pcg32(seed)](
+                     nes_simulator::cpu &cpu) mutable {
+              cpu.mem_write(snake::RANDOM, snake::random_byte(random()));
+            });
+      }
+    };
+    jobs[i].max_instructions = opts.instructions;
+    jobs[i].max_cycles = cycles;
+  }
+
+  nes_simulator::batch_runner runner(opts.threads);
+  const auto start = std::chrono::steady_clock::now();
+  const auto results = runner.run(jobs);
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  nes_simulator::uint64 instructions = 0;
+  int status = 0;
+  for (std::size_t i = 0; i < results.size(); i++) {
+    const auto &r = results[i];
+    if (!r.error.empty()) {
+      std::printf("session %zu error %s\n", i, r.error.c_str());
+      status = 1;
+      continue;
+    }
+    std::printf("session %zu %016llx instructions %llu cycles %llu\n", i,
+                (unsigned long long)r.digest,
+                (unsigned long long)r.registers.instructions,
+                (unsigned long long)r.registers.cycles);
+    instructions += r.registers.instructions;
+  }
+  std::fprintf(stderr, "%.3fs on %u threads, %.1f M instructions/s\n",
+               elapsed.count(), runner.threads(),
+               instructions / elapsed.count() / 1e6);
+  return status;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  try {
+    const auto opts = parse_options(argc, argv);
+    const auto source = open_program(opts);
+    if (opts.sessions) {
+      return run_sessions(opts, source);
+    }
+
+    std::unique_ptr<nes_simulator::trace_writer> trace;
+    if (!opts.trace.empty()) {
+      trace = std::make_unique<nes_simulator::trace_writer>(opts.trace);
+    }
+    std::unique_ptr<nes_simulator::profiler> profile;
+    if (!opts.profile.empty()) {
+      profile = std::make_unique<nes_simulator::profiler>();
+    }
+    const observers watch{trace.get(), profile.get()};
+    if (!opts.replay.empty()) {
+      const int status = run_replay(opts, source, watch);
+      finish(opts, watch);
+      return status;
+    }
+
+    auto cpu = std::make_unique<nes_simulator::cpu>();
+    cpu->engine = opts.engine;
+    cpu->trace_to(trace.get());
+    source.setup(*cpu);
+    std::unique_ptr<nes_simulator::cpu> reference;
+    if (opts.check) {
+      reference = std::make_unique<nes_simulator::cpu>();
+      reference->engine = *opts.check;
+      source.setup(*reference);
+    }
+    // The feed snake_session gives the game, so runs reproduce across
+    // platforms for a given seed and both machines see the same bytes.
+    if (opts.rom.empty()) {
+      for (auto *machine : {cpu.get(), reference.get()}) {
+        if (machine) {
+          nes_simulator::add_random_feed(*machine, opts.seed);
+        }
+      }
+    }
+
+    const auto script = opts.input.empty()
+                            ? std::map<nes_simulator::uint64,
+                                       nes_simulator::uint8>()
+                            : read_input_script(opts.input);
+    const double cycles_per_frame =
+        opts.cpu_frequency / nes_simulator::NTSC_FRAME_RATE;
+    double cycle_credit = 0;
+    const auto instruction_limit = opts.instructions
+                                       ? opts.instructions
+                                       : ~nes_simulator::uint64{0};
+
+    const auto start = std::chrono::steady_clock::now();
+    nes_simulator::uint64 frame = 0;
+    while (frame < opts.frames && !cpu->halted &&
+           cpu->instructions < instruction_limit) {
+      if (opts.rom.empty()) {
+        const auto key = script.find(frame);
+        for (auto *machine : {cpu.get(), reference.get()}) {
+          if (machine && key != script.end()) {
+            machine->mem_write(snake::INPUT, key->second);
+          }
+        }
+      }
+
+      cycle_credit += cycles_per_frame;
+      if (cycle_credit > 0) {
+        const auto budget = static_cast<nes_simulator::uint64>(cycle_credit);
+        cycle_credit -= run_budget(*cpu, budget, instruction_limit, watch);
+        if (reference) {
+          run_budget(*reference, budget, instruction_limit, {});
+        }
+      }
+      frame++;
+
+      if (reference &&
+          (cpu->state_digest() != reference->state_digest() ||
+           cpu->instructions != reference->instructions ||
+           cpu->halted != reference->halted)) {
+        std::printf("check frame %llu %s %s %s %s\n",
+                    (unsigned long long)frame,
+                    nes_simulator::engine_name(opts.engine),
+                    describe(*cpu).c_str(),
+                    nes_simulator::engine_name(*opts.check),
+                    describe(*reference).c_str());
+        return 1;
+      }
+
+      if (opts.frame_hashes) {
+        const auto hash =
+            opts.rom.empty()
+                ? nes_simulator::fnv1a(&cpu->memory[snake::SCREEN_BEGIN],
+                                       snake::SCREEN_END - snake::SCREEN_BEGIN)
+                : nes_simulator::fnv1a(cpu->memory, 0x800);
+        std::printf("frame %llu %016llx\n", (unsigned long long)frame,
+                    (unsigned long long)hash);
+      }
+    }
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    finish(opts, watch);
+
+    std::printf("digest %016llx frames %llu instructions %llu cycles %llu\n",
+                (unsigned long long)cpu->state_digest(),
+                (unsigned long long)frame,
+                (unsigned long long)cpu->instructions,
+                (unsigned long long)cpu->cycles);
+    std::fprintf(stderr, "%.3fs, %.1f M instructions/s\n", elapsed.count(),
+                 cpu->instructions / elapsed.count() / 1e6);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
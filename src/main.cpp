@@ -1,126 +1,453 @@
 #include "SDL2/SDL.h"
 #include "SDL_events.h"
+#include "SDL_keyboard.h"
 #include "SDL_pixels.h"
 #include "SDL_rect.h"
 #include "SDL_render.h"
 #include "SDL_scancode.h"
 #include "SDL_video.h"
 #include "cpu/cpu.h"
+#include "frontend/frame_scheduler.h"
+#include "frontend/movie.h"
+#include "frontend/palette.h"
+#include "frontend/snake_session.h"
+#include "frontend/spsc_queue.h"
+#include "frontend/triple_buffer.h"
+#include "programs/snake.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <exception>
 #include <iostream>
+#include <memory>
 #include <ostream>
 #include <thread>
+#include <optional>
+#include <random>
+#include <string>
+#include <utils/random.h>
 #include <utils/types.h>
 
-const nes_simulator::uint8 game_code[] = {
-    0x20, 0x06, 0x06, 0x20, 0x38, 0x06, 0x20, 0x0d, 0x06, 0x20, 0x2a, 0x06,
-    0x60, 0xa9, 0x02, 0x85, 0x02, 0xa9, 0x04, 0x85, 0x03, 0xa9, 0x11, 0x85,
-    0x10, 0xa9, 0x10, 0x85, 0x12, 0xa9, 0x0f, 0x85, 0x14, 0xa9, 0x04, 0x85,
-    0x11, 0x85, 0x13, 0x85, 0x15, 0x60, 0xa5, 0xfe, 0x85, 0x00, 0xa5, 0xfe,
-    0x29, 0x03, 0x18, 0x69, 0x02, 0x85, 0x01, 0x60, 0x20, 0x4d, 0x06, 0x20,
-    0x8d, 0x06, 0x20, 0xc3, 0x06, 0x20, 0x19, 0x07, 0x20, 0x20, 0x07, 0x20,
-    0x2d, 0x07, 0x4c, 0x38, 0x06, 0xa5, 0xff, 0xc9, 0x77, 0xf0, 0x0d, 0xc9,
-    0x64, 0xf0, 0x14, 0xc9, 0x73, 0xf0, 0x1b, 0xc9, 0x61, 0xf0, 0x22, 0x60,
-    0xa9, 0x04, 0x24, 0x02, 0xd0, 0x26, 0xa9, 0x01, 0x85, 0x02, 0x60, 0xa9,
-    0x08, 0x24, 0x02, 0xd0, 0x1b, 0xa9, 0x02, 0x85, 0x02, 0x60, 0xa9, 0x01,
-    0x24, 0x02, 0xd0, 0x10, 0xa9, 0x04, 0x85, 0x02, 0x60, 0xa9, 0x02, 0x24,
-    0x02, 0xd0, 0x05, 0xa9, 0x08, 0x85, 0x02, 0x60, 0x60, 0x20, 0x94, 0x06,
-    0x20, 0xa8, 0x06, 0x60, 0xa5, 0x00, 0xc5, 0x10, 0xd0, 0x0d, 0xa5, 0x01,
-    0xc5, 0x11, 0xd0, 0x07, 0xe6, 0x03, 0xe6, 0x03, 0x20, 0x2a, 0x06, 0x60,
-    0xa2, 0x02, 0xb5, 0x10, 0xc5, 0x10, 0xd0, 0x06, 0xb5, 0x11, 0xc5, 0x11,
-    0xf0, 0x09, 0xe8, 0xe8, 0xe4, 0x03, 0xf0, 0x06, 0x4c, 0xaa, 0x06, 0x4c,
-    0x35, 0x07, 0x60, 0xa6, 0x03, 0xca, 0x8a, 0xb5, 0x10, 0x95, 0x12, 0xca,
-    0x10, 0xf9, 0xa5, 0x02, 0x4a, 0xb0, 0x09, 0x4a, 0xb0, 0x19, 0x4a, 0xb0,
-    0x1f, 0x4a, 0xb0, 0x2f, 0xa5, 0x10, 0x38, 0xe9, 0x20, 0x85, 0x10, 0x90,
-    0x01, 0x60, 0xc6, 0x11, 0xa9, 0x01, 0xc5, 0x11, 0xf0, 0x28, 0x60, 0xe6,
-    0x10, 0xa9, 0x1f, 0x24, 0x10, 0xf0, 0x1f, 0x60, 0xa5, 0x10, 0x18, 0x69,
-    0x20, 0x85, 0x10, 0xb0, 0x01, 0x60, 0xe6, 0x11, 0xa9, 0x06, 0xc5, 0x11,
-    0xf0, 0x0c, 0x60, 0xc6, 0x10, 0xa5, 0x10, 0x29, 0x1f, 0xc9, 0x1f, 0xf0,
-    0x01, 0x60, 0x4c, 0x35, 0x07, 0xa0, 0x00, 0xa5, 0xfe, 0x91, 0x00, 0x60,
-    0xa6, 0x03, 0xa9, 0x00, 0x81, 0x10, 0xa2, 0x00, 0xa9, 0x01, 0x81, 0x10,
-    0x60, 0xa2, 0x00, 0xea, 0xea, 0xca, 0xd0, 0xfb, 0x60};
-
-void handle_user_input(nes_simulator::cpu &cpu) {
+namespace snake = nes_simulator::snake;
+
+// What the SDL thread hands the emulation thread. Events are applied at the
+// start of the next emulated frame, so the game sees input on frame
+// boundaries only, however the host schedules the two threads.
+struct input_event {
+  enum class type : nes_simulator::uint8 { Key, RewindStart, RewindStop };
+
+  std::chrono::steady_clock::time_point time;
+  type kind;
+  nes_simulator::uint8 key;
+};
+
+using input_queue = nes_simulator::spsc_queue<input_event, 256>;
+
+// Turns pending SDL events into input events; returns false on quit. With
+// the emulation thread stalled long enough to fill the queue, further events
+// are dropped.
+bool collect_input(input_queue &input) {
   SDL_Event event;
   while (SDL_PollEvent(&event)) {
+    const auto now = std::chrono::steady_clock::now();
+    const auto key = [&](nes_simulator::uint8 code) {
+      input.push({now, input_event::type::Key, code});
+    };
     switch (event.type) {
+    case SDL_QUIT:
+      return false;
     case SDL_KEYDOWN:
       switch (event.key.keysym.scancode) {
       case SDL_SCANCODE_Q:
-        exit(0);
+        return false;
       case SDL_SCANCODE_W:
-        cpu.mem_write(0xff, 0x77);
+        key(snake::KEY_UP);
         break;
       case SDL_SCANCODE_S:
-        cpu.mem_write(0xff, 0x73);
+        key(snake::KEY_DOWN);
         break;
       case SDL_SCANCODE_A:
-        cpu.mem_write(0xff, 0x61);
+        key(snake::KEY_LEFT);
         break;
       case SDL_SCANCODE_D:
-        cpu.mem_write(0xff, 0x64);
+        key(snake::KEY_RIGHT);
+        break;
+      case SDL_SCANCODE_BACKSPACE:
+        if (!event.key.repeat) {
+          input.push({now, input_event::type::RewindStart, 0});
+        }
         break;
       default:
         break;
       }
+      break;
+    case SDL_KEYUP:
+      if (event.key.keysym.scancode == SDL_SCANCODE_BACKSPACE) {
+        input.push({now, input_event::type::RewindStop, 0});
+      }
+      break;
     }
   }
+  return true;
 }
 
-SDL_Color color(nes_simulator::uint8 data) {
-  switch (data) {
-  case 0:
-    return SDL_Color{0, 0, 0, 0};
-  default:
-    return SDL_Color{255, 255, 255, 0};
+// The game only stores 0 (background) and 1-15 (snake, apple) in screen
+// memory, so a 16-color palette covers it.
+const nes_simulator::palette screen_palette = [] {
+  std::array<nes_simulator::uint32, 16> colors;
+  colors.fill(nes_simulator::rgba(255, 255, 255));
+  colors[0] = nes_simulator::rgba(0, 0, 0);
+  return nes_simulator::palette(colors);
+}();
+
+// Re-expands the screen rows written since the last call and returns the
+// bounding rectangle of the pixels whose color changed, or an empty one.
+SDL_Rect read_screen_state(nes_simulator::cpu &cpu,
+                           nes_simulator::uint8 *frame) {
+  int first_row = 32, last_row = -1;
+  cpu.consume_dirty(snake::SCREEN_BEGIN, snake::SCREEN_END,
+                    [&](nes_simulator::uint16 addr) {
+                      const int row = (addr - snake::SCREEN_BEGIN) / 32;
+                      first_row = std::min(first_row, row);
+                      last_row = std::max(last_row, row);
+                    });
+  if (last_row < 0) {
+    return SDL_Rect{0, 0, 0, 0};
+  }
+
+  const int first = first_row * 32;
+  const int count = (last_row - first_row + 1) * 32;
+  nes_simulator::uint64 change_mask[32 * 32 / 64];
+  const auto *screen = &cpu.memory[snake::SCREEN_BEGIN];
+  if (!nes_simulator::expand_palette_rgb24(screen + first, frame + first * 3,
+                                           count, screen_palette,
+                                           change_mask)) {
+    return SDL_Rect{0, 0, 0, 0};
   }
-}
 
-bool read_screen_state(nes_simulator::cpu &cpu, nes_simulator::uint8 *frame) {
-  bool update = false;
-  int frame_idx = 0;
-  for (int i = 0x200; i < 0x600; i++) {
-    auto c = color(cpu.mem_read(i));
-    if (frame[frame_idx] != c.r || frame[frame_idx + 1] != c.g ||
-        frame[frame_idx + 2] != c.b) {
-      frame[frame_idx] = c.r;
-      frame[frame_idx + 1] = c.g;
-      frame[frame_idx + 2] = c.b;
-      update = true;
+  int min_x = 32, min_y = 32, max_x = -1, max_y = -1;
+  for (int word = 0; word < (count + 63) / 64; word++) {
+    for (auto bits = change_mask[word]; bits != 0; bits &= bits - 1) {
+      const int pixel = first + word * 64 + std::countr_zero(bits);
+      const int x = pixel % 32, y = pixel / 32;
+      min_x = std::min(min_x, x);
+      max_x = std::max(max_x, x);
+      min_y = std::min(min_y, y);
+      max_y = std::max(max_y, y);
     }
-    frame_idx += 3;
   }
-  return update;
+  return SDL_Rect{min_x, min_y, max_x - min_x + 1, max_y - min_y + 1};
 }
 
-int main() {
-  SDL_Init(SDL_INIT_EVERYTHING);
-  auto *window =
-      SDL_CreateWindow("snake", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-                       320, 320, SDL_WINDOW_ALLOW_HIGHDPI);
+// Runs the snake program headless until the snake dies (the game then falls
+// through to a BRK), over and over for about a second, with a fixed seed so
+// every engine gets a reproducible input stream.
+template <class Run> double measure_instructions_per_second(Run &&run) {
+  using clock = std::chrono::steady_clock;
 
-  auto *render = SDL_CreateRenderer(window, -1, SDL_RENDERER_PRESENTVSYNC);
-  SDL_RenderSetScale(render, 10, 10);
+  std::uint64_t instructions = 0;
+  nes_simulator::pcg32 random(1);
+  auto next_random = [&] { return snake::random_byte(random()); };
+
+  const auto start = clock::now();
+  while (clock::now() - start < std::chrono::seconds(1)) {
+    auto cpu = std::make_unique<nes_simulator::cpu>();
+    cpu->load(snake::game_code, sizeof(snake::game_code));
+    cpu->reset();
+    run(*cpu, next_random);
+    instructions += cpu->instructions;
+  }
+
+  const std::chrono::duration<double> elapsed = clock::now() - start;
+  return instructions / elapsed.count();
+}
+
+double measure_engine(nes_simulator::Engine engine) {
+  return measure_instructions_per_second(
+      [engine](nes_simulator::cpu &cpu, auto &next_random) {
+        cpu.engine = engine;
+        cpu.run([&](nes_simulator::cpu &cpu) {
+          cpu.mem_write(snake::RANDOM, next_random());
+        });
+      });
+}
+
+// The Jit engine only runs native code in batches, so it is measured here.
+double measure_batched(nes_simulator::Engine engine) {
+  return measure_instructions_per_second(
+      [engine](nes_simulator::cpu &cpu, auto &next_random) {
+        cpu.engine = engine;
+        while (!cpu.halted) {
+          cpu.mem_write(snake::RANDOM, next_random());
+          cpu.run_instructions(1000);
+        }
+      });
+}
+
+void print_frame_stats(const nes_simulator::frame_stats &stats) {
+  std::cout << "frames: " << stats.frames << ", missed: " << stats.missed
+            << ", lateness: mean " << stats.mean_lateness_us << "us, jitter "
+            << stats.jitter_us << "us, max " << stats.max_lateness_us << "us"
+            << std::endl;
+}
+
+// How long input events waited between SDL and the frame that applied them.
+struct input_stats {
+  nes_simulator::uint64 events = 0;
+  double total_latency_us = 0;
+  double max_latency_us = 0;
+
+  void record(std::chrono::steady_clock::time_point captured) {
+    const std::chrono::duration<double, std::micro> latency =
+        std::chrono::steady_clock::now() - captured;
+    events++;
+    total_latency_us += latency.count();
+    max_latency_us = std::max(max_latency_us, latency.count());
+  }
+};
+
+void print_input_stats(const input_stats &stats) {
+  if (stats.events == 0) {
+    return;
+  }
+  std::cout << "input: " << stats.events << " events, latency: mean "
+            << stats.total_latency_us / stats.events << "us, max "
+            << stats.max_latency_us << "us" << std::endl;
+}
+
+using screen_frame = std::array<nes_simulator::uint8, 32 * 3 * 32>;
+
+// One emulated frame's screen. `dirty` covers what changed since frame
+// `number - 1`, so a display that showed that frame only uploads the rect.
+struct published_frame {
+  nes_simulator::uint64 number = 0;
+  SDL_Rect dirty = {0, 0, 0, 0};
+  screen_frame pixels = {};
+};
+
+// Frames from the emulation thread to the display. Dropped frames were
+// published and overwritten before the display got to them; duplicated ones
+// are refreshes that found nothing new and showed the last frame again.
+struct screen_handoff {
+  nes_simulator::triple_buffer<published_frame> frames;
+  std::atomic<nes_simulator::uint64> dropped = 0;
+  std::atomic<nes_simulator::uint64> duplicated = 0;
+};
+
+void print_display_stats(screen_handoff &screen) {
+  std::cout << "display: dropped " << screen.dropped.exchange(0)
+            << ", duplicated " << screen.duplicated.exchange(0) << std::endl;
+}
+
+// The emulation thread. One frame: apply the input that arrived during the
+// last one, run the frame (see snake_session), publish the screen, then wait
+// for the next deadline. While Backspace is held the session steps back a
+// frame instead, so once the snake dies the game waits on its last frame to
+// be rewound.
+void emulate(nes_simulator::cpu &cpu, nes_simulator::snake_session &session,
+             input_queue &input, screen_handoff &screen,
+             const std::atomic<bool> &running) {
+  nes_simulator::frame_scheduler scheduler(nes_simulator::NTSC_FRAME_RATE);
+  input_stats latency;
+  screen_frame frame = {};
+  nes_simulator::uint64 frame_number = 0;
 
+  while (running.load(std::memory_order_relaxed)) {
+    while (const auto event = input.pop()) {
+      latency.record(event->time);
+      switch (event->kind) {
+      case input_event::type::Key:
+        session.press(event->key);
+        break;
+      case input_event::type::RewindStart:
+        session.set_rewinding(true);
+        break;
+      case input_event::type::RewindStop:
+        session.set_rewinding(false);
+        break;
+      }
+    }
+    session.run_frame();
+
+    auto &slot = screen.frames.write_slot();
+    slot.number = ++frame_number;
+    slot.dirty = read_screen_state(cpu, frame.data());
+    slot.pixels = frame;
+    if (!screen.frames.publish()) {
+      screen.dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    scheduler.wait_for_next_frame();
+    if (scheduler.stats().frames == 600) {
+      print_frame_stats(scheduler.stats());
+      print_input_stats(latency);
+      print_display_stats(screen);
+      scheduler.reset_stats();
+      latency = {};
+    }
+  }
+
+  print_frame_stats(scheduler.stats());
+  print_input_stats(latency);
+  print_display_stats(screen);
+}
+
+// The display, on the main thread: SDL wants rendering and events on the
+// thread that made the window. At every refresh it collects input for the
+// emulation thread and shows the newest published frame; with vsync the
+// present is what paces it, and only this thread ever blocks on the
+// display. Without vsync it paces itself at the NTSC frame rate instead.
+// Returns once the window is closed.
+void present(SDL_Window *window, screen_handoff &screen, input_queue &input) {
+  auto *render = SDL_CreateRenderer(
+      window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+  SDL_RenderSetScale(render, 10, 10);
   auto *texture = SDL_CreateTexture(render, SDL_PIXELFORMAT_RGB24,
                                     SDL_TEXTUREACCESS_TARGET, 32, 32);
 
-  SDL_ShowWindow(window);
-  nes_simulator::uint8 frame[32 * 3 * 32];
+  SDL_RendererInfo info;
+  const bool vsync = SDL_GetRendererInfo(render, &info) == 0 &&
+                     (info.flags & SDL_RENDERER_PRESENTVSYNC);
+  nes_simulator::frame_scheduler scheduler(nes_simulator::NTSC_FRAME_RATE);
+
+  nes_simulator::uint64 shown = 0;
+  while (collect_input(input)) {
+    if (screen.frames.acquire()) {
+      const auto &frame = screen.frames.read_slot();
+      if (frame.number == shown + 1) {
+        if (frame.dirty.w > 0) {
+          SDL_UpdateTexture(texture, &frame.dirty,
+                            frame.pixels.data() +
+                                (frame.dirty.y * 32 + frame.dirty.x) * 3,
+                            32 * 3);
+        }
+      } else {
+        SDL_UpdateTexture(texture, nullptr, frame.pixels.data(), 32 * 3);
+      }
+      shown = frame.number;
+    } else if (shown > 0) {
+      screen.duplicated.fetch_add(1, std::memory_order_relaxed);
+    }
+    SDL_RenderCopy(render, texture, nullptr, nullptr);
+    SDL_RenderPresent(render);
+    if (!vsync) {
+      scheduler.wait_for_next_frame();
+    }
+  }
+
+  SDL_DestroyTexture(texture);
+  SDL_DestroyRenderer(render);
+}
+
+void compare_engines() {
+  const auto switch_ips = measure_engine(nes_simulator::Engine::Switch);
+  const auto threaded_ips = measure_engine(nes_simulator::Engine::Threaded);
+  const auto cached_ips = measure_engine(nes_simulator::Engine::Cached);
+  const auto batched_ips = measure_batched(nes_simulator::Engine::Threaded);
+  const auto jit_ips = measure_batched(nes_simulator::Engine::Jit);
+
+  std::cout << "switch:   " << switch_ips / 1e6 << " M instructions/s\n"
+            << "threaded: " << threaded_ips / 1e6 << " M instructions/s ("
+            << threaded_ips / switch_ips << "x)\n"
+            << "cached:   " << cached_ips / 1e6 << " M instructions/s ("
+            << cached_ips / switch_ips << "x)\n"
+            << "batched:  " << batched_ips / 1e6 << " M instructions/s ("
+            << batched_ips / switch_ips << "x)\n"
+            << "jit:      " << jit_ips / 1e6 << " M instructions/s ("
+            << jit_ips / switch_ips << "x)" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  // The snake demo was tuned for roughly one instruction per 120us, i.e.
+  // ~16k cycles/s; --ntsc runs it at the real 2A03 clock instead.
+  nes_simulator::uint64 cpu_frequency = 16000;
+  // --record writes the session to a movie that headless --replay plays
+  // back; --seed fixes the game's randomness, which is otherwise new on
+  // every run.
+  std::optional<nes_simulator::uint32> seed;
+  std::string record;
+  // --engine picks the cpu engine by name, as headless takes it.
+  auto engine = nes_simulator::Engine::Switch;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--compare-engines") == 0) {
+      compare_engines();
+      return 0;
+    }
+    if (strcmp(argv[i], "--ntsc") == 0) {
+      cpu_frequency = nes_simulator::NTSC_CPU_FREQUENCY;
+    } else if (strncmp(argv[i], "--cpu-hz=", 9) == 0) {
+      cpu_frequency = std::strtoull(argv[i] + 9, nullptr, 10);
+    } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+      seed = std::strtoul(argv[i] + 7, nullptr, 10);
+    } else if (strncmp(argv[i], "--record=", 9) == 0) {
+      record = argv[i] + 9;
+    } else if (strcmp(argv[i], "--engine") == 0 ||
+               strncmp(argv[i], "--engine=", 9) == 0) {
+      const char *name = argv[i][8] == '=' ? argv[i] + 9
+                         : i + 1 < argc    ? argv[++i]
+                                           : "";
+      try {
+        engine = nes_simulator::parse_engine(name);
+      } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+      }
+    }
+  }
 
   nes_simulator::cpu cpu;
-  cpu.load_and_run(game_code, sizeof(game_code), [&](nes_simulator::cpu &cpu) {
-    handle_user_input(cpu);
-    cpu.mem_write(0xfe, rand() % 15 + 1);
-    if (read_screen_state(cpu, frame)) {
-      SDL_UpdateTexture(texture, nullptr, frame, 32 * 3);
-      SDL_RenderCopy(render, texture, nullptr, nullptr);
-      SDL_RenderPresent(render);
+  cpu.engine = engine;
+  cpu.load(snake::game_code, sizeof(snake::game_code));
+  cpu.reset();
+  cpu.track_dirty(snake::SCREEN_BEGIN, snake::SCREEN_END);
+  nes_simulator::snake_session session(
+      cpu, cpu_frequency, seed ? *seed : std::random_device()());
+  std::unique_ptr<nes_simulator::movie_writer> movie;
+  if (!record.empty()) {
+    try {
+      movie = std::make_unique<nes_simulator::movie_writer>(record,
+                                                            session.header());
+    } catch (const std::exception &e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
     }
+    session.record_to(movie.get());
+  }
 
-    std::this_thread::sleep_for(std::chrono::microseconds(120));
-  });
+  SDL_Init(SDL_INIT_EVERYTHING);
+  auto *window =
+      SDL_CreateWindow("snake", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+                       320, 320, SDL_WINDOW_ALLOW_HIGHDPI);
+
+  SDL_ShowWindow(window);
+
+  // The window, its renderer and its events stay on this thread; the
+  // machine runs on its own, and the two hand frames and input over without
+  // waiting on each other.
+  input_queue input;
+  screen_handoff screen;
+  std::atomic<bool> running = true;
+  std::thread emulation(emulate, std::ref(cpu), std::ref(session),
+                        std::ref(input), std::ref(screen), std::cref(running));
 
+  present(window, screen, input);
+
+  running.store(false, std::memory_order_relaxed);
+  emulation.join();
+  SDL_DestroyWindow(window);
+  SDL_Quit();
+
+  if (movie) {
+    try {
+      movie->close(session.frames());
+    } catch (const std::exception &e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+  }
   return 0;
 }
@@ -0,0 +1,178 @@
+#include "runner/batch_runner.h"
+#include "cpu/cpu.h"
+#include "cpu/interpreter.h"
+#include <algorithm>
+#include <exception>
+#include <limits>
+#include <stdexcept>
+
+namespace nes_simulator {
+
+namespace {
+
+constexpr uint64 pack(uint32 begin, uint32 end) {
+  return uint64{begin} << 32 | end;
+}
+
+} // namespace
+
+batch_runner::batch_runner(uint32 threads)
+    : generation(0), busy(0), stopping(false), jobs(nullptr),
+      results(nullptr) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  ranges = std::make_unique<job_range[]>(threads);
+  workers.reserve(threads);
+  for (uint32 id = 0; id < threads; id++) {
+    workers.emplace_back(&batch_runner::worker, this, id);
+  }
+}
+
+batch_runner::~batch_runner() {
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+  }
+  start.notify_all();
+  for (auto &thread : workers) {
+    thread.join();
+  }
+}
+
+std::vector<batch_result>
+batch_runner::run(const std::vector<batch_job> &jobs) {
+  if (jobs.size() > std::numeric_limits<uint32>::max()) {
+    throw std::runtime_error("too many batch jobs");
+  }
+  std::vector<batch_result> results(jobs.size());
+  if (jobs.empty()) {
+    return results;
+  }
+
+  const uint32 count = jobs.size();
+  const uint32 threads = workers.size();
+  for (uint32 id = 0; id < threads; id++) {
+    ranges[id].range.store(pack(uint64{count} * id / threads,
+                                uint64{count} * (id + 1) / threads),
+                           std::memory_order_relaxed);
+  }
+
+  std::unique_lock lock(mutex);
+  this->jobs = jobs.data();
+  this->results = results.data();
+  busy = threads;
+  generation++;
+  start.notify_all();
+  done.wait(lock, [this] { return busy == 0; });
+  return results;
+}
+
+void batch_runner::worker(uint32 id) {
+  uint64 seen = 0;
+  for (;;) {
+    {
+      std::unique_lock lock(mutex);
+      start.wait(lock, [&] { return stopping || generation != seen; });
+      if (stopping) {
+        return;
+      }
+      seen = generation;
+    }
+
+    uint32 job;
+    while (take(id, job) || (steal(id) && take(id, job))) {
+      execute(job);
+    }
+
+    std::lock_guard lock(mutex);
+    if (--busy == 0) {
+      done.notify_one();
+    }
+  }
+}
+
+bool batch_runner::take(uint32 id, uint32 &job) {
+  auto &range = ranges[id].range;
+  uint64 current = range.load(std::memory_order_relaxed);
+  for (;;) {
+    const uint32 begin = current >> 32, end = current;
+    if (begin >= end) {
+      return false;
+    }
+    if (range.compare_exchange_weak(current, pack(begin + 1, end),
+                                    std::memory_order_relaxed)) {
+      job = begin;
+      return true;
+    }
+  }
+}
+
+// Moves the back half of the first non-empty range after our own into ours,
+// which is empty: nobody else adds to it, and thieves skip it.
+bool batch_runner::steal(uint32 id) {
+  const uint32 threads = workers.size();
+  for (uint32 i = 1; i < threads; i++) {
+    auto &victim = ranges[(id + i) % threads].range;
+    uint64 current = victim.load(std::memory_order_relaxed);
+    for (;;) {
+      const uint32 begin = current >> 32, end = current;
+      if (begin >= end) {
+        break;
+      }
+      const uint32 split = end - (end - begin + 1) / 2;
+      if (victim.compare_exchange_weak(current, pack(begin, split),
+                                       std::memory_order_relaxed)) {
+        ranges[id].range.store(pack(split, end), std::memory_order_relaxed);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void batch_runner::execute(uint32 index) {
+  const batch_job &job = jobs[index];
+  batch_result &result = results[index];
+  try {
+    auto machine = std::make_unique<cpu>();
+    if (job.setup) {
+      job.setup(*machine);
+    }
+
+    // A single budget is an entry point of its own, which the Jit engine
+    // runs native code under; with both, the instruction budget is counted
+    // down here.
+    if (!job.max_cycles) {
+      machine->run_instructions(job.max_instructions
+                                    ? job.max_instructions
+                                    : std::numeric_limits<uint64>::max());
+    } else if (!job.max_instructions) {
+      machine->run_cycles(job.max_cycles);
+    } else {
+      const uint64 cycle_limit = machine->cycles + job.max_cycles;
+      uint64 left = job.max_instructions;
+      machine->run_until([&](const cpu &c) {
+        if (left == 0 || c.cycles >= cycle_limit) {
+          return true;
+        }
+        left--;
+        return false;
+      });
+    }
+
+    if (job.finish) {
+      job.finish(*machine);
+    }
+    result.registers = {machine->reg_a,   machine->reg_x,
+                        machine->reg_y,   machine->sp,
+                        machine->status,  machine->pc,
+                        machine->halted,  machine->instructions,
+                        machine->cycles};
+    result.digest = machine->state_digest();
+  } catch (const std::exception &e) {
+    result.error = e.what();
+  }
+}
+
+} // namespace nes_simulator
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cpu/save_state.h>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utils/types.h>
+#include <vector>
+
+namespace nes_simulator {
+
+class cpu;
+
+struct batch_job {
+  // Prepares a fresh cpu: load or map a program, add hooks, reset.
+  std::function<void(cpu &)> setup;
+  // Budgets counted from the end of setup; 0 means unlimited. The run also
+  // stops when the program halts.
+  uint64 max_instructions = 0;
+  uint64 max_cycles = 0;
+  // Optional; sees the cpu after the run, e.g. to pull results out of
+  // memory into storage owned by this job.
+  std::function<void(cpu &)> finish;
+};
+
+struct batch_result {
+  cpu_registers registers;
+  uint64 digest;
+  // what() of an exception thrown by setup, the run or finish; empty if
+  // none was.
+  std::string error;
+};
+
+// Runs independent cpu sessions on a fixed set of worker threads. Each run()
+// splits the jobs into one contiguous range per worker; a worker takes jobs
+// from the front of its own range and, once it is empty, steals the back half
+// of another's. Ranges are single atomic words and each result has its own
+// slot, so nothing between jobs takes a lock; the mutex only starts and ends
+// a run.
+class batch_runner {
+public:
+  // 0 threads means one per hardware thread.
+  explicit batch_runner(uint32 threads = 0);
+  ~batch_runner();
+  batch_runner(const batch_runner &) = delete;
+  batch_runner &operator=(const batch_runner &) = delete;
+
+  // Blocks until every job has run; results are in job order.
+  std::vector<batch_result> run(const std::vector<batch_job> &jobs);
+
+  uint32 threads() const { return workers.size(); }
+
+private:
+  // [begin, end) of job indices packed as begin << 32 | end, so that the
+  // owner and thieves agree through one compare-and-swap.
+  struct alignas(64) job_range {
+    std::atomic<uint64> range;
+  };
+
+  void worker(uint32 id);
+  bool take(uint32 id, uint32 &job);
+  bool steal(uint32 id);
+  void execute(uint32 index);
+
+  std::vector<std::thread> workers;
+  std::unique_ptr<job_range[]> ranges;
+
+  std::mutex mutex;
+  std::condition_variable start;
+  std::condition_variable done;
+  uint64 generation;
+  uint32 busy;
+  bool stopping;
+
+  const batch_job *jobs;
+  batch_result *results;
+};
+
+} // namespace nes_simulator
@@ -0,0 +1,5 @@
+target("runner")
+  set_kind("static")
+  add_files("*.cpp")
+  add_deps("cpu")
+  add_syslinks("pthread", {public = true})
\ No newline at end of file
@@ -0,0 +1,296 @@
+#include "cpu/opcode.h"
+#include "cpu/trace.h"
+#include <cstdio>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <utils/types.h>
+#include <vector>
+
+// Prints a binary trace written by headless --trace in the nestest log
+// format, one line per instruction:
+//
+//   C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7
+//
+// The trace holds registers but not memory, so operands are shown without
+// the "= xx" values nestest adds for memory operands. The PPU position is
+// derived from the cycle count, three dots per cycle on a 341 x 262 frame
+// with no odd-frame skip, which is what nestest.log shows while rendering is
+// off.
+//
+// usage: tracelog TRACE [OUTPUT]
+
+namespace {
+
+using nes_simulator::AddressingMode;
+using nes_simulator::int8;
+using nes_simulator::OpcodeType;
+using nes_simulator::uint16;
+using nes_simulator::uint64;
+using nes_simulator::uint8;
+
+const char *mnemonic(OpcodeType type) {
+  switch (type) {
+  case OpcodeType::ADC:
+    return "ADC";
+  case OpcodeType::LDA:
+    return "LDA";
+  case OpcodeType::AND:
+    return "AND";
+  case OpcodeType::BCC:
+    return "BCC";
+  case OpcodeType::BCS:
+    return "BCS";
+  case OpcodeType::BEQ:
+    return "BEQ";
+  case OpcodeType::NOP:
+    return "NOP";
+  case OpcodeType::ORA:
+    return "ORA";
+  case OpcodeType::EOR:
+    return "EOR";
+  case OpcodeType::INX:
+    return "INX";
+  case OpcodeType::INY:
+    return "INY";
+  case OpcodeType::ASL:
+  case OpcodeType::ASL_ACC:
+    return "ASL";
+  case OpcodeType::BIT:
+    return "BIT";
+  case OpcodeType::BMI:
+    return "BMI";
+  case OpcodeType::BNE:
+    return "BNE";
+  case OpcodeType::BPL:
+    return "BPL";
+  case OpcodeType::BVC:
+    return "BVC";
+  case OpcodeType::BVS:
+    return "BVS";
+  case OpcodeType::CLC:
+    return "CLC";
+  case OpcodeType::CLD:
+    return "CLD";
+  case OpcodeType::CLI:
+    return "CLI";
+  case OpcodeType::CLV:
+    return "CLV";
+  case OpcodeType::CMP:
+    return "CMP";
+  case OpcodeType::CPX:
+    return "CPX";
+  case OpcodeType::CPY:
+    return "CPY";
+  case OpcodeType::SBC:
+    return "SBC";
+  case OpcodeType::SLC:
+    return "SEC";
+  case OpcodeType::SLD:
+    return "SED";
+  case OpcodeType::SLI:
+    return "SEI";
+  case OpcodeType::LDX:
+    return "LDX";
+  case OpcodeType::LDY:
+    return "LDY";
+  case OpcodeType::LSR:
+  case OpcodeType::LSR_ACC:
+    return "LSR";
+  case OpcodeType::TAX:
+    return "TAX";
+  case OpcodeType::TAY:
+    return "TAY";
+  case OpcodeType::TSX:
+    return "TSX";
+  case OpcodeType::TXA:
+    return "TXA";
+  case OpcodeType::TXS:
+    return "TXS";
+  case OpcodeType::TYA:
+    return "TYA";
+  case OpcodeType::JMP_ABS:
+  case OpcodeType::JMP_IND:
+    return "JMP";
+  case OpcodeType::JSR:
+    return "JSR";
+  case OpcodeType::DEX:
+    return "DEX";
+  case OpcodeType::DEY:
+    return "DEY";
+  case OpcodeType::STA:
+    return "STA";
+  case OpcodeType::STX:
+    return "STX";
+  case OpcodeType::STY:
+    return "STY";
+  case OpcodeType::PHA:
+    return "PHA";
+  case OpcodeType::PHP:
+    return "PHP";
+  case OpcodeType::PLA:
+    return "PLA";
+  case OpcodeType::PLP:
+    return "PLP";
+  case OpcodeType::BRK:
+    return "BRK";
+  case OpcodeType::ROL:
+  case OpcodeType::ROL_ACC:
+    return "ROL";
+  case OpcodeType::ROR:
+  case OpcodeType::ROR_ACC:
+    return "ROR";
+  case OpcodeType::RTI:
+    return "RTI";
+  case OpcodeType::RTS:
+    return "RTS";
+  case OpcodeType::INC:
+    return "INC";
+  case OpcodeType::DEC:
+    return "DEC";
+  case OpcodeType::UNKNOWN:
+    break;
+  }
+  return "???";
+}
+
+// The operand as nestest writes it. JMP and JSR are listed with the
+// Immediate mode in the opcode table and need their own cases.
+std::string operand_text(const nes_simulator::trace_record &r) {
+  const auto &info = nes_simulator::opcodes[r.opcode];
+  const uint8 byte = r.operand;
+  const uint16 word = r.operand;
+  char text[32] = "";
+  switch (info.opcode) {
+  case OpcodeType::JMP_ABS:
+  case OpcodeType::JSR:
+    std::snprintf(text, sizeof(text), "$%04X", word);
+    return text;
+  case OpcodeType::JMP_IND:
+    std::snprintf(text, sizeof(text), "($%04X)", word);
+    return text;
+  case OpcodeType::ASL_ACC:
+  case OpcodeType::LSR_ACC:
+  case OpcodeType::ROL_ACC:
+  case OpcodeType::ROR_ACC:
+    return "A";
+  default:
+    break;
+  }
+
+  switch (info.mode) {
+  case AddressingMode::Immediate:
+    std::snprintf(text, sizeof(text), "#$%02X", byte);
+    break;
+  case AddressingMode::ZeroPage:
+    std::snprintf(text, sizeof(text), "$%02X", byte);
+    break;
+  case AddressingMode::ZeroPage_X:
+    std::snprintf(text, sizeof(text), "$%02X,X", byte);
+    break;
+  case AddressingMode::ZeroPage_Y:
+    std::snprintf(text, sizeof(text), "$%02X,Y", byte);
+    break;
+  case AddressingMode::Absolute:
+    std::snprintf(text, sizeof(text), "$%04X", word);
+    break;
+  case AddressingMode::Absolute_X:
+    std::snprintf(text, sizeof(text), "$%04X,X", word);
+    break;
+  case AddressingMode::Absolute_Y:
+    std::snprintf(text, sizeof(text), "$%04X,Y", word);
+    break;
+  case AddressingMode::Indirect_X:
+    std::snprintf(text, sizeof(text), "($%02X,X)", byte);
+    break;
+  case AddressingMode::Indirect_Y:
+    std::snprintf(text, sizeof(text), "($%02X),Y", byte);
+    break;
+  case AddressingMode::Relative:
+    std::snprintf(text, sizeof(text), "$%04X",
+                  static_cast<uint16>(r.pc + 2 + static_cast<int8>(byte)));
+    break;
+  case AddressingMode::Implied:
+    break;
+  }
+  return text;
+}
+
+void print_line(std::FILE *out, const nes_simulator::trace_record &r) {
+  const auto &info = nes_simulator::opcodes[r.opcode];
+  char bytes[16];
+  switch (info.bytes) {
+  case 3:
+    std::snprintf(bytes, sizeof(bytes), "%02X %02X %02X", r.opcode,
+                  r.operand & 0xFF, r.operand >> 8);
+    break;
+  case 2:
+    std::snprintf(bytes, sizeof(bytes), "%02X %02X", r.opcode,
+                  r.operand & 0xFF);
+    break;
+  default:
+    std::snprintf(bytes, sizeof(bytes), "%02X", r.opcode);
+    break;
+  }
+
+  std::string text = mnemonic(info.opcode);
+  const auto operand = operand_text(r);
+  if (!operand.empty()) {
+    text += ' ';
+    text += operand;
+  }
+
+  const uint64 dots = r.cycles() * 3 % (341 * 262);
+  std::fprintf(out,
+               "%04X  %-8s  %-31s A:%02X X:%02X Y:%02X P:%02X SP:%02X "
+               "PPU:%3u,%3u CYC:%llu\n",
+               r.pc, bytes, text.c_str(), r.reg_a, r.reg_x, r.reg_y,
+               r.status, r.sp, static_cast<unsigned>(dots / 341),
+               static_cast<unsigned>(dots % 341),
+               static_cast<unsigned long long>(r.cycles()));
+}
+
+void convert(nes_simulator::trace_reader &in, std::FILE *out) {
+  std::vector<nes_simulator::trace_record> records(4096);
+  std::size_t count;
+  while ((count = in.read(records.data(), records.size())) > 0) {
+    for (std::size_t i = 0; i < count; i++) {
+      print_line(out, records[i]);
+    }
+  }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc < 2 || argc > 3) {
+    std::cerr << "usage: tracelog TRACE [OUTPUT]" << std::endl;
+    return 1;
+  }
+
+  std::optional<nes_simulator::trace_reader> in;
+  try {
+    in.emplace(argv[1]);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  std::FILE *out = argc == 3 ? std::fopen(argv[2], "w") : stdout;
+  if (!out) {
+    std::cerr << "cannot create " << argv[2] << std::endl;
+    return 1;
+  }
+
+  int status = 0;
+  try {
+    convert(*in, out);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    status = 1;
+  }
+  if (out != stdout && std::fclose(out) != 0) {
+    std::cerr << "cannot write " << argv[2] << std::endl;
+    status = 1;
+  }
+  return status;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <utils/types.h>
+
+namespace nes_simulator {
+
+constexpr uint64 FNV_OFFSET_BASIS = 0xcbf29ce484222325;
+constexpr uint64 FNV_PRIME = 0x100000001b3;
+
+// 64-bit FNV-1a. Pass a previous result as `hash` to chain several buffers
+// into one digest.
+constexpr uint64 fnv1a(const uint8 *data, std::size_t size,
+                       uint64 hash = FNV_OFFSET_BASIS) {
+  for (std::size_t i = 0; i < size; i++) {
+    hash = (hash ^ data[i]) * FNV_PRIME;
+  }
+  return hash;
+}
+
+} // namespace nes_simulator
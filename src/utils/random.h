@@ -0,0 +1,45 @@
+#pragma once
+
+#include <bit>
+#include <utils/types.h>
+
+namespace nes_simulator {
+
+// PCG32 (XSH RR): a 64-bit LCG whose state is scrambled by an xorshift and
+// a data-dependent rotate into each 32-bit result, a multiply and a handful
+// of shifts per number. Its sequence is fixed by the seed alone, so a
+// recorded seed replays the same numbers on any platform.
+//
+// It models UniformRandomBitGenerator, so it plugs in wherever a <random>
+// engine such as std::minstd_rand does.
+class pcg32 {
+public:
+  using result_type = uint32;
+
+  constexpr explicit pcg32(uint64 seed = 0) : state(0) { this->seed(seed); }
+
+  constexpr void seed(uint64 seed) {
+    state = 0;
+    (*this)();
+    state += seed;
+    (*this)();
+  }
+
+  constexpr result_type operator()() {
+    const uint64 old = state;
+    state = old * MULTIPLIER + INCREMENT;
+    const uint32 xorshifted = ((old >> 18) ^ old) >> 27;
+    return std::rotr(xorshifted, static_cast<int>(old >> 59));
+  }
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return ~result_type{0}; }
+
+private:
+  static constexpr uint64 MULTIPLIER = 6364136223846793005;
+  static constexpr uint64 INCREMENT = 1442695040888963407;
+
+  uint64 state;
+};
+
+} // namespace nes_simulator
@@ -7,5 +7,7 @@ namespace nes_simulator {
 using uint8 = std::uint8_t;
 using int8 = std::int8_t;
 using uint16 = std::uint16_t;
+using uint32 = std::uint32_t;
+using uint64 = std::uint64_t;
 
 } // namespace nes_simulator
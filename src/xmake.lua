@@ -1,6 +1,25 @@
+includes("cartridge")
 includes("cpu")
+includes("frontend")
+includes("runner")
 
 target("main")
   set_kind("binary")
   add_files("main.cpp")
+  add_deps("cpu", "frontend")
+  add_packages("libsdl")
+
+target("headless")
+  set_kind("binary")
+  add_files("headless.cpp")
+  add_deps("cpu", "cartridge", "frontend", "runner")
+
+target("bench")
+  set_kind("binary")
+  add_files("bench.cpp")
+  add_deps("cpu")
+
+target("tracelog")
+  set_kind("binary")
+  add_files("tracelog.cpp")
   add_deps("cpu")
\ No newline at end of file
@@ -0,0 +1,84 @@
+#include "check.h"
+#include "programs.h"
+#include <cpu/cpu.h>
+#include <runner/batch_runner.h>
+#include <vector>
+
+// A batch job stops at its instruction or cycle budget, whichever comes
+// first, on every engine, and ends where the switch loop ends the same job.
+
+using namespace nes_simulator;
+namespace programs = nes_simulator::test_programs;
+
+namespace {
+
+constexpr Engine engines[] = {Engine::Switch, Engine::Threaded,
+                              Engine::Cached, Engine::Jit};
+
+struct budget {
+  uint64 instructions;
+  uint64 cycles;
+};
+
+// The snake without input runs some 15,000 instructions before it halts,
+// far more than any budget here but the unlimited one.
+constexpr budget budgets[] = {
+    {100, 0}, {1, 0}, {0, 1000}, {100, 250}, {100, 100000}, {0, 0},
+};
+
+batch_job snake_job(Engine engine, budget limit) {
+  batch_job job;
+  job.setup = [engine](cpu &c) {
+    c.engine = engine;
+    programs::load(c, programs::all().back());
+  };
+  job.max_instructions = limit.instructions;
+  job.max_cycles = limit.cycles;
+  return job;
+}
+
+void stays_in_budget() {
+  cpu fresh;
+  programs::load(fresh, programs::all().back());
+
+  std::vector<batch_job> jobs;
+  for (Engine engine : engines) {
+    for (budget limit : budgets) {
+      jobs.push_back(snake_job(engine, limit));
+    }
+  }
+  batch_runner runner(2);
+  const auto results = runner.run(jobs);
+
+  constexpr std::size_t per_engine = std::size(budgets);
+  for (std::size_t i = 0; i < results.size(); i++) {
+    const batch_result &result = results[i];
+    const batch_result &reference = results[i % per_engine];
+    const budget limit = budgets[i % per_engine];
+    const uint64 ran = result.registers.instructions - fresh.instructions;
+    const uint64 spent = result.registers.cycles - fresh.cycles;
+    CHECK(result.error.empty());
+
+    if (limit.instructions) {
+      CHECK(ran <= limit.instructions);
+    }
+    if (limit.cycles) {
+      // Whole instructions, so at most one runs past the deadline.
+      CHECK(spent < limit.cycles + 8);
+    }
+    if (!result.registers.halted) {
+      CHECK(ran == limit.instructions ||
+            (limit.cycles && spent >= limit.cycles));
+    }
+    CHECK_EQ(result.registers.halted, !limit.instructions && !limit.cycles);
+    CHECK_EQ(result.digest, reference.digest);
+    CHECK_EQ(result.registers.instructions, reference.registers.instructions);
+  }
+}
+
+} // namespace
+
+int main() {
+  stays_in_budget();
+  return 0;
+}
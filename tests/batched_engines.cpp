@@ -0,0 +1,119 @@
+#include "check.h"
+#include "programs.h"
+#include <cpu/cpu.h>
+#include <cpu/interpreter.h>
+#include <cstring>
+#include <limits>
+
+// Every batched entry point runs the engine the cpu is set to: each ends
+// where that engine's own run() ends, predicates see the running count on
+// every engine, and the decode cache engines run the code they decoded even
+// after it is overwritten behind their back.
+
+using namespace nes_simulator;
+namespace programs = nes_simulator::test_programs;
+
+namespace {
+
+constexpr Engine engines[] = {Engine::Switch, Engine::Threaded,
+                              Engine::Cached, Engine::Jit};
+
+enum class entry { Instructions, Cycles, Until, Frame };
+constexpr entry entries[] = {entry::Instructions, entry::Cycles, entry::Until,
+                             entry::Frame};
+
+// Runs `c` to its halt through `how`, in batches small enough that hooks,
+// deadlines and restarts all come into play.
+void run_to_halt(cpu &c, entry how) {
+  for (int batch = 0; !c.halted; batch++) {
+    CHECK(batch < 1000000);
+    switch (how) {
+    case entry::Instructions:
+      c.run_instructions(97);
+      break;
+    case entry::Cycles:
+      c.run_cycles(301);
+      break;
+    case entry::Until: {
+      const uint64 stop = c.instructions + 89;
+      c.run_until([stop](const cpu &c) { return c.instructions >= stop; });
+      break;
+    }
+    case entry::Frame:
+      c.run_frame(1000);
+      break;
+    }
+  }
+}
+
+void matches_run() {
+  for (const auto &program : programs::all()) {
+    for (Engine engine : engines) {
+      cpu reference;
+      reference.engine = engine;
+      programs::load(reference, program);
+      reference.run();
+
+      for (entry how : entries) {
+        cpu c;
+        c.engine = engine;
+        programs::load(c, program);
+        // Interval hooks cut every kind of run into more batches.
+        c.add_interval_hook(53, [](cpu &) {});
+        run_to_halt(c, how);
+        CHECK_EQ(c.state_digest(), reference.state_digest());
+        CHECK_EQ(c.instructions, reference.instructions);
+      }
+    }
+  }
+}
+
+// A predicate sees the instruction it let run counted.
+bool counts_as_it_goes(Engine engine) {
+  cpu c;
+  c.engine = engine;
+  programs::load(c, programs::all().front());
+  const uint64 start = c.instructions;
+  uint64 calls = 0;
+  c.run_until([&](const cpu &at) {
+    return at.instructions != start || ++calls > 10;
+  });
+  return c.instructions == start + 1;
+}
+
+// Puts a BRK over the first instruction of a program that has run once,
+// writing `memory` directly rather than through the cpu. Only the decode
+// cache engines run the old code again.
+bool runs_stale_code(Engine engine, entry how) {
+  cpu c;
+  c.engine = engine;
+  programs::load(c, programs::all().front());
+  run_to_halt(c, how);
+
+  c.memory[0x600] = 0x00;
+  c.reset();
+  const uint64 before = c.instructions;
+  run_to_halt(c, how);
+  return c.instructions - before > 1;
+}
+
+void engine_specific() {
+  for (Engine engine : engines) {
+    CHECK(counts_as_it_goes(engine));
+  }
+
+  for (entry how : entries) {
+    CHECK(!runs_stale_code(Engine::Switch, how));
+    CHECK(!runs_stale_code(Engine::Threaded, how));
+    CHECK(runs_stale_code(Engine::Cached, how));
+    CHECK(runs_stale_code(Engine::Jit, how));
+  }
+}
+
+} // namespace
+
+int main() {
+  matches_run();
+  engine_specific();
+  return 0;
+}
@@ -0,0 +1,90 @@
+#include "check.h"
+#include <cpu/cpu.h>
+#include <cpu/interpreter.h>
+#include <vector>
+
+// Runs under debug_policy stop before the instruction at a breakpoint, on
+// every engine and through every batched entry point; the next run executes
+// it and goes on until the breakpoint comes round again. Runs under
+// fast_policy do not see breakpoints at all.
+
+using namespace nes_simulator;
+
+namespace {
+
+constexpr Engine engines[] = {Engine::Switch, Engine::Threaded,
+                              Engine::Cached, Engine::Jit};
+
+const std::vector<uint8> code = {
+    0xA2, 0x00, //   LDX #$00
+    0xE8,       // loop: INX
+    0xE0, 0x03, //   CPX #$03
+    0xD0, 0xFB, //   BNE loop
+    0x86, 0x10, //   STX $10
+    0x00,       //   BRK
+};
+constexpr uint16 LOOP = 0x0602;
+
+enum class entry { Instructions, Cycles, Until };
+constexpr entry entries[] = {entry::Instructions, entry::Cycles, entry::Until};
+
+void run_debug(cpu &c, entry how) {
+  switch (how) {
+  case entry::Instructions:
+    c.run_instructions<debug_policy>(1000);
+    break;
+  case entry::Cycles:
+    c.run_cycles<debug_policy>(3000);
+    break;
+  case entry::Until:
+    c.run_until<debug_policy>([](const cpu &) { return false; });
+    break;
+  }
+}
+
+void stops_and_resumes(Engine engine, entry how) {
+  cpu c;
+  c.engine = engine;
+  c.load(code.data(), static_cast<int>(code.size()));
+  c.reset();
+  c.add_breakpoint(LOOP);
+
+  // Stops before the INX, then runs it and comes round once per pass.
+  for (uint8 pass = 0; pass < 3; pass++) {
+    run_debug(c, how);
+    CHECK(c.at_breakpoint);
+    CHECK(!c.halted);
+    CHECK_EQ(c.pc, LOOP);
+    CHECK_EQ(c.reg_x, pass);
+    CHECK_EQ(c.instructions, 1 + 3 * uint64{pass});
+  }
+
+  c.remove_breakpoint(LOOP);
+  run_debug(c, how);
+  CHECK(!c.at_breakpoint);
+  CHECK(c.halted);
+  CHECK_EQ(c.memory[0x10], 3);
+}
+
+void fast_policy_ignores(Engine engine) {
+  cpu c;
+  c.engine = engine;
+  c.load(code.data(), static_cast<int>(code.size()));
+  c.reset();
+  c.add_breakpoint(LOOP);
+  c.run_instructions(1000);
+  CHECK(c.halted);
+  CHECK_EQ(c.memory[0x10], 3);
+}
+
+} // namespace
+
+int main() {
+  for (Engine engine : engines) {
+    for (entry how : entries) {
+      stops_and_resumes(engine, how);
+    }
+    fast_policy_ignores(engine);
+  }
+  return 0;
+}
@@ -0,0 +1,115 @@
+#include "check.h"
+#include <cpu/cpu.h>
+#include <cpu/interpreter.h>
+#include <vector>
+
+// Code runs from RAM mirrors and from ROM on every engine; ROM pages read
+// the caller's buffer in place; and code decoded at one mirror is dropped
+// by a write through another.
+
+using namespace nes_simulator;
+
+namespace {
+
+constexpr Engine engines[] = {Engine::Switch, Engine::Threaded,
+                              Engine::Cached, Engine::Jit};
+
+// 2 KB of RAM mirrored through $0000-$1FFF and ROM at $8000-$FFFF.
+void nes_layout(cpu &c, const std::vector<uint8> &rom) {
+  c.bus.map_ram(0x0000, 0x2000, 0x800);
+  c.bus.unmap(0x2000, 0x8000);
+  c.bus.map_rom(0x8000, 0x10000, rom.data(), rom.size());
+}
+
+// LDX #$00 / loop: INX / CPX #$40 / BNE loop / STX $10 / BRK at `at`.
+void write_counter(uint8 *at) {
+  const uint8 code[] = {0xA2, 0x00, 0xE8, 0xE0, 0x40, 0xD0, 0xFB,
+                        0x86, 0x10, 0x00};
+  for (uint32 i = 0; i < sizeof(code); i++) {
+    at[i] = code[i];
+  }
+}
+
+void rom_is_read_in_place() {
+  std::vector<uint8> rom(0x4000);
+  cpu c;
+  nes_layout(c, rom);
+  CHECK(c.bus.read_page(0x8000) == rom.data());
+  CHECK(c.bus.read_page(0xC000) == rom.data());
+  CHECK(c.bus.read_page(0xFF00) == rom.data() + 0x3F00);
+  CHECK(c.memory[0x8000] == 0);
+}
+
+void runs_from_rom() {
+  std::vector<uint8> rom(0x8000);
+  write_counter(&rom[0x0100]);
+  rom[0x7FFC] = 0x00;
+  rom[0x7FFD] = 0x81;
+  for (Engine engine : engines) {
+    cpu c;
+    c.engine = engine;
+    nes_layout(c, rom);
+    c.reset();
+    c.run_instructions(1000);
+    CHECK(c.halted);
+    CHECK_EQ(c.memory[0x10], 0x40);
+  }
+}
+
+// The program is written at $0200 and run at $0A00, its second mirror; then
+// its loop bound is rewritten through the third, at $1200.
+void runs_from_ram_mirror() {
+  std::vector<uint8> rom(0x4000);
+  rom[0x3FFC] = 0x00;
+  rom[0x3FFD] = 0x0A;
+  for (Engine engine : engines) {
+    cpu c;
+    c.engine = engine;
+    nes_layout(c, rom);
+    write_counter(c.memory + 0x200);
+    c.reset();
+    c.run_instructions(1000);
+    CHECK(c.halted);
+    CHECK_EQ(c.memory[0x10], 0x40);
+
+    c.mem_write(0x1204, 0x20);
+    c.reset();
+    c.run_instructions(1000);
+    CHECK(c.halted);
+    CHECK_EQ(c.memory[0x10], 0x20);
+  }
+}
+
+// A running block rewrites its own loop bound through a mirror; the decode
+// cache engines must see the write as they would at the code's own address.
+void self_modifying_mirror() {
+  std::vector<uint8> rom(0x4000);
+  rom[0x3FFC] = 0x00;
+  rom[0x3FFD] = 0x0A;
+  // LDX #$00 / loop: INX / LDA #$10 / STA $1209 / CPX #$40 / BNE loop /
+  // STX $10 / BRK, where $1209 is the CPX operand.
+  const uint8 code[] = {0xA2, 0x00, 0xE8, 0xA9, 0x10, 0x8D, 0x09, 0x12,
+                        0xE0, 0x40, 0xD0, 0xF6, 0x86, 0x10, 0x00};
+  for (Engine engine : engines) {
+    cpu c;
+    c.engine = engine;
+    nes_layout(c, rom);
+    for (uint32 i = 0; i < sizeof(code); i++) {
+      c.mem_write(0x0200 + i, code[i]);
+    }
+    c.reset();
+    c.run_instructions(1000);
+    CHECK(c.halted);
+    CHECK_EQ(c.memory[0x10], 0x10);
+  }
+}
+
+} // namespace
+
+int main() {
+  rom_is_read_in_place();
+  runs_from_rom();
+  runs_from_ram_mirror();
+  self_modifying_mirror();
+  return 0;
+}
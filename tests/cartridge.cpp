@@ -0,0 +1,78 @@
+#include "check.h"
+#include <algorithm>
+#include <cartridge/cartridge.h>
+#include <cpu/cpu.h>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// A mapped cartridge's ROM pages point into its file mapping, not into a
+// copy, and code runs from them.
+
+using namespace nes_simulator;
+
+namespace {
+
+// Writes an NROM image with `banks` 16 KB PRG banks, each filled with its
+// index, whose reset vector points at a BRK at $8000.
+std::string write_rom(uint8 banks) {
+  std::vector<uint8> file(INES_HEADER_SIZE + banks * PRG_BANK_SIZE);
+  file[0] = 'N';
+  file[1] = 'E';
+  file[2] = 'S';
+  file[3] = 0x1A;
+  file[4] = banks;
+  for (uint8 bank = 0; bank < banks; bank++) {
+    std::fill_n(&file[INES_HEADER_SIZE + bank * PRG_BANK_SIZE], PRG_BANK_SIZE,
+                bank);
+  }
+  const std::size_t vector = file.size() - 4;
+  file[vector] = 0x00;
+  file[vector + 1] = 0x80;
+  file[INES_HEADER_SIZE] = 0x00;
+
+  const auto path = std::filesystem::temp_directory_path() /
+                    ("nes_cartridge_test_" + std::to_string(banks) + ".nes");
+  std::FILE *out = std::fopen(path.c_str(), "wb");
+  CHECK(out != nullptr);
+  CHECK(std::fwrite(file.data(), 1, file.size(), out) == file.size());
+  std::fclose(out);
+  return path.string();
+}
+
+bool inside(const uint8 *page, std::span<const uint8> mapping) {
+  return page >= mapping.data() &&
+         page + memory_bus::PAGE_SIZE <= mapping.data() + mapping.size();
+}
+
+void maps_in_place(uint8 banks) {
+  const std::string path = write_rom(banks);
+  {
+    const cartridge cart(path);
+    cpu c;
+    cart.map(c);
+
+    const auto prg = cart.prg_rom();
+    for (uint32 addr = 0x8000; addr < 0x10000; addr += memory_bus::PAGE_SIZE) {
+      const uint8 *page = c.bus.read_page(addr);
+      CHECK(inside(page, prg));
+      CHECK(page == prg.data() + (addr - 0x8000) % prg.size());
+    }
+    CHECK_EQ(c.mem_read(0xC000), banks - 1);
+
+    c.reset();
+    CHECK_EQ(c.pc, 0x8000);
+    c.run();
+    CHECK(c.halted);
+  }
+  std::filesystem::remove(path);
+}
+
+} // namespace
+
+int main() {
+  maps_in_place(1);
+  maps_in_place(2);
+  return 0;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+// Each test is a binary that exits non-zero at its first failed check, so
+// `xmake test` needs no framework to run them.
+#define CHECK(condition)                                                       \
+  do {                                                                         \
+    if (!(condition)) {                                                        \
+      std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,    \
+                   #condition);                                                \
+      std::exit(1);                                                            \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_EQ(actual, expected)                                             \
+  do {                                                                         \
+    const auto actual_value = (actual);                                        \
+    const auto expected_value = (expected);                                    \
+    if (!(actual_value == expected_value)) {                                   \
+      std::fprintf(stderr, "%s:%d: check failed: %s == %s (%llx vs %llx)\n",  \
+                   __FILE__, __LINE__, #actual, #expected,                     \
+                   static_cast<unsigned long long>(actual_value),              \
+                   static_cast<unsigned long long>(expected_value));           \
+      std::exit(1);                                                            \
+    }                                                                          \
+  } while (0)
@@ -0,0 +1,75 @@
+#include "check.h"
+#include "programs.h"
+#include <cpu/cpu.h>
+#include <cpu/interpreter.h>
+#include <vector>
+
+// Every engine, the Jit included, ends each program in the state the switch
+// loop ends it in. The programs run again and again from reset without
+// reloading, so the Jit's blocks get hot and run natively in later rounds,
+// and code a program rewrote in one round runs in the next.
+
+using namespace nes_simulator;
+namespace programs = nes_simulator::test_programs;
+
+namespace {
+
+constexpr Engine engines[] = {Engine::Threaded, Engine::Cached, Engine::Jit};
+constexpr int ROUNDS = 2 * jit_compiler::HOT_ENTRIES;
+
+enum class entry { Run, Instructions, Cycles };
+constexpr entry entries[] = {entry::Run, entry::Instructions, entry::Cycles};
+
+void run_to_halt(cpu &c, entry how) {
+  for (int batch = 0; !c.halted; batch++) {
+    CHECK(batch < 1000000);
+    switch (how) {
+    case entry::Run:
+      c.run();
+      break;
+    case entry::Instructions:
+      c.run_instructions(1000);
+      break;
+    case entry::Cycles:
+      c.run_cycles(3000);
+      break;
+    }
+  }
+}
+
+void matches_oracle(const programs::program &program) {
+  cpu oracle;
+  oracle.engine = Engine::Switch;
+  programs::load(oracle, program);
+  std::vector<uint64> digests;
+  std::vector<uint64> instructions;
+  for (int round = 0; round < ROUNDS; round++) {
+    oracle.run_switch();
+    digests.push_back(oracle.state_digest());
+    instructions.push_back(oracle.instructions);
+    oracle.reset();
+  }
+
+  for (Engine engine : engines) {
+    for (entry how : entries) {
+      cpu c;
+      c.engine = engine;
+      programs::load(c, program);
+      for (int round = 0; round < ROUNDS; round++) {
+        run_to_halt(c, how);
+        CHECK_EQ(c.state_digest(), digests[round]);
+        CHECK_EQ(c.instructions, instructions[round]);
+        c.reset();
+      }
+    }
+  }
+}
+
+} // namespace
+
+int main() {
+  for (const auto &program : programs::all()) {
+    matches_oracle(program);
+  }
+  return 0;
+}
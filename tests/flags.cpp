@@ -0,0 +1,78 @@
+#include "check.h"
+#include <cpu/cpu.h>
+#include <cpu/interpreter.h>
+#include <vector>
+
+// Z and N written into `status` between runs are the ones the host reads
+// back and the ones the next run branches on, whatever the last run left
+// behind.
+
+using namespace nes_simulator;
+
+namespace {
+
+constexpr Engine engines[] = {Engine::Switch, Engine::Threaded,
+                              Engine::Cached, Engine::Jit};
+
+const std::vector<uint8> code = {
+    0xA9, 0x01, //   LDA #$01
+    0x00,       //   BRK
+    0xF0, 0x02, // branches: BEQ zero
+    0x00, 0x00, //   BRK
+    0x30, 0x02, // zero: BMI negative
+    0x00, 0x00, //   BRK
+    0xE6, 0x10, // negative: INC $10
+    0x00,       //   BRK
+};
+
+constexpr uint8 Z = 0x02;
+constexpr uint8 N = 0x80;
+
+// Runs LDA #$01, which clears Z and N, then writes `flags` into status and
+// runs the branches from there.
+void branches_on(Engine engine, uint8 flags) {
+  cpu c;
+  c.engine = engine;
+  c.load(code.data(), static_cast<int>(code.size()));
+  c.reset();
+  c.run_instructions(10);
+  CHECK(c.halted);
+  CHECK(!c.status_bit_get(flag::ZeroFlag));
+  CHECK(!c.status_bit_get(flag::NegativeFlag));
+
+  c.status = (c.status & ~(Z | N)) | flags;
+  CHECK_EQ(c.status_bit_get(flag::ZeroFlag), (flags & Z) != 0);
+  CHECK_EQ(c.status_bit_get(flag::NegativeFlag), (flags & N) != 0);
+  CHECK_EQ(c.current_status(), c.status);
+
+  c.pc = 0x0603;
+  c.halted = false;
+  c.run_instructions(10);
+  CHECK(c.halted);
+  CHECK_EQ(c.memory[0x10], flags == (Z | N) ? 1 : 0);
+  CHECK_EQ(c.status & (Z | N), flags == (Z | N) ? 0 : flags);
+}
+
+// The flag setters outside a run land in status.
+void sets_status() {
+  cpu c;
+  c.status = 0;
+  c.status_bit_set(flag::ZeroFlag, true);
+  CHECK_EQ(c.status, Z);
+  c.update_zero_negative_flag(0x80);
+  CHECK_EQ(c.status, N);
+  c.status_bit_set(flag::NegativeFlag, false);
+  CHECK_EQ(c.status, 0);
+}
+
+} // namespace
+
+int main() {
+  for (Engine engine : engines) {
+    for (uint8 flags : {uint8{0}, Z, N, uint8{Z | N}}) {
+      branches_on(engine, flags);
+    }
+  }
+  sets_status();
+  return 0;
+}
@@ -0,0 +1,112 @@
+#include "check.h"
+#include <cpu/cpu.h>
+#include <iterator>
+#include <vector>
+
+// The Cached and Jit engines fast-forward idle loops under a cycle deadline
+// or an instruction budget; every engine still ends each run on the
+// instruction, cycle and registers the switch loop ends the same run on,
+// whether the budget runs out inside a loop, on its last lap or after it.
+// Polls of bytes that nothing writes spin until the host writes them, and
+// polls through MMIO handlers see every read.
+
+using namespace nes_simulator;
+
+namespace {
+
+constexpr Engine engines[] = {Engine::Threaded, Engine::Cached, Engine::Jit};
+
+// Counting delay loops, down and up, nested in a third.
+const std::vector<uint8> delays = {
+    0xA0, 0x00, //   LDY #$00
+    0xA2, 0x00, // outer: LDX #$00
+    0xEA,       // down: NOP
+    0xEA,       //   NOP
+    0xCA,       //   DEX
+    0xD0, 0xFB, //   BNE down
+    0xA2, 0xF0, //   LDX #$F0
+    0xE8,       // up: INX
+    0xD0, 0xFD, //   BNE up
+    0x88,       //   DEY
+    0xD0, 0xF1, //   BNE outer
+    0x86, 0x10, //   STX $10
+    0x00,       //   BRK
+};
+
+// Spins on a zero page byte until it is nonzero, then on bit 7 of an
+// absolute byte, which the tests map to an MMIO handler.
+const std::vector<uint8> polls = {
+    0xA5, 0x10,       // zero: LDA $10
+    0xF0, 0xFC,       //   BEQ zero
+    0x2C, 0x00, 0x40, // flag: BIT $4000
+    0x10, 0xFB,       //   BPL flag
+    0x00,             //   BRK
+};
+
+// Budgets that leave runs ending at every point of a lap.
+constexpr uint64 cycle_budgets[] = {1, 2, 5, 7, 64, 997, 5000, 20011};
+constexpr uint64 instruction_budgets[] = {1, 2, 3, 4, 17, 255, 1000, 6007};
+
+enum class entry { Cycles, Instructions };
+
+void load(cpu &c, Engine engine, const std::vector<uint8> &code) {
+  c.engine = engine;
+  c.load(code.data(), static_cast<int>(code.size()));
+  c.reset();
+}
+
+// Reads of $4000 return bit 7 set from the 300th on.
+void map_flag(cpu &c, uint32 &reads) {
+  c.bus.map_mmio(
+      0x4000, 0x4100,
+      [&reads](uint16) { return uint8(++reads >= 300 ? 0x80 : 0x00); },
+      [](uint16, uint8) {});
+}
+
+void run(cpu &c, entry how, uint64 budget) {
+  if (how == entry::Cycles) {
+    c.run_cycles(budget);
+  } else {
+    c.run_instructions(budget);
+  }
+}
+
+void matches_switch(Engine engine, entry how,
+                    const std::vector<uint8> &code) {
+  cpu oracle, c;
+  load(oracle, Engine::Switch, code);
+  load(c, engine, code);
+  uint32 oracle_reads = 0, reads = 0;
+  map_flag(oracle, oracle_reads);
+  map_flag(c, reads);
+
+  const auto *budgets =
+      how == entry::Cycles ? cycle_budgets : instruction_budgets;
+  for (uint32 call = 0; !oracle.halted; call++) {
+    CHECK(call < 1000000);
+    // The zero page poll exits once the host writes its byte.
+    if (call == 40) {
+      oracle.mem_write(0x10, 1);
+      c.mem_write(0x10, 1);
+    }
+    const uint64 budget = budgets[call % std::size(cycle_budgets)];
+    run(oracle, how, budget);
+    run(c, how, budget);
+    CHECK_EQ(c.state_digest(), oracle.state_digest());
+    CHECK_EQ(c.instructions, oracle.instructions);
+    CHECK_EQ(c.halted, oracle.halted);
+    CHECK_EQ(reads, oracle_reads);
+  }
+}
+
+} // namespace
+
+int main() {
+  for (Engine engine : engines) {
+    for (entry how : {entry::Cycles, entry::Instructions}) {
+      matches_switch(engine, how, delays);
+      matches_switch(engine, how, polls);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,138 @@
+#include "check.h"
+#include "programs.h"
+#include <cpu/cpu.h>
+#include <cpu/lockstep.h>
+#include <programs/snake.h>
+#include <vector>
+
+// Every lane of a lockstep run ends bit-identical to a cpu that ran the same
+// instructions on its own, while the lanes' inputs send them down different
+// paths and some of them halt along the way.
+
+using namespace nes_simulator;
+namespace programs = nes_simulator::test_programs;
+
+namespace {
+
+// Loops a number of times given by the input at $00 and halts early for some
+// inputs, so lanes split, meet again at the top and drop out one by one.
+const std::vector<uint8> diverging = {
+    0xA5, 0x00,       // start: LDA $00
+    0x29, 0x07,       //   AND #$07
+    0xF0, 0x25,       //   BEQ stop
+    0xA6, 0x00,       //   LDX $00
+    0xA0, 0x00,       //   LDY #$00
+    0x8A,             // loop: TXA
+    0x18,             //   CLC
+    0x65, 0x01,       //   ADC $01
+    0x85, 0x01,       //   STA $01
+    0x4A,             //   LSR A
+    0x90, 0x02,       //   BCC even
+    0xE6, 0x02,       //   INC $02
+    0x48,             // even: PHA
+    0x68,             //   PLA
+    0x45, 0x00,       //   EOR $00
+    0x99, 0x00, 0x03, //   STA $0300,Y
+    0xC8,             //   INY
+    0xCA,             //   DEX
+    0xD0, 0xEA,       //   BNE loop
+    0xA5, 0x01,       //   LDA $01
+    0xC9, 0xA0,       //   CMP #$A0
+    0xB0, 0x05,       //   BCS stop
+    0xE6, 0x00,       //   INC $00
+    0x4C, 0x00, 0x06, //   JMP start
+    0x00,             // stop: BRK
+};
+
+// Feeds lane `lane` its input for slice `slice`; the same call drives the
+// reference cpus.
+using feed = void (*)(cpu &, uint32 lane, uint32 slice);
+
+void feed_counter(cpu &c, uint32 lane, uint32 slice) {
+  if (slice == 0) {
+    c.mem_write(0x00, static_cast<uint8>(lane * 37 + 1));
+  }
+}
+
+void feed_snake(cpu &c, uint32 lane, uint32 slice) {
+  static constexpr uint8 keys[] = {snake::KEY_RIGHT, snake::KEY_DOWN,
+                                   snake::KEY_LEFT, snake::KEY_UP};
+  c.mem_write(snake::RANDOM, snake::random_byte(lane * 7919 + slice * 31));
+  if ((slice + lane) % 3 == 0) {
+    c.mem_write(snake::INPUT, keys[(slice * 5 + lane) % 4]);
+  }
+}
+
+void check_lane(const cpu &lane, const cpu &reference) {
+  CHECK_EQ(lane.state_digest(), reference.state_digest());
+  CHECK_EQ(lane.instructions, reference.instructions);
+  CHECK_EQ(lane.cycles, reference.cycles);
+  CHECK_EQ(lane.halted, reference.halted);
+}
+
+// Runs `lanes` copies of `code` in slices of `slice_size` instructions,
+// feeding each lane its own input before every slice, against one cpu per
+// lane running the switch loop.
+void matches_scalar(const std::vector<uint8> &code, feed input, uint32 lanes,
+                    uint32 slices, uint64 slice_size) {
+  lockstep_cpu group(lanes);
+  std::vector<cpu> references(lanes);
+  for (uint32 i = 0; i < lanes; i++) {
+    programs::load(group.lane(i), {"", code});
+    programs::load(references[i], {"", code});
+    references[i].engine = Engine::Switch;
+  }
+
+  for (uint32 slice = 0; slice < slices; slice++) {
+    for (uint32 i = 0; i < lanes; i++) {
+      input(group.lane(i), i, slice);
+      input(references[i], i, slice);
+    }
+    group.run_instructions(slice_size);
+    for (uint32 i = 0; i < lanes; i++) {
+      references[i].run_instructions(slice_size);
+      check_lane(group.lane(i), references[i]);
+    }
+  }
+}
+
+void halting_lanes() {
+  matches_scalar(diverging, feed_counter, lockstep_cpu::MAX_LANES, 400, 97);
+
+  // Every lane halts: some on their first pass, the rest after passes of
+  // different lengths.
+  lockstep_cpu group(lockstep_cpu::MAX_LANES);
+  for (uint32 i = 0; i < group.lanes(); i++) {
+    programs::load(group.lane(i), {"", diverging});
+    feed_counter(group.lane(i), i, 0);
+  }
+  group.run_instructions(1 << 16);
+  uint32 halted = 0;
+  for (uint32 i = 0; i < group.lanes(); i++) {
+    CHECK(group.lane(i).halted);
+    halted += group.lane(i).instructions < 10;
+  }
+  CHECK(halted > 0 && halted < group.lanes());
+}
+
+void divergent_snakes() {
+  const std::vector<uint8> game(std::begin(snake::game_code),
+                                std::end(snake::game_code));
+  matches_scalar(game, feed_snake, lockstep_cpu::MAX_LANES, 60, 1000);
+  matches_scalar(game, feed_snake, 5, 60, 1000);
+}
+
+void every_program() {
+  for (const auto &program : programs::all()) {
+    matches_scalar(program.code, feed_counter, 3, 1, 1 << 20);
+  }
+}
+
+} // namespace
+
+int main() {
+  halting_lanes();
+  divergent_snakes();
+  every_program();
+  return 0;
+}
@@ -0,0 +1,229 @@
+#include "check.h"
+#include <cpu/cpu.h>
+#include <cstddef>
+#include <filesystem>
+#include <frontend/movie.h>
+#include <frontend/snake_session.h>
+#include <optional>
+#include <programs/snake.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// A movie reads back as the header and events it was written with. A snake
+// session replayed from its movie, as headless --replay plays it, shows the
+// screens the recording showed, frame for frame and on every engine, and
+// ends in the same state.
+
+using namespace nes_simulator;
+
+namespace {
+
+constexpr Engine engines[] = {Engine::Switch, Engine::Threaded,
+                              Engine::Cached, Engine::Jit};
+
+using event_type = movie_event::type;
+
+std::string temp_path(const std::string &name) {
+  return (std::filesystem::temp_directory_path() /
+          ("nes_movie_test_" + name + ".mov"))
+      .string();
+}
+
+bool same(const movie_event &a, const movie_event &b) {
+  return a.kind == b.kind && a.frame == b.frame && a.key == b.key &&
+         a.hash == b.hash;
+}
+
+// Frame gaps long enough to take several LEB128 bytes, and a hash with
+// every byte set.
+const std::vector<movie_event> events = {
+    {event_type::Key, 0, 'w', 0},
+    {event_type::Screen, 0, 0, 0xFEDCBA9876543210},
+    {event_type::Key, 200, 'd', 0},
+    {event_type::RewindStart, 70000, 0, 0},
+    {event_type::RewindStop, 70010, 0, 0},
+    {event_type::Screen, uint64{1} << 40, 0, 1},
+};
+
+movie_header test_header() {
+  movie_header header{};
+  header.seed = 0xC0FFEE;
+  header.cpu_frequency = 1789773;
+  header.start_digest = 0x0123456789ABCDEF;
+  header.rewind_frames = 600;
+  header.rewind_bytes = 4 << 20;
+  return header;
+}
+
+void round_trips_events() {
+  const auto path = temp_path("events");
+  {
+    movie_writer writer(path, test_header());
+    for (const auto &event : events) {
+      writer.write(event);
+    }
+    writer.close(events.back().frame + 1);
+  }
+
+  movie_reader reader(path);
+  const movie_header &header = reader.header();
+  CHECK_EQ(header.version, movie_header::VERSION);
+  CHECK_EQ(header.seed, test_header().seed);
+  CHECK_EQ(header.cpu_frequency, test_header().cpu_frequency);
+  CHECK_EQ(header.start_digest, test_header().start_digest);
+  CHECK_EQ(header.rewind_frames, test_header().rewind_frames);
+  CHECK_EQ(header.rewind_bytes, test_header().rewind_bytes);
+  for (const auto &event : events) {
+    const auto read = reader.next();
+    CHECK(read && same(*read, event));
+  }
+  const auto end = reader.next();
+  CHECK(end && same(*end, {event_type::End, events.back().frame + 1, 0, 0}));
+  CHECK(!reader.next());
+  std::filesystem::remove(path);
+}
+
+// A movie cut off part way through an event ends after the last whole one.
+void reads_movies_cut_short() {
+  const auto path = temp_path("cut");
+  {
+    movie_writer writer(path, test_header());
+    for (const auto &event : events) {
+      writer.write(event);
+    }
+  }
+  // Part of the last Screen event's hash, and the End event after it.
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 6);
+  movie_reader reader(path);
+  for (std::size_t i = 0; i + 1 < events.size(); i++) {
+    const auto read = reader.next();
+    CHECK(read && same(*read, events[i]));
+  }
+  CHECK(!reader.next());
+  std::filesystem::remove(path);
+}
+
+void rejects_other_versions() {
+  const auto path = temp_path("version");
+  {
+    movie_writer writer(path, test_header());
+  }
+  std::FILE *file = std::fopen(path.c_str(), "r+b");
+  CHECK(file != nullptr);
+  const uint32 old_version = movie_header::VERSION - 1;
+  std::fseek(file, offsetof(movie_header, version), SEEK_SET);
+  CHECK(std::fwrite(&old_version, sizeof(old_version), 1, file) == 1);
+  std::fclose(file);
+
+  bool threw = false;
+  try {
+    movie_reader reader(path);
+  } catch (const std::runtime_error &) {
+    threw = true;
+  }
+  std::filesystem::remove(path);
+  CHECK(threw);
+}
+
+void load_snake(cpu &c, Engine engine) {
+  c.engine = engine;
+  c.load(snake::game_code, sizeof(snake::game_code));
+  c.reset();
+}
+
+// Steers the snake round a few corners, rewinds over one of them and plays
+// on, recording every frame's screen hash.
+std::vector<uint64> record(const std::string &path, uint64 &digest) {
+  cpu c;
+  load_snake(c, Engine::Switch);
+  snake_session session(c, 16000, 42);
+  movie_writer writer(path, session.header());
+  session.record_to(&writer);
+
+  std::vector<uint64> hashes;
+  for (uint64 frame = 0; frame < 400 && !c.halted; frame++) {
+    switch (frame) {
+    case 10:
+      session.press('s');
+      break;
+    case 40:
+      session.press('d');
+      break;
+    case 70:
+      session.press('w');
+      break;
+    case 100:
+      session.set_rewinding(true);
+      break;
+    case 130:
+      session.set_rewinding(false);
+      session.press('a');
+      break;
+    }
+    hashes.push_back(session.run_frame());
+  }
+  writer.close(session.frames());
+  digest = c.state_digest();
+  return hashes;
+}
+
+// Headless --replay's loop: events before the frame, its screen after.
+void replays(const std::string &path, Engine engine,
+             const std::vector<uint64> &hashes, uint64 digest) {
+  movie_reader movie(path);
+  const auto &header = movie.header();
+  cpu c;
+  load_snake(c, engine);
+  CHECK_EQ(c.state_digest(), header.start_digest);
+  snake_session session(c, header.cpu_frequency, header.seed,
+                        header.rewind_frames, header.rewind_bytes);
+
+  auto event = movie.next();
+  std::optional<uint64> expected;
+  while (event && !(event->kind == event_type::End &&
+                    event->frame == session.frames())) {
+    const uint64 frame = session.frames();
+    for (; event && event->frame == frame; event = movie.next()) {
+      if (event->kind == event_type::Key) {
+        session.press(event->key);
+      } else if (event->kind == event_type::RewindStart) {
+        session.set_rewinding(true);
+      } else if (event->kind == event_type::RewindStop) {
+        session.set_rewinding(false);
+      } else {
+        break;
+      }
+    }
+    const uint64 hash = session.run_frame();
+    if (event && event->kind == event_type::Screen && event->frame == frame) {
+      expected = event->hash;
+      event = movie.next();
+    }
+    CHECK(expected && hash == *expected);
+    CHECK(frame < hashes.size());
+    CHECK_EQ(hash, hashes[frame]);
+  }
+  CHECK_EQ(session.frames(), hashes.size());
+  CHECK_EQ(c.state_digest(), digest);
+}
+
+void replays_sessions() {
+  const auto path = temp_path("session");
+  uint64 digest;
+  const auto hashes = record(path, digest);
+  for (Engine engine : engines) {
+    replays(path, engine, hashes, digest);
+  }
+  std::filesystem::remove(path);
+}
+
+} // namespace
+
+int main() {
+  round_trips_events();
+  reads_movies_cut_short();
+  rejects_other_versions();
+  replays_sessions();
+  return 0;
+}
@@ -0,0 +1,164 @@
+#include "check.h"
+#include <cstddef>
+#include <frontend/palette.h>
+#include <utils/random.h>
+#include <vector>
+
+// Every kernel the host can run expands indices to the pixels and change
+// masks a plain per-pixel lookup gives, for nibble-indexed palettes and
+// others, at lengths that end inside and between whole blocks, and at
+// addresses that are not aligned to any of them.
+
+using namespace nes_simulator;
+
+namespace {
+
+constexpr palette_isa isas[] = {palette_isa::Scalar, palette_isa::Ssse3,
+                                palette_isa::Avx2};
+
+// Whole blocks are 8, 16 and 32 pixels; the rest leave tails of every
+// length up to 31 behind some block.
+constexpr std::size_t lengths[] = {0,  1,  3,  7,  8,  9,  15,  16,  17,
+                                   31, 32, 33, 47, 63, 64, 65,  100, 127,
+                                   128, 129, 255, 256, 257, 1000, 1024};
+constexpr std::size_t MAX_LENGTH = 1024;
+// Offsets of src and dst from an aligned start.
+constexpr std::size_t OFFSET = 3;
+
+palette nibble_palette() {
+  std::vector<uint32> colors;
+  for (uint32 i = 0; i < 16; i++) {
+    colors.push_back(rgba(i * 16, 255 - i * 9, i * i, 0xF0 | i));
+  }
+  return palette(colors);
+}
+
+// 64 colors, so indices that share a low nibble differ.
+palette wide_palette() {
+  std::vector<uint32> colors;
+  for (uint32 i = 0; i < 64; i++) {
+    colors.push_back(rgba(i * 4, i ^ 0x5A, 255 - i, i * 3));
+  }
+  return palette(colors);
+}
+
+struct expansion {
+  std::vector<uint8> src;
+  // The pixels dst holds before the expansion, which match the new ones at
+  // about half the positions.
+  std::vector<uint32> before;
+};
+
+expansion make_expansion(pcg32 &random, const palette &pal) {
+  expansion e;
+  for (std::size_t i = 0; i < MAX_LENGTH; i++) {
+    e.src.push_back(random());
+    e.before.push_back(random() % 2 ? pal[e.src[i]] : random());
+  }
+  return e;
+}
+
+std::vector<uint64> expected_mask(const expansion &e, const palette &pal,
+                                  std::size_t count, bool &changed) {
+  std::vector<uint64> mask((count + 63) / 64);
+  changed = false;
+  for (std::size_t i = 0; i < count; i++) {
+    if (e.before[i] != pal[e.src[i]]) {
+      mask[i / 64] |= uint64{1} << i % 64;
+      changed = true;
+    }
+  }
+  return mask;
+}
+
+void expands_rgba32(palette_isa isa, const palette &pal, const expansion &e,
+                    std::size_t count) {
+  bool expected_changed;
+  const auto expected = expected_mask(e, pal, count, expected_changed);
+
+  std::vector<uint8> src(OFFSET + count);
+  std::vector<uint32> dst(1 + count + 1, 0xDEADBEEF);
+  for (std::size_t i = 0; i < count; i++) {
+    src[OFFSET + i] = e.src[i];
+    dst[1 + i] = e.before[i];
+  }
+  std::vector<uint64> mask((count + 63) / 64, ~uint64{0});
+  const bool changed = expand_palette_rgba32(&src[OFFSET], &dst[1], count,
+                                             pal, mask.data(), isa);
+  CHECK_EQ(changed, expected_changed);
+  CHECK(mask == expected);
+  for (std::size_t i = 0; i < count; i++) {
+    CHECK_EQ(dst[1 + i], pal[e.src[i]]);
+  }
+  CHECK_EQ(dst.front(), 0xDEADBEEFu);
+  CHECK_EQ(dst.back(), 0xDEADBEEFu);
+
+  // Again, without a mask: nothing changes now.
+  CHECK(!expand_palette_rgba32(&src[OFFSET], &dst[1], count, pal, nullptr,
+                               isa));
+}
+
+void expands_rgb24(palette_isa isa, const palette &pal, const expansion &e,
+                   std::size_t count) {
+  // RGB24 drops alpha, so a pixel differing only there is unchanged.
+  expansion opaque = e;
+  for (std::size_t i = 0; i < count; i++) {
+    const uint32 alpha_only = pal[e.src[i]] ^ 0xFF000000;
+    if (i % 7 == 0) {
+      opaque.before[i] = alpha_only;
+    }
+  }
+  std::vector<uint64> expected((count + 63) / 64);
+  bool expected_changed = false;
+  for (std::size_t i = 0; i < count; i++) {
+    if ((opaque.before[i] ^ pal[e.src[i]]) & 0xFFFFFF) {
+      expected[i / 64] |= uint64{1} << i % 64;
+      expected_changed = true;
+    }
+  }
+
+  std::vector<uint8> src(OFFSET + count);
+  std::vector<uint8> dst(OFFSET + count * 3 + 4, 0xA5);
+  for (std::size_t i = 0; i < count; i++) {
+    src[OFFSET + i] = e.src[i];
+    for (int channel = 0; channel < 3; channel++) {
+      dst[OFFSET + i * 3 + channel] = opaque.before[i] >> channel * 8;
+    }
+  }
+  std::vector<uint64> mask((count + 63) / 64, ~uint64{0});
+  const bool changed = expand_palette_rgb24(&src[OFFSET], &dst[OFFSET], count,
+                                            pal, mask.data(), isa);
+  CHECK_EQ(changed, expected_changed);
+  CHECK(mask == expected);
+  for (std::size_t i = 0; i < count; i++) {
+    for (int channel = 0; channel < 3; channel++) {
+      CHECK_EQ(dst[OFFSET + i * 3 + channel],
+               uint8(pal[e.src[i]] >> channel * 8));
+    }
+  }
+  for (std::size_t i = 0; i < OFFSET; i++) {
+    CHECK_EQ(dst[i], 0xA5);
+  }
+  for (std::size_t i = OFFSET + count * 3; i < dst.size(); i++) {
+    CHECK_EQ(dst[i], 0xA5);
+  }
+}
+
+} // namespace
+
+int main() {
+  CHECK(nibble_palette().nibble_indexed());
+  CHECK(!wide_palette().nibble_indexed());
+
+  pcg32 random(7);
+  for (const palette &pal : {nibble_palette(), wide_palette()}) {
+    const expansion e = make_expansion(random, pal);
+    for (palette_isa isa : isas) {
+      for (std::size_t count : lengths) {
+        expands_rgba32(isa, pal, e, count);
+        expands_rgb24(isa, pal, e, count);
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,99 @@
+#include "check.h"
+#include "programs.h"
+#include <cpu/cpu.h>
+#include <cpu/interpreter.h>
+#include <cpu/profiler.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// A profiled run charges each instruction's cycles to the call stack it ran
+// in, followed through JSR and RTS, and counts the taken backward branches
+// that close loops. The profile is the same on every engine.
+
+using namespace nes_simulator;
+namespace programs = nes_simulator::test_programs;
+
+namespace {
+
+constexpr Engine engines[] = {Engine::Switch, Engine::Threaded,
+                              Engine::Cached, Engine::Jit};
+
+// The root calls `outer`, which calls `count`, then calls `count` itself.
+const std::vector<uint8> calls = {
+    0x20, 0x07, 0x06, //   JSR outer
+    0x20, 0x0B, 0x06, //   JSR count
+    0x00,             //   BRK
+    0x20, 0x0B, 0x06, // outer: JSR count
+    0x60,             //   RTS
+    0xA2, 0x03,       // count: LDX #$03
+    0xCA,             // loop: DEX
+    0xD0, 0xFD,       //   BNE loop
+    0x60,             //   RTS
+};
+
+// LDX 2, DEX 3 x 2, BNE 3 + 3 + 2, RTS 6.
+constexpr uint64 COUNT_CYCLES = 22;
+// JSR 6, RTS 6.
+constexpr uint64 OUTER_CYCLES = 12;
+
+std::string profile(Engine engine, const programs::program &program,
+                    profiler &prof) {
+  cpu c;
+  c.engine = engine;
+  programs::load(c, program);
+  c.run_until(prof.profiled([](const cpu &) { return false; }));
+  prof.settle(c);
+  CHECK(c.halted);
+  std::ostringstream folded;
+  prof.write_folded(folded);
+  return folded.str();
+}
+
+void folds_calls(Engine engine) {
+  cpu c;
+  programs::load(c, {"calls", calls});
+  const uint64 start = c.cycles;
+  c.run();
+  const uint64 root = c.cycles - start - 2 * COUNT_CYCLES - OUTER_CYCLES;
+
+  profiler prof;
+  const auto folded = profile(engine, {"calls", calls}, prof);
+  CHECK(folded == "$0600 " + std::to_string(root) + "\n" +
+                      "$0600;$0607 " + std::to_string(OUTER_CYCLES) + "\n" +
+                      "$0600;$0607;$060B " + std::to_string(COUNT_CYCLES) +
+                      "\n" + "$0600;$060B " + std::to_string(COUNT_CYCLES) +
+                      "\n");
+
+  CHECK_EQ(prof.at(0x060D).instructions, uint64{6});
+  CHECK_EQ(prof.at(0x060D).cycles, uint64{12});
+  CHECK_EQ(prof.at(0x0606).instructions, uint64{1});
+
+  std::ostringstream loops;
+  prof.write_hot_loops(loops, 10);
+  CHECK(loops.str().starts_with("loop $060D-$060E iterations 4 cycles 28 "));
+  CHECK(loops.str().find('\n') == loops.str().size() - 1);
+}
+
+// Every engine gives the profile the switch loop gives on the shared
+// programs, the snake's deep calls included.
+void matches_switch(const programs::program &program) {
+  profiler reference;
+  const auto expected = profile(Engine::Switch, program, reference);
+  for (Engine engine : engines) {
+    profiler prof;
+    CHECK(profile(engine, program, prof) == expected);
+  }
+}
+
+} // namespace
+
+int main() {
+  for (Engine engine : engines) {
+    folds_calls(engine);
+  }
+  for (const auto &program : programs::all()) {
+    matches_switch(program);
+  }
+  return 0;
+}
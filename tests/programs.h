@@ -0,0 +1,176 @@
+#pragma once
+
+#include <cpu/cpu.h>
+#include <iterator>
+#include <programs/snake.h>
+#include <utils/types.h>
+#include <vector>
+
+// Programs the tests run on every engine. Each is loaded at $0600 and runs
+// from reset until it halts; together they cover every addressing mode,
+// page crossings, the stack, calls, the flags and code that rewrites
+// itself.
+namespace nes_simulator::test_programs {
+
+struct program {
+  const char *name;
+  std::vector<uint8> code;
+};
+
+// 256 rounds of ALU, shift, rotate, compare and flag instructions with the
+// results kept in zero page, branching on every flag and moving the stack
+// pointer through TXS.
+inline const std::vector<uint8> alu_loop = {
+    0xA0, 0x00, //   LDY #$00
+    0x98,       // loop: TYA
+    0x18,       //   CLC
+    0x65, 0x11, //   ADC $11
+    0x85, 0x11, //   STA $11
+    0x38,       //   SEC
+    0xE5, 0x12, //   SBC $12
+    0x85, 0x12, //   STA $12
+    0x50, 0x02, //   BVC no_overflow
+    0xE6, 0x13, //   INC $13
+    0x49, 0x5A, // no_overflow: EOR #$5A
+    0x25, 0x11, //   AND $11
+    0x09, 0x03, //   ORA #$03
+    0x06, 0x10, //   ASL $10
+    0x26, 0x14, //   ROL $14
+    0x46, 0x15, //   LSR $15
+    0x66, 0x16, //   ROR $16
+    0x0A,       //   ASL A
+    0x2A,       //   ROL A
+    0x4A,       //   LSR A
+    0x6A,       //   ROR A
+    0x85, 0x17, //   STA $17
+    0x24, 0x17, //   BIT $17
+    0x30, 0x02, //   BMI negative
+    0xE6, 0x18, //   INC $18
+    0x70, 0x02, // negative: BVS overflow
+    0xC6, 0x19, //   DEC $19
+    0xC5, 0x11, // overflow: CMP $11
+    0x90, 0x02, //   BCC less
+    0xE6, 0x1A, //   INC $1A
+    0xC0, 0x80, // less: CPY #$80
+    0xB0, 0x02, //   BCS high
+    0xC6, 0x1B, //   DEC $1B
+    0x08,       // high: PHP
+    0x68,       //   PLA
+    0x85, 0x1C, //   STA $1C
+    0x48,       //   PHA
+    0x28,       //   PLP
+    0xBA,       //   TSX
+    0x86, 0x1D, //   STX $1D
+    0xA2, 0xF0, //   LDX #$F0
+    0x9A,       //   TXS
+    0x08,       //   PHP
+    0xA6, 0x1D, //   LDX $1D
+    0x9A,       //   TXS
+    0xB8,       //   CLV
+    0x88,       //   DEY
+    0xD0, 0xB3, //   BNE loop
+    0x00,       //   BRK
+};
+
+// Fills two pages through abs,X across a page boundary, then reads them
+// back through (zp),Y, abs,Y and (zp,X) pointers and zp,X.
+inline const std::vector<uint8> addressing = {
+    0xA9, 0xF0,       //   LDA #$F0
+    0x85, 0x20,       //   STA $20
+    0xA9, 0x02,       //   LDA #$02
+    0x85, 0x21,       //   STA $21
+    0xA9, 0x00,       //   LDA #$00
+    0x85, 0x30,       //   STA $30
+    0xA9, 0x05,       //   LDA #$05
+    0x85, 0x31,       //   STA $31
+    0xA2, 0x00,       //   LDX #$00
+    0x8A,             // fill: TXA
+    0x9D, 0xF0, 0x02, //   STA $02F0,X
+    0x49, 0xFF,       //   EOR #$FF
+    0x9D, 0x00, 0x04, //   STA $0400,X
+    0xE8,             //   INX
+    0xD0, 0xF4,       //   BNE fill
+    0xA0, 0x00,       //   LDY #$00
+    0xB1, 0x20,       // sum: LDA ($20),Y
+    0x18,             //   CLC
+    0x79, 0x00, 0x04, //   ADC $0400,Y
+    0x99, 0x00, 0x05, //   STA $0500,Y
+    0x79, 0xFF, 0x04, //   ADC $04FF,Y
+    0xAA,             //   TAX
+    0xA1, 0x30,       //   LDA ($30,X)
+    0x99, 0x00, 0x08, //   STA $0800,Y
+    0xC8,             //   INY
+    0xD0, 0xEB,       //   BNE sum
+    0xA2, 0x3F,       //   LDX #$3F
+    0xBD, 0x00, 0x05, // zero_page: LDA $0500,X
+    0x95, 0x40,       //   STA $40,X
+    0xB4, 0x40,       //   LDY $40,X
+    0x98,             //   TYA
+    0x9D, 0x00, 0x07, //   STA $0700,X
+    0xCA,             //   DEX
+    0x10, 0xF2,       //   BPL zero_page
+    0x00,             //   BRK
+};
+
+// Nested JSR/RTS with PHA/PLA around them, then a JMP through a pointer at
+// $02FF, whose high byte comes from $0200.
+inline const std::vector<uint8> calls = {
+    0xA2, 0x20,       //   LDX #$20
+    0x20, 0x1B, 0x06, // outer: JSR square
+    0xCA,             //   DEX
+    0xD0, 0xFA,       //   BNE outer
+    0xA9, 0x16,       //   LDA #<done
+    0x8D, 0xFF, 0x02, //   STA $02FF
+    0xA9, 0x06,       //   LDA #>done
+    0x8D, 0x00, 0x02, //   STA $0200
+    0x6C, 0xFF, 0x02, //   JMP ($02FF)
+    0x00,             //   BRK
+    0xA9, 0x01,       // done: LDA #$01
+    0x85, 0x60,       //   STA $60
+    0x00,             //   BRK
+    0x8A,             // square: TXA
+    0x48,             //   PHA
+    0x20, 0x25, 0x06, //   JSR double
+    0x9D, 0x00, 0x03, //   STA $0300,X
+    0x68,             //   PLA
+    0x60,             //   RTS
+    0x0A,             // double: ASL A
+    0x26, 0x61,       //   ROL $61
+    0x60,             //   RTS
+};
+
+// Rewrites the operand of the instruction at the top of its loop on every
+// pass, then the opcode just ahead of it.
+inline const std::vector<uint8> self_modifying = {
+    0xA2, 0x00,       //   LDX #$00
+    0xA9, 0x00,       // loop: LDA #$00
+    0x18,             //   CLC
+    0x69, 0x03,       //   ADC #$03
+    0x8D, 0x03, 0x06, //   STA loop+1
+    0x9D, 0x00, 0x03, //   STA $0300,X
+    0xE8,             //   INX
+    0xD0, 0xF2,       //   BNE loop
+    0xA9, 0xE8,       //   LDA #$E8
+    0x8D, 0x15, 0x06, //   STA patch
+    0xEA,             // patch: NOP
+    0x8E, 0x10, 0x03, //   STX $0310
+    0x00,             //   BRK
+};
+
+inline std::vector<program> all() {
+  return {
+      {"alu_loop", alu_loop},
+      {"addressing", addressing},
+      {"calls", calls},
+      {"self_modifying", self_modifying},
+      // Without input the snake runs into the wall and the game halts.
+      {"snake", {std::begin(snake::game_code), std::end(snake::game_code)}},
+  };
+}
+
+inline void load(cpu &c, const program &p) {
+  c.load(p.code.data(), static_cast<int>(p.code.size()));
+  c.reset();
+}
+
+} // namespace nes_simulator::test_programs
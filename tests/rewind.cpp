@@ -0,0 +1,121 @@
+#include "check.h"
+#include "programs.h"
+#include <cpu/cpu.h>
+#include <cpu/rewind.h>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+// Stepping back through a rewind buffer restores the recorded frames newest
+// first, on every engine, and the machine runs on from each as it did the
+// first time. The buffer never holds more frames or bytes than it was given,
+// dropping the oldest frames to stay inside both.
+
+using namespace nes_simulator;
+namespace programs = nes_simulator::test_programs;
+
+namespace {
+
+constexpr Engine engines[] = {Engine::Switch, Engine::Threaded,
+                              Engine::Cached, Engine::Jit};
+
+// alu_loop runs some 10,000 instructions, so every frame here runs.
+constexpr uint64 FRAME_INSTRUCTIONS = 50;
+
+// Runs `frames` frames, recording each, and returns the digest after each.
+std::vector<uint64> record_frames(cpu &c, rewind_buffer &rewind,
+                                  uint32 frames) {
+  std::vector<uint64> digests;
+  for (uint32 frame = 0; frame < frames; frame++) {
+    c.run_instructions(FRAME_INSTRUCTIONS);
+    rewind.record(c);
+    digests.push_back(c.state_digest());
+  }
+  return digests;
+}
+
+void steps_back(Engine engine) {
+  cpu c;
+  c.engine = engine;
+  programs::load(c, {"alu_loop", programs::alu_loop});
+  rewind_buffer rewind(8, 1 << 20);
+  auto digests = record_frames(c, rewind, 20);
+  CHECK_EQ(rewind.frames(), uint32{8});
+
+  for (uint32 back = 1; back <= 8; back++) {
+    CHECK(rewind.step_back(c));
+    CHECK_EQ(c.state_digest(), digests[19 - back]);
+    CHECK_EQ(rewind.frames(), 8 - back);
+  }
+  // Out of history: the oldest frame held stays.
+  CHECK(!rewind.step_back(c));
+  CHECK_EQ(c.state_digest(), digests[11]);
+
+  // Recording goes on from the frame stepped back to.
+  digests.resize(12);
+  const auto again = record_frames(c, rewind, 3);
+  digests.insert(digests.end(), again.begin(), again.end());
+  CHECK(rewind.step_back(c));
+  CHECK_EQ(c.state_digest(), digests[13]);
+  c.run_instructions(FRAME_INSTRUCTIONS);
+  CHECK_EQ(c.state_digest(), digests[14]);
+}
+
+void stays_under_byte_cap() {
+  constexpr uint32 cap = 512;
+  cpu c;
+  programs::load(c, {"alu_loop", programs::alu_loop});
+  rewind_buffer rewind(1000, cap);
+  std::vector<uint64> digests;
+  for (uint32 frame = 0; frame < 100; frame++) {
+    c.run_instructions(FRAME_INSTRUCTIONS);
+    rewind.record(c);
+    digests.push_back(c.state_digest());
+    CHECK(rewind.bytes_used() <= cap);
+  }
+  const uint32 held = rewind.frames();
+  CHECK(held > 1);
+  CHECK(held < 99);
+  for (uint32 back = 1; back <= held; back++) {
+    CHECK(rewind.step_back(c));
+    CHECK_EQ(c.state_digest(), digests[99 - back]);
+  }
+  CHECK(!rewind.step_back(c));
+  CHECK_EQ(rewind.bytes_used(), std::size_t{0});
+}
+
+// A frame whose record cannot fit at all leaves nothing to step back
+// through but the newest frame.
+void drops_records_that_never_fit() {
+  cpu c;
+  programs::load(c, {"alu_loop", programs::alu_loop});
+  rewind_buffer rewind(8, 16);
+  const auto digests = record_frames(c, rewind, 4);
+  CHECK_EQ(rewind.frames(), uint32{0});
+  CHECK_EQ(rewind.bytes_used(), std::size_t{0});
+  c.run_instructions(FRAME_INSTRUCTIONS);
+  CHECK(!rewind.step_back(c));
+  CHECK_EQ(c.state_digest(), digests.back());
+}
+
+bool rejects(uint32 frames, std::size_t bytes) {
+  try {
+    rewind_buffer rewind(frames, bytes);
+  } catch (const std::runtime_error &) {
+    return true;
+  }
+  return false;
+}
+
+} // namespace
+
+int main() {
+  for (Engine engine : engines) {
+    steps_back(engine);
+  }
+  stays_under_byte_cap();
+  drops_records_that_never_fit();
+  CHECK(rejects(0, 1024));
+  CHECK(rejects(8, 0));
+  return 0;
+}
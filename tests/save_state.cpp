@@ -0,0 +1,141 @@
+#include "check.h"
+#include "programs.h"
+#include <cpu/cpu.h>
+#include <cpu/save_state.h>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+// A restored state runs on exactly as the saved machine did, on every
+// engine, code the program or the host rewrote included. Deltas hold only
+// the pages written since the previous save, and restore the machine as it
+// was when they were taken.
+
+using namespace nes_simulator;
+namespace programs = nes_simulator::test_programs;
+
+namespace {
+
+constexpr Engine engines[] = {Engine::Switch, Engine::Threaded,
+                              Engine::Cached, Engine::Jit};
+
+void run_to_halt(cpu &c) {
+  for (int batch = 0; !c.halted; batch++) {
+    CHECK(batch < 1000000);
+    c.run_instructions(1000);
+  }
+}
+
+void restores_and_reruns(Engine engine, const programs::program &program) {
+  cpu c;
+  c.engine = engine;
+  programs::load(c, program);
+  auto start = std::make_unique<save_state>();
+  c.save(*start);
+  const uint64 start_digest = c.state_digest();
+
+  run_to_halt(c);
+  const uint64 end_digest = c.state_digest();
+  const uint64 instructions = c.instructions;
+
+  c.restore(*start);
+  CHECK_EQ(c.state_digest(), start_digest);
+  CHECK_EQ(c.instructions, start->registers.instructions);
+  CHECK(!c.halted);
+  run_to_halt(c);
+  CHECK_EQ(c.state_digest(), end_digest);
+  CHECK_EQ(c.instructions, instructions);
+}
+
+// The engines must drop what they decoded from code a restore replaces,
+// here a loop bound patched in after the save and run once.
+void restores_code(Engine engine) {
+  const std::vector<uint8> code = {
+      0xA2, 0x00, //   LDX #$00
+      0xE8,       // loop: INX
+      0xE0, 0x03, //   CPX #$03
+      0xD0, 0xFB, //   BNE loop
+      0x86, 0x10, //   STX $10
+      0x00,       //   BRK
+  };
+  cpu c;
+  c.engine = engine;
+  c.load(code.data(), static_cast<int>(code.size()));
+  c.reset();
+  auto start = std::make_unique<save_state>();
+  c.save(*start);
+
+  c.mem_write(0x0604, 0x05);
+  run_to_halt(c);
+  CHECK_EQ(c.memory[0x10], 5);
+
+  c.restore(*start);
+  run_to_halt(c);
+  CHECK_EQ(c.memory[0x10], 3);
+}
+
+// alu_loop writes its results to zero page and pushes onto the stack, and
+// writes nothing else.
+void deltas_hold_written_pages() {
+  cpu c;
+  programs::load(c, {"alu_loop", programs::alu_loop});
+  state_delta delta;
+  bool threw = false;
+  try {
+    c.save_delta(delta);
+  } catch (const std::runtime_error &) {
+    threw = true;
+  }
+  CHECK(threw);
+
+  auto start = std::make_unique<save_state>();
+  c.save(*start);
+  const uint64 start_digest = c.state_digest();
+
+  c.run_instructions(200);
+  state_delta first;
+  c.save_delta(first);
+  CHECK(first.pages == std::vector<uint8>({0x00, 0x01}));
+  CHECK_EQ(first.data.size(), 2 * memory_bus::PAGE_SIZE);
+  const uint64 first_digest = c.state_digest();
+
+  state_delta idle;
+  c.save_delta(idle);
+  CHECK(idle.pages.empty());
+  CHECK(idle.data.empty());
+
+  c.mem_write(0x2345, 0x67);
+  c.run_instructions(200);
+  state_delta second;
+  c.save_delta(second);
+  CHECK(second.pages == std::vector<uint8>({0x00, 0x01, 0x23}));
+  const uint64 second_digest = c.state_digest();
+
+  c.restore(*start);
+  CHECK_EQ(c.state_digest(), start_digest);
+  c.restore(first);
+  CHECK_EQ(c.state_digest(), first_digest);
+  c.restore(idle);
+  c.restore(second);
+  CHECK_EQ(c.state_digest(), second_digest);
+
+  // Rolled forward, the full state is the machine at the last delta.
+  start->apply(first);
+  start->apply(second);
+  c.restore(*start);
+  CHECK_EQ(c.state_digest(), second_digest);
+  CHECK_EQ(c.instructions, uint64{400});
+}
+
+} // namespace
+
+int main() {
+  for (Engine engine : engines) {
+    for (const auto &program : programs::all()) {
+      restores_and_reruns(engine, program);
+    }
+    restores_code(engine);
+  }
+  deltas_hold_written_pages();
+  return 0;
+}
@@ -0,0 +1,129 @@
+#include "check.h"
+#include "programs.h"
+#include <cpu/cpu.h>
+#include <cpu/interpreter.h>
+#include <cpu/trace.h>
+#include <filesystem>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// A traced run on any engine writes one record per instruction, the cpu as
+// it stood before each, and reading the file back gives exactly what the
+// switch loop shows stepping through the same program one instruction at a
+// time. The writer's ring is kept small so that the emulation thread has
+// to wait for it.
+
+using namespace nes_simulator;
+namespace programs = nes_simulator::test_programs;
+
+namespace {
+
+constexpr Engine engines[] = {Engine::Switch, Engine::Threaded,
+                              Engine::Cached, Engine::Jit};
+
+trace_record expected_record(const cpu &c) {
+  trace_record r{};
+  r.pc = c.pc;
+  r.opcode = c.fetch(c.pc);
+  r.reg_a = c.reg_a;
+  r.reg_x = c.reg_x;
+  r.reg_y = c.reg_y;
+  r.status = c.status;
+  r.sp = c.sp;
+  r.operand = c.fetch(c.pc + 1) | c.fetch(c.pc + 2) << 8;
+  r.cycles_high = c.cycles >> 32;
+  r.cycles_low = c.cycles;
+  return r;
+}
+
+std::vector<trace_record> step_through(const programs::program &program) {
+  cpu c;
+  c.engine = Engine::Switch;
+  programs::load(c, program);
+  std::vector<trace_record> records;
+  while (!c.halted) {
+    records.push_back(expected_record(c));
+    c.run_instructions(1);
+  }
+  return records;
+}
+
+std::vector<trace_record> read_all(const std::string &path) {
+  trace_reader reader(path);
+  std::vector<trace_record> records;
+  trace_record block[100];
+  while (const std::size_t count = reader.read(block, std::size(block))) {
+    records.insert(records.end(), block, block + count);
+  }
+  return records;
+}
+
+void round_trips(Engine engine, const programs::program &program,
+                 const std::vector<trace_record> &expected) {
+  const auto path = std::filesystem::temp_directory_path() /
+                    ("nes_trace_test_" + std::string(program.name) + ".bin");
+  cpu c;
+  c.engine = engine;
+  programs::load(c, program);
+  {
+    trace_writer writer(path.string(), 64);
+    c.trace_to(&writer);
+    for (int batch = 0; !c.halted; batch++) {
+      CHECK(batch < 1000000);
+      c.run_instructions<debug_policy>(1000);
+    }
+    c.trace_to(nullptr);
+    CHECK_EQ(writer.records(), c.instructions);
+    writer.close();
+  }
+
+  const auto records = read_all(path.string());
+  std::filesystem::remove(path);
+  CHECK_EQ(records.size(), expected.size());
+  for (std::size_t i = 0; i < records.size(); i++) {
+    const trace_record &got = records[i];
+    const trace_record &want = expected[i];
+    CHECK_EQ(got.pc, want.pc);
+    CHECK_EQ(got.opcode, want.opcode);
+    CHECK_EQ(got.reg_a, want.reg_a);
+    CHECK_EQ(got.reg_x, want.reg_x);
+    CHECK_EQ(got.reg_y, want.reg_y);
+    CHECK_EQ(got.status, want.status);
+    CHECK_EQ(got.sp, want.sp);
+    CHECK_EQ(got.operand, want.operand);
+    CHECK_EQ(got.cycles(), want.cycles());
+  }
+}
+
+// A file that is not a trace is turned away before any records are read.
+void rejects_other_files() {
+  const auto path =
+      std::filesystem::temp_directory_path() / "nes_trace_test_bad.bin";
+  std::FILE *out = std::fopen(path.c_str(), "wb");
+  CHECK(out != nullptr);
+  CHECK(std::fputs("NESMOVIE and then some", out) >= 0);
+  std::fclose(out);
+  bool threw = false;
+  try {
+    trace_reader reader(path.string());
+  } catch (const std::runtime_error &) {
+    threw = true;
+  }
+  std::filesystem::remove(path);
+  CHECK(threw);
+}
+
+} // namespace
+
+int main() {
+  for (const auto &program : programs::all()) {
+    const auto expected = step_through(program);
+    for (Engine engine : engines) {
+      round_trips(engine, program, expected);
+    }
+  }
+  rejects_other_files();
+  return 0;
+}
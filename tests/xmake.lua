@@ -0,0 +1,12 @@
+-- One binary per file; `xmake test` builds and runs them all.
+for _, file in ipairs(os.files(path.join(os.scriptdir(), "*.cpp"))) do
+  local name = path.basename(file)
+  target("test_" .. name)
+    set_kind("binary")
+    set_group("tests")
+    set_default(false)
+    add_files(name .. ".cpp")
+    add_includedirs(".")
+    add_deps("cpu", "cartridge", "frontend", "runner")
+    add_tests("default")
+end
@@ -7,8 +7,8 @@ set_toolset('cxx', "clang++")
 add_languages("c99", "cxx23")
 
 add_requires("libsdl")
-add_packages("libsdl")
 
 add_includedirs("src")
 
-includes("src")
\ No newline at end of file
+includes("src")
+includes("tests")